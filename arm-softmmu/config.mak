@@ -0,0 +1,5 @@
+# Automatically generated by configure - do not modify
+include ../config-host.mak
+TARGET_ARCH=arm
+CONFIG_SOFTMMU=yes
+CONFIG_SOFTFLOAT=yes
@@ -0,0 +1,465 @@
+#include "dyngen-op.h"
+static inline void gen_op_movl_T0_r0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r0;
+}
+
+static inline void gen_op_movl_T1_r0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r0;
+}
+
+static inline void gen_op_movl_T2_r0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r0;
+}
+
+static inline void gen_op_movl_r0_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r0_T0;
+}
+
+static inline void gen_op_movl_r0_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r0_T1;
+}
+
+static inline void gen_op_movl_T0_r1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r1;
+}
+
+static inline void gen_op_movl_T1_r1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r1;
+}
+
+static inline void gen_op_movl_T2_r1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r1;
+}
+
+static inline void gen_op_movl_r1_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r1_T0;
+}
+
+static inline void gen_op_movl_r1_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r1_T1;
+}
+
+static inline void gen_op_movl_T0_r2(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r2;
+}
+
+static inline void gen_op_movl_T1_r2(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r2;
+}
+
+static inline void gen_op_movl_T2_r2(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r2;
+}
+
+static inline void gen_op_movl_r2_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r2_T0;
+}
+
+static inline void gen_op_movl_r2_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r2_T1;
+}
+
+static inline void gen_op_movl_T0_r3(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r3;
+}
+
+static inline void gen_op_movl_T1_r3(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r3;
+}
+
+static inline void gen_op_movl_T2_r3(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r3;
+}
+
+static inline void gen_op_movl_r3_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r3_T0;
+}
+
+static inline void gen_op_movl_r3_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r3_T1;
+}
+
+static inline void gen_op_movl_T0_r4(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r4;
+}
+
+static inline void gen_op_movl_T1_r4(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r4;
+}
+
+static inline void gen_op_movl_T2_r4(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r4;
+}
+
+static inline void gen_op_movl_r4_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r4_T0;
+}
+
+static inline void gen_op_movl_r4_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r4_T1;
+}
+
+static inline void gen_op_movl_T0_r5(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r5;
+}
+
+static inline void gen_op_movl_T1_r5(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r5;
+}
+
+static inline void gen_op_movl_T2_r5(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r5;
+}
+
+static inline void gen_op_movl_r5_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r5_T0;
+}
+
+static inline void gen_op_movl_r5_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r5_T1;
+}
+
+static inline void gen_op_movl_T0_r6(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r6;
+}
+
+static inline void gen_op_movl_T1_r6(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r6;
+}
+
+static inline void gen_op_movl_T2_r6(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r6;
+}
+
+static inline void gen_op_movl_r6_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r6_T0;
+}
+
+static inline void gen_op_movl_r6_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r6_T1;
+}
+
+static inline void gen_op_movl_T0_r7(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r7;
+}
+
+static inline void gen_op_movl_T1_r7(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r7;
+}
+
+static inline void gen_op_movl_T2_r7(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r7;
+}
+
+static inline void gen_op_movl_r7_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r7_T0;
+}
+
+static inline void gen_op_movl_r7_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r7_T1;
+}
+
+static inline void gen_op_movl_T0_r8(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r8;
+}
+
+static inline void gen_op_movl_T1_r8(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r8;
+}
+
+static inline void gen_op_movl_T2_r8(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r8;
+}
+
+static inline void gen_op_movl_r8_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r8_T0;
+}
+
+static inline void gen_op_movl_r8_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r8_T1;
+}
+
+static inline void gen_op_movl_T0_r9(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r9;
+}
+
+static inline void gen_op_movl_T1_r9(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r9;
+}
+
+static inline void gen_op_movl_T2_r9(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r9;
+}
+
+static inline void gen_op_movl_r9_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r9_T0;
+}
+
+static inline void gen_op_movl_r9_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r9_T1;
+}
+
+static inline void gen_op_movl_T0_r10(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r10;
+}
+
+static inline void gen_op_movl_T1_r10(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r10;
+}
+
+static inline void gen_op_movl_T2_r10(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r10;
+}
+
+static inline void gen_op_movl_r10_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r10_T0;
+}
+
+static inline void gen_op_movl_r10_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r10_T1;
+}
+
+static inline void gen_op_movl_T0_r11(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r11;
+}
+
+static inline void gen_op_movl_T1_r11(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r11;
+}
+
+static inline void gen_op_movl_T2_r11(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r11;
+}
+
+static inline void gen_op_movl_r11_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r11_T0;
+}
+
+static inline void gen_op_movl_r11_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r11_T1;
+}
+
+static inline void gen_op_movl_T0_r12(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r12;
+}
+
+static inline void gen_op_movl_T1_r12(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r12;
+}
+
+static inline void gen_op_movl_T2_r12(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r12;
+}
+
+static inline void gen_op_movl_r12_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r12_T0;
+}
+
+static inline void gen_op_movl_r12_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r12_T1;
+}
+
+static inline void gen_op_movl_T0_r13(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r13;
+}
+
+static inline void gen_op_movl_T1_r13(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r13;
+}
+
+static inline void gen_op_movl_T2_r13(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r13;
+}
+
+static inline void gen_op_movl_r13_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r13_T0;
+}
+
+static inline void gen_op_movl_r13_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r13_T1;
+}
+
+static inline void gen_op_movl_T0_r14(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r14;
+}
+
+static inline void gen_op_movl_T1_r14(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r14;
+}
+
+static inline void gen_op_movl_T2_r14(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r14;
+}
+
+static inline void gen_op_movl_r14_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r14_T0;
+}
+
+static inline void gen_op_movl_r14_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r14_T1;
+}
+
+static inline void gen_op_movl_T0_r15(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_r15;
+}
+
+static inline void gen_op_movl_T1_r15(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T1_r15;
+}
+
+static inline void gen_op_movl_T2_r15(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T2_r15;
+}
+
+static inline void gen_op_movl_r15_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r15_T0;
+}
+
+static inline void gen_op_movl_r15_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_r15_T1;
+}
+
+static inline void gen_op_bx_T0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_bx_T0;
+}
+
+static inline void gen_op_movl_T0_0(void)
+{
+    *gen_opc_ptr++ = INDEX_op_movl_T0_0;
+}
+
+static inline void gen_op_movl_T0_im(long param1)
+{
+    *gen_opparam_ptr++ = param1;
+    *gen_opc_ptr++ = INDEX_op_movl_T0_im;
+}
+
+static inline void gen_op_movl_T1_im(long param1)
+{
+    *gen_opparam_ptr++ = param1;
+    *gen_opc_ptr++ = INDEX_op_movl_T1_im;
+}
+
+static inline void gen_op_mov_CF_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_mov_CF_T1;
+}
+
+static inline void gen_op_movl_T2_im(long param1)
+{
+    *gen_opparam_ptr++ = param1;
+    *gen_opc_ptr++ = INDEX_op_movl_T2_im;
+}
+
+static inline void gen_op_addl_T1_im(long param1)
+{
+    *gen_opparam_ptr++ = param1;
+    *gen_opc_ptr++ = INDEX_op_addl_T1_im;
+}
+
+static inline void gen_op_addl_T1_T2(void)
+{
+    *gen_opc_ptr++ = INDEX_op_addl_T1_T2;
+}
+
+static inline void gen_op_subl_T1_T2(void)
+{
+    *gen_opc_ptr++ = INDEX_op_subl_T1_T2;
+}
+
+static inline void gen_op_addl_T0_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_addl_T0_T1;
+}
+
+static inline void gen_op_addl_T0_T1_cc(void)
+{
+    *gen_opc_ptr++ = INDEX_op_addl_T0_T1_cc;
+}
+
+static inline void gen_op_adcl_T0_T1(void)
+{
+    *gen_opc_ptr++ = INDEX_op_adcl_T0_T1;
+}
+
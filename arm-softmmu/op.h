@@ -0,0 +1,669 @@
+int dyngen_code(uint8_t *gen_code_buf,
+                uint16_t *label_offsets, uint16_t *jmp_offsets,
+                const uint16_t *opc_buf, const uint32_t *opparam_buf, const long *gen_labels)
+{
+    uint8_t *gen_code_ptr;
+    const uint16_t *opc_ptr;
+    const uint32_t *opparam_ptr;
+
+    gen_code_ptr = gen_code_buf;
+    opc_ptr = opc_buf;
+    opparam_ptr = opparam_buf;
+    for(;;) {
+        switch(*opc_ptr++) {
+case INDEX_op_movl_T0_r0: {
+    extern void op_movl_T0_r0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r0+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_T1_r0: {
+    extern void op_movl_T1_r0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r0+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_T2_r0: {
+    extern void op_movl_T2_r0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r0+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_r0_T0: {
+    extern void op_movl_r0_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r0_T0+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_r0_T1: {
+    extern void op_movl_r0_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r0_T1+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_T0_r1: {
+    extern void op_movl_T0_r1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r1: {
+    extern void op_movl_T1_r1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r1: {
+    extern void op_movl_T2_r1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r1_T0: {
+    extern void op_movl_r1_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r1_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r1_T1: {
+    extern void op_movl_r1_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r1_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r2: {
+    extern void op_movl_T0_r2();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r2+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r2: {
+    extern void op_movl_T1_r2();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r2+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r2: {
+    extern void op_movl_T2_r2();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r2+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r2_T0: {
+    extern void op_movl_r2_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r2_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r2_T1: {
+    extern void op_movl_r2_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r2_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r3: {
+    extern void op_movl_T0_r3();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r3+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r3: {
+    extern void op_movl_T1_r3();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r3+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r3: {
+    extern void op_movl_T2_r3();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r3+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r3_T0: {
+    extern void op_movl_r3_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r3_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r3_T1: {
+    extern void op_movl_r3_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r3_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r4: {
+    extern void op_movl_T0_r4();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r4+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r4: {
+    extern void op_movl_T1_r4();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r4+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r4: {
+    extern void op_movl_T2_r4();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r4+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r4_T0: {
+    extern void op_movl_r4_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r4_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r4_T1: {
+    extern void op_movl_r4_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r4_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r5: {
+    extern void op_movl_T0_r5();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r5+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r5: {
+    extern void op_movl_T1_r5();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r5+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r5: {
+    extern void op_movl_T2_r5();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r5+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r5_T0: {
+    extern void op_movl_r5_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r5_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r5_T1: {
+    extern void op_movl_r5_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r5_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r6: {
+    extern void op_movl_T0_r6();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r6+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r6: {
+    extern void op_movl_T1_r6();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r6+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r6: {
+    extern void op_movl_T2_r6();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r6+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r6_T0: {
+    extern void op_movl_r6_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r6_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r6_T1: {
+    extern void op_movl_r6_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r6_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r7: {
+    extern void op_movl_T0_r7();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r7+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r7: {
+    extern void op_movl_T1_r7();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r7+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r7: {
+    extern void op_movl_T2_r7();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r7+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r7_T0: {
+    extern void op_movl_r7_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r7_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r7_T1: {
+    extern void op_movl_r7_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r7_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r8: {
+    extern void op_movl_T0_r8();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r8+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r8: {
+    extern void op_movl_T1_r8();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r8+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r8: {
+    extern void op_movl_T2_r8();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r8+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r8_T0: {
+    extern void op_movl_r8_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r8_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r8_T1: {
+    extern void op_movl_r8_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r8_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r9: {
+    extern void op_movl_T0_r9();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r9+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r9: {
+    extern void op_movl_T1_r9();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r9+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r9: {
+    extern void op_movl_T2_r9();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r9+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r9_T0: {
+    extern void op_movl_r9_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r9_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r9_T1: {
+    extern void op_movl_r9_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r9_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r10: {
+    extern void op_movl_T0_r10();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r10+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r10: {
+    extern void op_movl_T1_r10();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r10+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r10: {
+    extern void op_movl_T2_r10();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r10+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r10_T0: {
+    extern void op_movl_r10_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r10_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r10_T1: {
+    extern void op_movl_r10_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r10_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r11: {
+    extern void op_movl_T0_r11();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r11+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r11: {
+    extern void op_movl_T1_r11();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r11+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r11: {
+    extern void op_movl_T2_r11();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r11+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r11_T0: {
+    extern void op_movl_r11_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r11_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r11_T1: {
+    extern void op_movl_r11_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r11_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r12: {
+    extern void op_movl_T0_r12();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r12+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r12: {
+    extern void op_movl_T1_r12();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r12+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r12: {
+    extern void op_movl_T2_r12();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r12+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r12_T0: {
+    extern void op_movl_r12_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r12_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r12_T1: {
+    extern void op_movl_r12_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r12_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r13: {
+    extern void op_movl_T0_r13();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r13+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r13: {
+    extern void op_movl_T1_r13();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r13+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r13: {
+    extern void op_movl_T2_r13();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r13+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r13_T0: {
+    extern void op_movl_r13_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r13_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r13_T1: {
+    extern void op_movl_r13_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r13_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r14: {
+    extern void op_movl_T0_r14();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r14+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r14: {
+    extern void op_movl_T1_r14();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r14+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r14: {
+    extern void op_movl_T2_r14();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r14+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r14_T0: {
+    extern void op_movl_r14_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r14_T0+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r14_T1: {
+    extern void op_movl_r14_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r14_T1+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T0_r15: {
+    extern void op_movl_T0_r15();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_r15+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T1_r15: {
+    extern void op_movl_T1_r15();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_r15+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_T2_r15: {
+    extern void op_movl_T2_r15();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_r15+0), 4);
+    gen_code_ptr += 4;
+}
+break;
+
+case INDEX_op_movl_r15_T0: {
+    extern void op_movl_r15_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r15_T0+0), 10);
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_movl_r15_T1: {
+    extern void op_movl_r15_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_r15_T1+0), 10);
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_bx_T0: {
+    extern void op_bx_T0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_bx_T0+0), 23);
+    gen_code_ptr += 23;
+}
+break;
+
+case INDEX_op_movl_T0_0: {
+    extern void op_movl_T0_0();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_0+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_movl_T0_im: {
+    long param1;
+    extern void op_movl_T0_im();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T0_im+0), 10);
+    param1 = *opparam_ptr++;
+    *(uint32_t *)(gen_code_ptr + 3) = param1 - (long)(gen_code_ptr + 3) + -4;
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_movl_T1_im: {
+    long param1;
+    extern void op_movl_T1_im();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T1_im+0), 10);
+    param1 = *opparam_ptr++;
+    *(uint32_t *)(gen_code_ptr + 3) = param1 - (long)(gen_code_ptr + 3) + -4;
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_mov_CF_T1: {
+    extern void op_mov_CF_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_mov_CF_T1+0), 13);
+    gen_code_ptr += 13;
+}
+break;
+
+case INDEX_op_movl_T2_im: {
+    long param1;
+    extern void op_movl_T2_im();
+    memcpy(gen_code_ptr, (void *)((char *)&op_movl_T2_im+0), 10);
+    param1 = *opparam_ptr++;
+    *(uint32_t *)(gen_code_ptr + 3) = param1 - (long)(gen_code_ptr + 3) + -4;
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_addl_T1_im: {
+    long param1;
+    extern void op_addl_T1_im();
+    memcpy(gen_code_ptr, (void *)((char *)&op_addl_T1_im+0), 10);
+    param1 = *opparam_ptr++;
+    *(uint32_t *)(gen_code_ptr + 3) = param1 - (long)(gen_code_ptr + 3) + -4;
+    gen_code_ptr += 10;
+}
+break;
+
+case INDEX_op_addl_T1_T2: {
+    extern void op_addl_T1_T2();
+    memcpy(gen_code_ptr, (void *)((char *)&op_addl_T1_T2+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_subl_T1_T2: {
+    extern void op_subl_T1_T2();
+    memcpy(gen_code_ptr, (void *)((char *)&op_subl_T1_T2+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_addl_T0_T1: {
+    extern void op_addl_T0_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_addl_T0_T1+0), 3);
+    gen_code_ptr += 3;
+}
+break;
+
+case INDEX_op_addl_T0_T1_cc: {
+    extern void op_addl_T0_T1_cc();
+    memcpy(gen_code_ptr, (void *)((char *)&op_addl_T0_T1_cc+0), 45);
+    gen_code_ptr += 45;
+}
+break;
+
+case INDEX_op_adcl_T0_T1: {
+    extern void op_adcl_T0_T1();
+    memcpy(gen_code_ptr, (void *)((char *)&op_adcl_T0_T1+0), 10);
+    gen_code_ptr += 10;
+}
+break;
+
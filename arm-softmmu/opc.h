@@ -0,0 +1,97 @@
+DEF(end, 0, 0)
+DEF(nop, 0, 0)
+DEF(nop1, 1, 0)
+DEF(nop2, 2, 0)
+DEF(nop3, 3, 0)
+DEF(movl_T0_r0, 0, 3)
+DEF(movl_T1_r0, 0, 3)
+DEF(movl_T2_r0, 0, 3)
+DEF(movl_r0_T0, 0, 3)
+DEF(movl_r0_T1, 0, 3)
+DEF(movl_T0_r1, 0, 4)
+DEF(movl_T1_r1, 0, 4)
+DEF(movl_T2_r1, 0, 4)
+DEF(movl_r1_T0, 0, 4)
+DEF(movl_r1_T1, 0, 4)
+DEF(movl_T0_r2, 0, 4)
+DEF(movl_T1_r2, 0, 4)
+DEF(movl_T2_r2, 0, 4)
+DEF(movl_r2_T0, 0, 4)
+DEF(movl_r2_T1, 0, 4)
+DEF(movl_T0_r3, 0, 4)
+DEF(movl_T1_r3, 0, 4)
+DEF(movl_T2_r3, 0, 4)
+DEF(movl_r3_T0, 0, 4)
+DEF(movl_r3_T1, 0, 4)
+DEF(movl_T0_r4, 0, 4)
+DEF(movl_T1_r4, 0, 4)
+DEF(movl_T2_r4, 0, 4)
+DEF(movl_r4_T0, 0, 4)
+DEF(movl_r4_T1, 0, 4)
+DEF(movl_T0_r5, 0, 4)
+DEF(movl_T1_r5, 0, 4)
+DEF(movl_T2_r5, 0, 4)
+DEF(movl_r5_T0, 0, 4)
+DEF(movl_r5_T1, 0, 4)
+DEF(movl_T0_r6, 0, 4)
+DEF(movl_T1_r6, 0, 4)
+DEF(movl_T2_r6, 0, 4)
+DEF(movl_r6_T0, 0, 4)
+DEF(movl_r6_T1, 0, 4)
+DEF(movl_T0_r7, 0, 4)
+DEF(movl_T1_r7, 0, 4)
+DEF(movl_T2_r7, 0, 4)
+DEF(movl_r7_T0, 0, 4)
+DEF(movl_r7_T1, 0, 4)
+DEF(movl_T0_r8, 0, 4)
+DEF(movl_T1_r8, 0, 4)
+DEF(movl_T2_r8, 0, 4)
+DEF(movl_r8_T0, 0, 4)
+DEF(movl_r8_T1, 0, 4)
+DEF(movl_T0_r9, 0, 4)
+DEF(movl_T1_r9, 0, 4)
+DEF(movl_T2_r9, 0, 4)
+DEF(movl_r9_T0, 0, 4)
+DEF(movl_r9_T1, 0, 4)
+DEF(movl_T0_r10, 0, 4)
+DEF(movl_T1_r10, 0, 4)
+DEF(movl_T2_r10, 0, 4)
+DEF(movl_r10_T0, 0, 4)
+DEF(movl_r10_T1, 0, 4)
+DEF(movl_T0_r11, 0, 4)
+DEF(movl_T1_r11, 0, 4)
+DEF(movl_T2_r11, 0, 4)
+DEF(movl_r11_T0, 0, 4)
+DEF(movl_r11_T1, 0, 4)
+DEF(movl_T0_r12, 0, 4)
+DEF(movl_T1_r12, 0, 4)
+DEF(movl_T2_r12, 0, 4)
+DEF(movl_r12_T0, 0, 4)
+DEF(movl_r12_T1, 0, 4)
+DEF(movl_T0_r13, 0, 4)
+DEF(movl_T1_r13, 0, 4)
+DEF(movl_T2_r13, 0, 4)
+DEF(movl_r13_T0, 0, 4)
+DEF(movl_r13_T1, 0, 4)
+DEF(movl_T0_r14, 0, 4)
+DEF(movl_T1_r14, 0, 4)
+DEF(movl_T2_r14, 0, 4)
+DEF(movl_r14_T0, 0, 4)
+DEF(movl_r14_T1, 0, 4)
+DEF(movl_T0_r15, 0, 4)
+DEF(movl_T1_r15, 0, 4)
+DEF(movl_T2_r15, 0, 4)
+DEF(movl_r15_T0, 0, 10)
+DEF(movl_r15_T1, 0, 10)
+DEF(bx_T0, 0, 23)
+DEF(movl_T0_0, 0, 3)
+DEF(movl_T0_im, 1, 10)
+DEF(movl_T1_im, 1, 10)
+DEF(mov_CF_T1, 0, 13)
+DEF(movl_T2_im, 1, 10)
+DEF(addl_T1_im, 1, 10)
+DEF(addl_T1_T2, 0, 3)
+DEF(subl_T1_T2, 0, 3)
+DEF(addl_T0_T1, 0, 3)
+DEF(addl_T0_T1_cc, 0, 45)
+DEF(adcl_T0_T1, 0, 10)
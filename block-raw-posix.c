@@ -29,6 +29,7 @@
 #include "block_int.h"
 #include <assert.h>
 #include <aio.h>
+#include <sys/mman.h>
 
 #ifdef CONFIG_COCOA
 #include <paths.h>
@@ -78,6 +79,8 @@ typedef struct BDRVRawState {
     int fd;
     int type;
     unsigned int lseek_err_cnt;
+    void *map;
+    int64_t map_size;
 #if defined(__linux__)
     /* linux floppy specific */
     int fd_open_flags;
@@ -459,6 +462,11 @@ static void raw_aio_cancel(BlockDriverAIOCB *blockacb)
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
+    if (s->map) {
+        msync(s->map, s->map_size, MS_SYNC);
+        munmap(s->map, s->map_size);
+        s->map = NULL;
+    }
     if (s->fd >= 0) {
         close(s->fd);
         s->fd = -1;
@@ -542,9 +550,33 @@ static int raw_create(const char *filename, int64_t total_size,
 static void raw_flush(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
+    if (s->map)
+        msync(s->map, s->map_size, MS_SYNC);
     fsync(s->fd);
 }
 
+static void *raw_mmap(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    int64_t size;
+    void *map;
+
+    if (s->map)
+        return s->map;
+    if (s->type != FTYPE_FILE || bs->read_only)
+        return NULL;
+
+    size = raw_getlength(bs);
+    if (size <= 0 || size != (size_t) size)
+        return NULL;
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    s->map = map;
+    s->map_size = size;
+    return map;
+}
+
 BlockDriver bdrv_raw = {
     "raw",
     sizeof(BDRVRawState),
@@ -565,6 +597,7 @@ BlockDriver bdrv_raw = {
     .bdrv_pwrite = raw_pwrite,
     .bdrv_truncate = raw_truncate,
     .bdrv_getlength = raw_getlength,
+    .bdrv_mmap = raw_mmap,
 };
 
 /***********************************************/
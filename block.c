@@ -24,6 +24,7 @@
 #include "qemu-common.h"
 #ifndef QEMU_IMG
 #include "console.h"
+#include "qemu-timer.h"
 #endif
 #include "block_int.h"
 
@@ -55,6 +56,10 @@ static int bdrv_read_em(BlockDriverState *bs, int64_t sector_num,
                         uint8_t *buf, int nb_sectors);
 static int bdrv_write_em(BlockDriverState *bs, int64_t sector_num,
                          const uint8_t *buf, int nb_sectors);
+static void bdrv_ra_reset(BlockDriverState *bs);
+static int bdrv_wb_flush(BlockDriverState *bs);
+static int bdrv_wb_sync(BlockDriverState *bs);
+static void bdrv_wb_discard(BlockDriverState *bs);
 
 BlockDriverState *bdrv_first;
 static BlockDriver *first_drv;
@@ -149,6 +154,7 @@ BlockDriverState *bdrv_new(const char *device_name)
     bs = qemu_mallocz(sizeof(BlockDriverState));
     if(!bs)
         return NULL;
+    bs->ra_fill = -1;
     pstrcpy(bs->device_name, sizeof(bs->device_name), device_name);
     if (device_name[0] != '\0') {
         /* insert at the end */
@@ -427,6 +433,10 @@ int bdrv_open2(BlockDriverState *bs, const char *filename, int flags,
 void bdrv_close(BlockDriverState *bs)
 {
     if (bs->drv) {
+        bdrv_ra_reset(bs);
+        bdrv_wb_sync(bs);
+        bdrv_wb_discard(bs);
+        bdrv_hash_reset(bs);
         if (bs->backing_hd)
             bdrv_delete(bs->backing_hd);
         bs->drv->bdrv_close(bs);
@@ -450,6 +460,8 @@ void bdrv_delete(BlockDriverState *bs)
 {
     /* XXX: remove the driver list */
     bdrv_close(bs);
+    bdrv_set_readahead(bs, 0);
+    bdrv_set_write_cache(bs, 0);
     qemu_free(bs);
 }
 
@@ -472,6 +484,9 @@ int bdrv_commit(BlockDriverState *bs)
 	return -ENOTSUP;
     }
 
+    if (bdrv_wb_flush(bs) < 0)
+        return -EIO;
+
     total_sectors = bdrv_getlength(bs) >> SECTOR_BITS;
     for (i = 0; i < total_sectors;) {
         if (drv->bdrv_is_allocated(bs, i, 65536, &n)) {
@@ -496,23 +511,191 @@ int bdrv_commit(BlockDriverState *bs)
     return 0;
 }
 
-/* return < 0 if error. See bdrv_write() for the return codes */
-int bdrv_read(BlockDriverState *bs, int64_t sector_num,
-              uint8_t *buf, int nb_sectors)
+/**************************************************************/
+/* sequential readahead */
+
+/* number of back to back reads after which a stream is considered
+   sequential and the next window is prefetched */
+#define BDRV_RA_TRIGGER 2
+
+static int bdrv_do_read(BlockDriverState *bs, int64_t sector_num,
+                        uint8_t *buf, int nb_sectors);
+
+static void bdrv_ra_cb(void *opaque, int ret)
 {
-    BlockDriver *drv = bs->drv;
+    BlockDriverState *bs = opaque;
 
-    if (!drv)
-        return -ENOMEDIUM;
+    if (ret < 0 || bs->ra_discard)
+        bs->ra_valid[bs->ra_fill] = 0;
+    bs->ra_fill = -1;
+    bs->ra_discard = 0;
+    bs->ra_acb = NULL;
+}
 
-    if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
-            memcpy(buf, bs->boot_sector_data, 512);
-        sector_num++;
-        nb_sectors--;
-        buf += 512;
-        if (nb_sectors == 0)
-            return 0;
+/* start filling window i from sector_num in the background */
+static void bdrv_ra_prefetch(BlockDriverState *bs, int i, int64_t sector_num)
+{
+    BlockDriverAIOCB *acb;
+    int n;
+
+    n = bs->ra_sectors;
+    if (bs->total_sectors && sector_num + n > bs->total_sectors)
+        n = bs->total_sectors - sector_num;
+    if (n <= 0)
+        return;
+
+    bs->ra_start[i] = sector_num;
+    bs->ra_valid[i] = n;
+    bs->ra_fill = i;
+    bs->ra_discard = 0;
+    bs->ra_busy = 1;
+    acb = bdrv_aio_read(bs, sector_num, bs->ra_buf[i], n, bdrv_ra_cb, bs);
+    bs->ra_busy = 0;
+    /* the callback may already have run if the driver completed the
+       request synchronously */
+    if (bs->ra_fill == i) {
+        if (acb) {
+            bs->ra_acb = acb;
+        } else {
+            bs->ra_valid[i] = 0;
+            bs->ra_fill = -1;
+        }
+    }
+}
+
+static void bdrv_ra_wait(BlockDriverState *bs)
+{
+    qemu_aio_wait_start();
+    /* the completion signal may have been delivered already */
+    qemu_aio_poll();
+    while (bs->ra_fill != -1)
+        qemu_aio_wait();
+    qemu_aio_wait_end();
+}
+
+/* drop any cached data overlapping the given range */
+static void bdrv_ra_invalidate(BlockDriverState *bs, int64_t sector_num,
+                               int nb_sectors)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (sector_num < bs->ra_start[i] + bs->ra_valid[i] &&
+            sector_num + nb_sectors > bs->ra_start[i]) {
+            if (i == bs->ra_fill)
+                bs->ra_discard = 1;
+            else
+                bs->ra_valid[i] = 0;
+        }
+    }
+}
+
+/* Try to serve a read from the readahead windows.  Return 1 if the
+   request was satisfied, 0 if the caller must go to the driver.  */
+static int bdrv_ra_read(BlockDriverState *bs, int64_t sector_num,
+                        uint8_t *buf, int nb_sectors)
+{
+    int i, sequential;
+
+    if (nb_sectors >= bs->ra_sectors)
+        return 0;
+
+    sequential = (sector_num == bs->ra_next);
+    if (sequential)
+        bs->ra_seq++;
+    else
+        bs->ra_seq = 0;
+    bs->ra_next = sector_num + nb_sectors;
+
+    for (i = 0; i < 2; i++) {
+        if (!bs->ra_valid[i] || sector_num < bs->ra_start[i] ||
+            sector_num + nb_sectors > bs->ra_start[i] + bs->ra_valid[i])
+            continue;
+        if (i == bs->ra_fill) {
+            bdrv_ra_wait(bs);
+            if (!bs->ra_valid[i])
+                break;
+        }
+        memcpy(buf, bs->ra_buf[i] + ((sector_num - bs->ra_start[i]) <<
+                                     SECTOR_BITS), nb_sectors << SECTOR_BITS);
+        bs->ra_hits++;
+
+        /* once the guest starts consuming a window, queue the next one */
+        if (sequential && bs->ra_fill == -1 &&
+            !(bs->ra_valid[i ^ 1] &&
+              bs->ra_start[i ^ 1] == bs->ra_start[i] + bs->ra_valid[i]))
+            bdrv_ra_prefetch(bs, i ^ 1, bs->ra_start[i] + bs->ra_valid[i]);
+        return 1;
+    }
+
+    if (bs->ra_seq < BDRV_RA_TRIGGER)
+        return 0;
+
+    /* a sequential stream missed the cache: read a whole window now and
+       start prefetching the one after it */
+    if (bs->ra_fill != -1)
+        bdrv_ra_wait(bs);
+    i = 0;
+    bs->ra_valid[i] = bs->ra_sectors;
+    if (bs->total_sectors && sector_num + bs->ra_valid[i] > bs->total_sectors)
+        bs->ra_valid[i] = bs->total_sectors - sector_num;
+    if (bs->ra_valid[i] < nb_sectors) {
+        bs->ra_valid[i] = 0;
+        return 0;
     }
+    bs->ra_start[i] = sector_num;
+    if (bdrv_do_read(bs, sector_num, bs->ra_buf[i], bs->ra_valid[i]) < 0) {
+        bs->ra_valid[i] = 0;
+        return 0;
+    }
+    memcpy(buf, bs->ra_buf[i], nb_sectors << SECTOR_BITS);
+    bdrv_ra_prefetch(bs, i ^ 1, sector_num + bs->ra_valid[i]);
+    return 1;
+}
+
+static void bdrv_ra_reset(BlockDriverState *bs)
+{
+    if (bs->ra_acb) {
+        bdrv_aio_cancel(bs->ra_acb);
+        bs->ra_acb = NULL;
+    }
+    bs->ra_fill = -1;
+    bs->ra_discard = 0;
+    bs->ra_valid[0] = bs->ra_valid[1] = 0;
+    bs->ra_seq = 0;
+}
+
+/* Enable readahead of nb_sectors per window on a sequential stream of
+   small reads, or disable it if nb_sectors is zero.  */
+void bdrv_set_readahead(BlockDriverState *bs, int nb_sectors)
+{
+    int i;
+
+    bdrv_ra_reset(bs);
+    for (i = 0; i < 2; i++) {
+        if (bs->ra_buf[i])
+            qemu_vfree(bs->ra_buf[i]);
+        bs->ra_buf[i] = NULL;
+    }
+    bs->ra_sectors = 0;
+    if (nb_sectors <= 0)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        bs->ra_buf[i] = qemu_memalign(SECTOR_SIZE, nb_sectors << SECTOR_BITS);
+        if (!bs->ra_buf[i]) {
+            bdrv_set_readahead(bs, 0);
+            return;
+        }
+    }
+    bs->ra_sectors = nb_sectors;
+}
+
+static int bdrv_do_read(BlockDriverState *bs, int64_t sector_num,
+                        uint8_t *buf, int nb_sectors)
+{
+    BlockDriver *drv = bs->drv;
+
     if (drv->bdrv_pread) {
         int ret, len;
         len = nb_sectors * 512;
@@ -531,23 +714,17 @@ int bdrv_read(BlockDriverState *bs, int64_t sector_num,
     }
 }
 
-/* Return < 0 if error. Important errors are:
-  -EIO         generic I/O error (may happen for all errors)
-  -ENOMEDIUM   No media inserted.
-  -EINVAL      Invalid sector number or nb_sectors
-  -EACCES      Trying to write a read-only device
-*/
-int bdrv_write(BlockDriverState *bs, int64_t sector_num,
-               const uint8_t *buf, int nb_sectors)
+/**************************************************************/
+/* write-back sector cache */
+
+/* dirty data is written out at most this many ms after it was cached */
+#define BDRV_WB_FLUSH_DELAY 1000
+
+static int bdrv_do_write(BlockDriverState *bs, int64_t sector_num,
+                         const uint8_t *buf, int nb_sectors)
 {
     BlockDriver *drv = bs->drv;
-    if (!bs->drv)
-        return -ENOMEDIUM;
-    if (bs->read_only)
-        return -EACCES;
-    if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
-        memcpy(bs->boot_sector_data, buf, 512);
-    }
+
     if (drv->bdrv_pwrite) {
         int ret, len;
         len = nb_sectors * 512;
@@ -566,6 +743,282 @@ int bdrv_write(BlockDriverState *bs, int64_t sector_num,
     }
 }
 
+static inline int bdrv_wb_hash(BlockDriverState *bs, int64_t sector_num)
+{
+    return (sector_num * 0x9e3779b1) & (bs->wb_hash_size - 1);
+}
+
+/* return the slot caching sector_num, or -1 */
+static int bdrv_wb_find(BlockDriverState *bs, int64_t sector_num)
+{
+    int h, slot;
+
+    for (h = bdrv_wb_hash(bs, sector_num); (slot = bs->wb_hash[h]);
+                    h = (h + 1) & (bs->wb_hash_size - 1))
+        if (bs->wb_sector[slot - 1] == sector_num)
+            return slot - 1;
+    return -1;
+}
+
+static int bdrv_wb_insert(BlockDriverState *bs, int64_t sector_num)
+{
+    int h, slot;
+
+    for (h = bdrv_wb_hash(bs, sector_num); bs->wb_hash[h];
+                    h = (h + 1) & (bs->wb_hash_size - 1));
+    slot = bs->wb_count ++;
+    bs->wb_hash[h] = slot + 1;
+    bs->wb_sector[slot] = sector_num;
+    return slot;
+}
+
+/* flush for callers that have no way to pass the error on */
+static int bdrv_wb_sync(BlockDriverState *bs)
+{
+    int ret;
+
+    ret = bdrv_wb_flush(bs);
+    if (ret < 0)
+        fprintf(stderr, "%s: writing back cached sectors failed: %s\n",
+                        bs->device_name, strerror(-ret));
+    return ret;
+}
+
+/* forget the cached sectors without writing them */
+static void bdrv_wb_discard(BlockDriverState *bs)
+{
+    if (!bs->wb_count)
+        return;
+#ifndef QEMU_IMG
+    qemu_del_timer(bs->wb_timer);
+#endif
+    memset(bs->wb_hash, 0, bs->wb_hash_size * sizeof(*bs->wb_hash));
+    bs->wb_count = 0;
+}
+
+#ifndef QEMU_IMG
+/* sectors that fail to be written stay cached and are retried when
+   the timer next fires */
+static void bdrv_wb_timer(void *opaque)
+{
+    bdrv_wb_sync((BlockDriverState *) opaque);
+}
+#endif
+
+static int bdrv_wb_write(BlockDriverState *bs, int64_t sector_num,
+                         const uint8_t *buf, int nb_sectors)
+{
+    int slot, ret;
+
+    /* large writes gain nothing from being cached */
+    if (nb_sectors >= bs->wb_sectors) {
+        ret = bdrv_wb_flush(bs);
+        if (ret < 0)
+            return ret;
+        return bdrv_do_write(bs, sector_num, buf, nb_sectors);
+    }
+
+    for (; nb_sectors > 0; nb_sectors --, sector_num ++, buf += SECTOR_SIZE) {
+        slot = bdrv_wb_find(bs, sector_num);
+        if (slot < 0) {
+            if (bs->wb_count >= bs->wb_sectors) {
+                ret = bdrv_wb_flush(bs);
+                if (ret < 0)
+                    return ret;
+            }
+#ifndef QEMU_IMG
+            if (!bs->wb_count)
+                qemu_mod_timer(bs->wb_timer,
+                                qemu_get_clock(rt_clock) + BDRV_WB_FLUSH_DELAY);
+#endif
+            slot = bdrv_wb_insert(bs, sector_num);
+        } else
+            bs->wb_hits ++;
+        memcpy(bs->wb_buf + (slot << SECTOR_BITS), buf, SECTOR_SIZE);
+    }
+    return 0;
+}
+
+/* overlay cached dirty sectors on data just read from the driver */
+static void bdrv_wb_read(BlockDriverState *bs, int64_t sector_num,
+                         uint8_t *buf, int nb_sectors)
+{
+    int slot;
+
+    for (; nb_sectors > 0; nb_sectors --, sector_num ++, buf += SECTOR_SIZE)
+        if ((slot = bdrv_wb_find(bs, sector_num)) >= 0)
+            memcpy(buf, bs->wb_buf + (slot << SECTOR_BITS), SECTOR_SIZE);
+}
+
+static BlockDriverState *bdrv_wb_sort_bs;
+
+static int bdrv_wb_cmp(const void *a, const void *b)
+{
+    int64_t sa = bdrv_wb_sort_bs->wb_sector[*(const int *) a];
+    int64_t sb = bdrv_wb_sort_bs->wb_sector[*(const int *) b];
+
+    return (sa > sb) - (sa < sb);
+}
+
+/* Write out all dirty sectors, one driver request per run of adjacent
+   sectors.  Sectors whose write failed stay in the cache and the error
+   is returned.  */
+static int bdrv_wb_flush(BlockDriverState *bs)
+{
+    int *order, i, j, n, ret, err, count;
+    int64_t start;
+    uint8_t *run;
+
+    if (!bs->wb_count)
+        return 0;
+    /* before anything is touched, the cache stays as it is on failure */
+    run = qemu_memalign(SECTOR_SIZE, bs->wb_count << SECTOR_BITS);
+    if (!run)
+        return -ENOMEM;
+#ifndef QEMU_IMG
+    qemu_del_timer(bs->wb_timer);
+#endif
+
+    /* wb_hash is rebuilt below, borrow it as the sort array */
+    order = bs->wb_hash;
+    for (i = 0; i < bs->wb_count; i ++)
+        order[i] = i;
+    bdrv_wb_sort_bs = bs;
+    qsort(order, bs->wb_count, sizeof(*order), bdrv_wb_cmp);
+
+    err = 0;
+    for (i = 0; i < bs->wb_count; i += n) {
+        start = bs->wb_sector[order[i]];
+        for (n = 0; i + n < bs->wb_count &&
+                        bs->wb_sector[order[i + n]] == start + n; n ++)
+            memcpy(run + (n << SECTOR_BITS),
+                            bs->wb_buf + (order[i + n] << SECTOR_BITS),
+                            SECTOR_SIZE);
+        /* a readahead window may have been filled from the image while
+           these sectors were only in the cache */
+        if (bs->ra_sectors)
+            bdrv_ra_invalidate(bs, start, n);
+        ret = bdrv_do_write(bs, start, run, n);
+        if (ret < 0)
+            err = ret;
+        else
+            for (j = 0; j < n; j ++)
+                bs->wb_sector[order[i + j]] = -1;
+    }
+    qemu_vfree(run);
+
+    /* keep the sectors that could not be written */
+    memset(bs->wb_hash, 0, bs->wb_hash_size * sizeof(*bs->wb_hash));
+    count = bs->wb_count;
+    bs->wb_count = 0;
+    for (i = 0; i < count; i ++) {
+        if (bs->wb_sector[i] < 0)
+            continue;
+        n = bdrv_wb_insert(bs, bs->wb_sector[i]);
+        if (n != i)
+            memcpy(bs->wb_buf + (n << SECTOR_BITS),
+                            bs->wb_buf + (i << SECTOR_BITS), SECTOR_SIZE);
+    }
+#ifndef QEMU_IMG
+    if (bs->wb_count)
+        qemu_mod_timer(bs->wb_timer,
+                        qemu_get_clock(rt_clock) + BDRV_WB_FLUSH_DELAY);
+#endif
+    bs->wb_flushes ++;
+    return err;
+}
+
+/* Cache up to nb_sectors dirty sectors in memory before writing them
+   to the image, or write straight through if nb_sectors is zero.
+   Cached data reaches the image on bdrv_flush(), when the cache fills
+   up, or BDRV_WB_FLUSH_DELAY ms after the first write to a clean
+   cache.  */
+void bdrv_set_write_cache(BlockDriverState *bs, int nb_sectors)
+{
+    if (bs->wb_sectors) {
+        bdrv_wb_sync(bs);
+#ifndef QEMU_IMG
+        qemu_free_timer(bs->wb_timer);
+#endif
+        qemu_free(bs->wb_hash);
+        qemu_free(bs->wb_sector);
+        qemu_vfree(bs->wb_buf);
+        bs->wb_sectors = 0;
+    }
+    if (nb_sectors <= 0)
+        return;
+
+    /* keep the hash at most half full */
+    for (bs->wb_hash_size = 1; bs->wb_hash_size < nb_sectors * 2;
+                    bs->wb_hash_size <<= 1);
+    bs->wb_hash = qemu_mallocz(bs->wb_hash_size * sizeof(*bs->wb_hash));
+    bs->wb_sector = qemu_malloc(nb_sectors * sizeof(*bs->wb_sector));
+    bs->wb_buf = qemu_memalign(SECTOR_SIZE, nb_sectors << SECTOR_BITS);
+    if (!bs->wb_hash || !bs->wb_sector || !bs->wb_buf) {
+        qemu_free(bs->wb_hash);
+        qemu_free(bs->wb_sector);
+        qemu_vfree(bs->wb_buf);
+        return;
+    }
+#ifndef QEMU_IMG
+    bs->wb_timer = qemu_new_timer(rt_clock, bdrv_wb_timer, bs);
+#endif
+    bs->wb_count = 0;
+    bs->wb_sectors = nb_sectors;
+}
+
+/* return < 0 if error. See bdrv_write() for the return codes */
+int bdrv_read(BlockDriverState *bs, int64_t sector_num,
+              uint8_t *buf, int nb_sectors)
+{
+    BlockDriver *drv = bs->drv;
+    int ret;
+
+    if (!drv)
+        return -ENOMEDIUM;
+
+    if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
+            memcpy(buf, bs->boot_sector_data, 512);
+        sector_num++;
+        nb_sectors--;
+        buf += 512;
+        if (nb_sectors == 0)
+            return 0;
+    }
+    if (!(bs->ra_sectors && !bs->ra_busy &&
+          bdrv_ra_read(bs, sector_num, buf, nb_sectors))) {
+        ret = bdrv_do_read(bs, sector_num, buf, nb_sectors);
+        if (ret < 0)
+            return ret;
+    }
+    if (bs->wb_count)
+        bdrv_wb_read(bs, sector_num, buf, nb_sectors);
+    return 0;
+}
+
+/* Return < 0 if error. Important errors are:
+  -EIO         generic I/O error (may happen for all errors)
+  -ENOMEDIUM   No media inserted.
+  -EINVAL      Invalid sector number or nb_sectors
+  -EACCES      Trying to write a read-only device
+*/
+int bdrv_write(BlockDriverState *bs, int64_t sector_num,
+               const uint8_t *buf, int nb_sectors)
+{
+    if (!bs->drv)
+        return -ENOMEDIUM;
+    if (bs->read_only)
+        return -EACCES;
+    if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
+        memcpy(bs->boot_sector_data, buf, 512);
+    }
+    if (bs->ra_sectors)
+        bdrv_ra_invalidate(bs, sector_num, nb_sectors);
+    if (bs->wb_sectors)
+        return bdrv_wb_write(bs, sector_num, buf, nb_sectors);
+    return bdrv_do_write(bs, sector_num, buf, nb_sectors);
+}
+
 static int bdrv_pread_em(BlockDriverState *bs, int64_t offset,
                          uint8_t *buf, int count1)
 {
@@ -670,6 +1123,8 @@ int bdrv_pread(BlockDriverState *bs, int64_t offset,
         return -ENOMEDIUM;
     if (!drv->bdrv_pread)
         return bdrv_pread_em(bs, offset, buf1, count1);
+    if (bs->wb_count && bdrv_wb_flush(bs) < 0)
+        return -EIO;
     return drv->bdrv_pread(bs, offset, buf1, count1);
 }
 
@@ -685,6 +1140,12 @@ int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
         return -ENOMEDIUM;
     if (!drv->bdrv_pwrite)
         return bdrv_pwrite_em(bs, offset, buf1, count1);
+    if (bs->wb_count && bdrv_wb_flush(bs) < 0)
+        return -EIO;
+    if (bs->ra_sectors && count1 > 0)
+        bdrv_ra_invalidate(bs, offset >> SECTOR_BITS,
+                        ((offset + count1 + SECTOR_SIZE - 1) >> SECTOR_BITS) -
+                        (offset >> SECTOR_BITS));
     return drv->bdrv_pwrite(bs, offset, buf1, count1);
 }
 
@@ -865,12 +1326,29 @@ const char *bdrv_get_device_name(BlockDriverState *bs)
     return bs->device_name;
 }
 
-void bdrv_flush(BlockDriverState *bs)
+/* Returns a negative errno if cached sectors could not be written */
+int bdrv_flush(BlockDriverState *bs)
 {
+    int ret = 0;
+
+    if (bs->wb_count)
+        ret = bdrv_wb_sync(bs);
     if (bs->drv->bdrv_flush)
         bs->drv->bdrv_flush(bs);
-    if (bs->backing_hd)
-        bdrv_flush(bs->backing_hd);
+    if (bs->backing_hd && bdrv_flush(bs->backing_hd) < 0 && ret >= 0)
+        ret = -EIO;
+    return ret;
+}
+
+int bdrv_flush_all(void)
+{
+    BlockDriverState *bs;
+    int ret = 0;
+
+    for (bs = bdrv_first; bs != NULL; bs = bs->next)
+        if (bs->drv && bdrv_flush(bs) < 0)
+            ret = -EIO;
+    return ret;
 }
 
 #ifndef QEMU_IMG
@@ -924,11 +1402,17 @@ void bdrv_info_stats (void)
 		     " rd_bytes=%" PRIu64
 		     " wr_bytes=%" PRIu64
 		     " rd_operations=%" PRIu64
-		     " wr_operations=%" PRIu64
-		     "\n",
+		     " wr_operations=%" PRIu64,
 		     bs->device_name,
 		     bs->rd_bytes, bs->wr_bytes,
 		     bs->rd_ops, bs->wr_ops);
+	if (bs->ra_sectors)
+	    term_printf (" readahead_hits=%" PRIu64, bs->ra_hits);
+	if (bs->wb_sectors)
+	    term_printf (" writeback_hits=%" PRIu64
+			 " writeback_flushes=%" PRIu64,
+			 bs->wb_hits, bs->wb_flushes);
+	term_printf ("\n");
     }
 }
 #endif
@@ -968,6 +1452,14 @@ int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 /**************************************************************/
 /* handling of snapshots */
 
+/* return whether bdrv_snapshot_create() can work on this device */
+int bdrv_snapshot_supported(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    return drv && drv->bdrv_snapshot_create && !bs->read_only;
+}
+
 int bdrv_snapshot_create(BlockDriverState *bs,
                          QEMUSnapshotInfo *sn_info)
 {
@@ -976,6 +1468,8 @@ int bdrv_snapshot_create(BlockDriverState *bs,
         return -ENOMEDIUM;
     if (!drv->bdrv_snapshot_create)
         return -ENOTSUP;
+    if (bdrv_wb_flush(bs) < 0)
+        return -EIO;
     return drv->bdrv_snapshot_create(bs, sn_info);
 }
 
@@ -987,6 +1481,10 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
         return -ENOMEDIUM;
     if (!drv->bdrv_snapshot_goto)
         return -ENOTSUP;
+    bdrv_wb_sync(bs);
+    bdrv_wb_discard(bs);
+    if (bs->ra_sectors)
+        bdrv_ra_reset(bs);
     return drv->bdrv_snapshot_goto(bs, snapshot_id);
 }
 
@@ -1097,6 +1595,8 @@ BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
 
     if (!drv)
         return NULL;
+    if (bs->wb_count && !bs->ra_busy && bdrv_wb_flush(bs) < 0)
+        return NULL;
 
     /* XXX: we assume that nb_sectors == 0 is suppored by the async read */
     if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
@@ -1131,6 +1631,10 @@ BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
     if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
         memcpy(bs->boot_sector_data, buf, 512);
     }
+    if (bs->ra_sectors)
+        bdrv_ra_invalidate(bs, sector_num, nb_sectors);
+    if (bs->wb_count && bdrv_wb_flush(bs) < 0)
+        return NULL;
 
     ret = drv->bdrv_aio_write(bs, sector_num, buf, nb_sectors, cb, opaque);
 
@@ -1410,3 +1914,182 @@ int bdrv_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         return drv->bdrv_ioctl(bs, req, buf);
     return -ENOTSUP;
 }
+
+/**
+ * Map the whole image in memory.  Stores to the mapping go straight to
+ * the image and are made durable by bdrv_flush().  Return NULL if the
+ * driver cannot map the image, e.g. because it is not a raw file.
+ */
+void *bdrv_mmap(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv || !drv->bdrv_mmap || bs->read_only)
+        return NULL;
+    /* the mapping bypasses the sector caches */
+    if (bdrv_wb_flush(bs) < 0)
+        return NULL;
+    bdrv_set_readahead(bs, 0);
+    return drv->bdrv_mmap(bs);
+}
+
+/**************************************************************/
+/* content index */
+
+/* images larger than this are not indexed */
+#define BDRV_HASH_MAX_SIZE (1024LL << 20)
+#define BDRV_HASH_READ_SIZE (64 * 1024)
+
+static uint32_t bdrv_hash_block(const uint8_t *buf, int size)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < size; i += 4)
+        h = (h ^ (buf[i] | (buf[i + 1] << 8) | (buf[i + 2] << 16) |
+                  ((uint32_t)buf[i + 3] << 24))) * 16777619u;
+    return h;
+}
+
+static int bdrv_hash_is_uniform(const uint8_t *buf, int size)
+{
+    int i;
+
+    for (i = 1; i < size; i++)
+        if (buf[i] != buf[0])
+            return 0;
+    return 1;
+}
+
+void bdrv_hash_reset(BlockDriverState *bs)
+{
+    qemu_free(bs->hash_key);
+    qemu_free(bs->hash_sector);
+    bs->hash_key = NULL;
+    bs->hash_sector = NULL;
+    bs->hash_size = 0;
+    bs->hash_block_size = 0;
+    bs->hash_pos = 0;
+}
+
+static void bdrv_hash_insert(BlockDriverState *bs, uint32_t key,
+                             int64_t sector_num)
+{
+    int i;
+
+    for (i = key & (bs->hash_size - 1); bs->hash_sector[i] >= 0;
+         i = (i + 1) & (bs->hash_size - 1))
+        if (bs->hash_key[i] == key)
+            return; /* keep the first block with this content */
+    bs->hash_key[i] = key;
+    bs->hash_sector[i] = sector_num;
+}
+
+static int bdrv_hash_alloc(BlockDriverState *bs, int size)
+{
+    int64_t total;
+    int i;
+
+    bdrv_hash_reset(bs);
+    /* a failed index is not retried until the block size changes */
+    bs->hash_block_size = size;
+    total = bdrv_getlength(bs);
+    if (total <= 0 || total > BDRV_HASH_MAX_SIZE)
+        return -1;
+    for (bs->hash_size = 1; bs->hash_size < 2 * (total / size);
+         bs->hash_size <<= 1);
+    bs->hash_key = qemu_malloc(bs->hash_size * sizeof(uint32_t));
+    bs->hash_sector = qemu_malloc(bs->hash_size * sizeof(int64_t));
+    if (!bs->hash_key || !bs->hash_sector) {
+        bdrv_hash_reset(bs);
+        bs->hash_block_size = size;
+        return -1;
+    }
+    for (i = 0; i < bs->hash_size; i++)
+        bs->hash_sector[i] = -1;
+    bs->hash_pos = 0;
+    return 0;
+}
+
+/**
+ * Index the hash of each block of 'size' bytes of the image, reading at
+ * most 'max_bytes' more of it, or all of it if 'max_bytes' is zero.
+ * Blocks filled with a single byte value are not indexed.  Return 1 once
+ * the whole image is indexed, 0 if there is more to read, or -1 if the
+ * image cannot be indexed.  'size' must be a multiple of the sector size
+ * and stay the same between calls.
+ */
+int bdrv_hash_index(BlockDriverState *bs, int size, int64_t max_bytes)
+{
+    int64_t total, pos;
+    uint8_t *buf;
+    int i, len;
+
+    if (!bs->drv || size <= 0 || (size & (SECTOR_SIZE - 1)))
+        return -1;
+    if (bs->hash_block_size != size && bdrv_hash_alloc(bs, size) < 0)
+        return -1;
+    if (!bs->hash_size)
+        return -1;
+
+    total = bdrv_getlength(bs);
+    pos = bs->hash_pos;
+    if (pos + size > total)
+        return 1;
+    buf = qemu_malloc(BDRV_HASH_READ_SIZE);
+    if (!buf)
+        return -1;
+    for (; pos + size <= total && (!max_bytes || pos < bs->hash_pos +
+                                   max_bytes); pos += len) {
+        len = MIN(BDRV_HASH_READ_SIZE, (total - pos) / size * size);
+        if (bdrv_read(bs, pos >> SECTOR_BITS, buf, len >> SECTOR_BITS) < 0) {
+            qemu_free(buf);
+            bdrv_hash_reset(bs);
+            bs->hash_block_size = size;
+            return -1;
+        }
+        for (i = 0; i < len; i += size)
+            if (!bdrv_hash_is_uniform(buf + i, size))
+                bdrv_hash_insert(bs, bdrv_hash_block(buf + i, size),
+                                 (pos + i) >> SECTOR_BITS);
+    }
+    qemu_free(buf);
+    bs->hash_pos = pos;
+    return pos + size > total;
+}
+
+/**
+ * Find a block of 'size' bytes of the image with the same content as
+ * 'buf' and return its first sector, or -1 if there is none.  Only an
+ * index completed by bdrv_hash_index() is searched, blocks written after
+ * they were indexed are only found if they kept their old content.
+ */
+int64_t bdrv_hash_find(BlockDriverState *bs, const uint8_t *buf, int size)
+{
+    uint8_t *tmp;
+    uint32_t key;
+    int64_t sector_num;
+    int i;
+
+    if (!bs->drv || bs->hash_block_size != size || !bs->hash_size ||
+        bs->hash_pos + size <= bdrv_getlength(bs))
+        return -1;
+
+    key = bdrv_hash_block(buf, size);
+    tmp = qemu_malloc(size);
+    if (!tmp)
+        return -1;
+    sector_num = -1;
+    for (i = key & (bs->hash_size - 1); bs->hash_sector[i] >= 0;
+         i = (i + 1) & (bs->hash_size - 1)) {
+        if (bs->hash_key[i] != key)
+            continue;
+        /* the image may have changed since it was indexed */
+        if (bdrv_read(bs, bs->hash_sector[i], tmp,
+                      size >> SECTOR_BITS) >= 0 && !memcmp(tmp, buf, size))
+            sector_num = bs->hash_sector[i];
+        break;
+    }
+    qemu_free(tmp);
+    return sector_num;
+}
@@ -76,6 +76,8 @@ int64_t bdrv_getlength(BlockDriverState *bs);
 void bdrv_get_geometry(BlockDriverState *bs, uint64_t *nb_sectors_ptr);
 int bdrv_commit(BlockDriverState *bs);
 void bdrv_set_boot_sector(BlockDriverState *bs, const uint8_t *data, int size);
+void bdrv_set_readahead(BlockDriverState *bs, int nb_sectors);
+void bdrv_set_write_cache(BlockDriverState *bs, int nb_sectors);
 /* async block I/O */
 typedef struct BlockDriverAIOCB BlockDriverAIOCB;
 typedef void BlockDriverCompletionFunc(void *opaque, int ret);
@@ -98,7 +100,8 @@ void qemu_aio_wait_end(void);
 int qemu_key_check(BlockDriverState *bs, const char *name);
 
 /* Ensure contents are flushed to disk.  */
-void bdrv_flush(BlockDriverState *bs);
+int bdrv_flush(BlockDriverState *bs);
+int bdrv_flush_all(void);
 
 #define BDRV_TYPE_HD     0
 #define BDRV_TYPE_CDROM  1
@@ -141,6 +144,7 @@ int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
 
 void bdrv_get_backing_filename(BlockDriverState *bs,
                                char *filename, int filename_size);
+int bdrv_snapshot_supported(BlockDriverState *bs);
 int bdrv_snapshot_create(BlockDriverState *bs,
                          QEMUSnapshotInfo *sn_info);
 int bdrv_snapshot_goto(BlockDriverState *bs,
@@ -150,6 +154,10 @@ int bdrv_snapshot_list(BlockDriverState *bs,
                        QEMUSnapshotInfo **psn_info);
 char *bdrv_snapshot_dump(char *buf, int buf_size, QEMUSnapshotInfo *sn);
 int bdrv_ioctl(BlockDriverState *bs, unsigned long int req, void *buf);
+void *bdrv_mmap(BlockDriverState *bs);
+int bdrv_hash_index(BlockDriverState *bs, int size, int64_t max_bytes);
+int64_t bdrv_hash_find(BlockDriverState *bs, const uint8_t *buf, int size);
+void bdrv_hash_reset(BlockDriverState *bs);
 
 char *get_human_readable_size(char *buf, int buf_size, int64_t size);
 int path_is_absolute(const char *path);
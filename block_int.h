@@ -85,6 +85,9 @@ struct BlockDriver {
     /* to control generic scsi devices */
     int (*bdrv_ioctl)(BlockDriverState *bs, unsigned long int req, void *buf);
 
+    /* map the whole image in memory, shared with the backing file */
+    void *(*bdrv_mmap)(BlockDriverState *bs);
+
     BlockDriverAIOCB *free_aiocb;
     struct BlockDriver *next;
 };
@@ -124,6 +127,44 @@ struct BlockDriverState {
     uint64_t rd_ops;
     uint64_t wr_ops;
 
+    /* sequential readahead, disabled when ra_sectors is zero.  Two
+       windows are kept so that one can be prefetched while the guest
+       drains the other. */
+    int ra_sectors;
+    int64_t ra_next;   /* first sector after the last read */
+    int ra_seq;        /* length of the current sequential run */
+    int ra_busy;       /* set while the readahead code issues its own I/O */
+    uint8_t *ra_buf[2];
+    int64_t ra_start[2];
+    int ra_valid[2];   /* number of sectors cached, 0 if empty */
+    int ra_fill;       /* window being prefetched, -1 if none */
+    int ra_discard;    /* prefetch was overwritten while in flight */
+    BlockDriverAIOCB *ra_acb;
+    uint64_t ra_hits;
+
+    /* write-back sector cache, disabled when wb_sectors is zero.  Dirty
+       sectors are found through an open addressing hash and are written
+       out, merged into runs of adjacent sectors, by bdrv_flush() or
+       when the flush timer expires. */
+    int wb_sectors;
+    int wb_count;
+    int wb_hash_size;
+    int *wb_hash;       /* slot index plus one, 0 if free */
+    int64_t *wb_sector; /* sector held by each slot */
+    uint8_t *wb_buf;
+    QEMUTimer *wb_timer;
+    uint64_t wb_hits;
+    uint64_t wb_flushes;
+
+    /* content index built by bdrv_hash_index(), hash_size entries of
+       hash_block_size bytes each, a sector of -1 marks a free entry.
+       The image is indexed up to hash_pos.  */
+    int hash_block_size;
+    int hash_size;
+    uint32_t *hash_key;
+    int64_t *hash_sector;
+    int64_t hash_pos;
+
     /* NOTE: the following infos are only hints for real hardware
        drivers. They are not used by the block driver */
     int cyls, heads, secs, translation;
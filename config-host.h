@@ -0,0 +1,13 @@
+/* Automatically generated by configure - do not modify */
+#define CONFIG_QEMU_SHAREDIR "/usr/local/share/qemu"
+#define HOST_X86_64 1
+#define HOST_LONG_BITS 64
+#define HAVE_BYTESWAP_H 1
+#define CONFIG_GDBSTUB 1
+#define CONFIG_SLIRP 1
+#define CONFIG_OSS 1
+#define CONFIG_VNC_TLS 1
+#define QEMU_VERSION "0.9.1-openmoko-svn"
+#define CONFIG_UNAME_RELEASE ""
+#define CONFIG_GADGETFS 1
+#define INTERNAL_MODEM "gnokiigsm"
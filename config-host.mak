@@ -0,0 +1,35 @@
+# Automatically generated by configure - do not modify
+# Configured with: ./configure --target-list=arm-softmmu --disable-gcc-check --disable-gfx-check
+prefix=/usr/local
+bindir=${prefix}/bin
+mandir=${prefix}/share/man
+datadir=${prefix}/share/qemu
+docdir=${prefix}/share/doc/qemu
+MAKE=make
+INSTALL=install
+CC=gcc
+HOST_CC=gcc
+AR=ar
+STRIP=strip -s -R .comment -R .note
+OS_CFLAGS=
+OS_LDFLAGS=
+VL_OS_LDFLAGS=
+ARCH_CFLAGS=
+ARCH_LDFLAGS=
+CFLAGS= -Wall -O2 -g -fno-strict-aliasing
+LDFLAGS= -g
+EXESUF=
+AIOLIBS=-lrt -lpthread
+ARCH=x86_64
+CONFIG_GDBSTUB=yes
+CONFIG_SLIRP=yes
+CONFIG_OSS=yes
+CONFIG_VNC_TLS=yes
+CONFIG_VNC_TLS_CFLAGS=-I/usr/include/p11-kit-1 
+CONFIG_VNC_TLS_LIBS=-lgnutls 
+VERSION=0.9.1-openmoko-svn
+SRC_PATH=/root/repo
+TARGET_DIRS=arm-softmmu
+CONFIG_GADGETFS=yes
+MODEM=
+TOOLS=qemu-img$(EXESUF) raw2flash$(EXESUF) flash2raw$(EXESUF) 
@@ -999,6 +999,7 @@ void console_select(unsigned int index)
     if (s) {
         active_console = s;
         if (s->console_type != GRAPHIC_CONSOLE) {
+            dpy_share(s->ds, NULL, 0);
             if (s->g_width != s->ds->width ||
                 s->g_height != s->ds->height) {
                 if (s->console_type == TEXT_CONSOLE_FIXED_SIZE) {
@@ -75,6 +75,7 @@ struct DisplayState {
     void (*dpy_update)(struct DisplayState *s, int x, int y, int w, int h);
     void (*dpy_resize)(struct DisplayState *s, int w, int h);
     void (*dpy_refresh)(struct DisplayState *s);
+    int (*dpy_share)(struct DisplayState *s, uint8_t *data, int linesize);
     void (*dpy_copy)(struct DisplayState *s, int src_x, int src_y,
                      int dst_x, int dst_y, int w, int h);
     void (*dpy_fill)(struct DisplayState *s, int x, int y,
@@ -94,6 +95,16 @@ static inline void dpy_resize(DisplayState *s, int w, int h)
     s->dpy_resize(s, w, h);
 }
 
+/* Ask the frontend to read the pixels straight from DATA, kept by the
+   device in the display's own format, instead of from its buffer.  NULL
+   DATA gives the buffer back.  Returns zero if the frontend can't.  */
+static inline int dpy_share(DisplayState *s, uint8_t *data, int linesize)
+{
+    if (!s->dpy_share)
+        return !data;
+    return s->dpy_share(s, data, linesize);
+}
+
 typedef void (*vga_hw_update_ptr)(void *);
 typedef void (*vga_hw_invalidate_ptr)(void *);
 typedef void (*vga_hw_screen_dump_ptr)(void *, const char *);
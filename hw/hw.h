@@ -81,12 +81,28 @@ int64_t qemu_fseek(QEMUFile *f, int64_t pos, int whence);
 typedef void SaveStateHandler(QEMUFile *f, void *opaque);
 typedef int LoadStateHandler(QEMUFile *f, void *opaque, int version_id);
 
+/* stages of a live save, see qemu_savevm_state_begin() */
+#define QEMU_VM_STAGE_START	1
+#define QEMU_VM_STAGE_PART	2
+#define QEMU_VM_STAGE_END	3
+
+/* Return 1 when the device is ready to complete the save, a negative
+   value if the state could not be saved */
+typedef int SaveLiveStateHandler(QEMUFile *f, int stage, void *opaque);
+
 int register_savevm(const char *idstr,
                     int instance_id,
                     int version_id,
                     SaveStateHandler *save_state,
                     LoadStateHandler *load_state,
                     void *opaque);
+int register_savevm_live(const char *idstr,
+                         int instance_id,
+                         int version_id,
+                         SaveLiveStateHandler *save_live_state,
+                         SaveStateHandler *save_state,
+                         LoadStateHandler *load_state,
+                         void *opaque);
 
 typedef void QEMUResetHandler(void *opaque);
 
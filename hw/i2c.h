@@ -74,6 +74,8 @@ void wm8753_reset(i2c_slave *i2c);
 void wm8753_data_req_set(i2c_slave *i2c,
                 void (*data_req)(void *, int, int), void *opaque);
 void wm8753_dac_dat(void *opaque, uint32_t sample);
+uint8_t *wm8753_dac_buffer(void *opaque, int *samples);
+void wm8753_dac_commit(void *opaque);
 uint32_t wm8753_adc_dat(void *opaque);
 qemu_irq *wm8753_gpio_in_get(i2c_slave *i2c);
 void wm8753_gpio_out_set(i2c_slave *i2c, int line, qemu_irq handler);
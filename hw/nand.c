@@ -52,6 +52,7 @@ struct nand_flash_s {
     uint8_t *storage;
     BlockDriverState *bdrv;
     int mem_oob;
+    int mapped;
 
     int cle, ale, ce, wp, gnd;
 
@@ -491,6 +492,14 @@ struct nand_flash_s *nand_init(int manf_id, int chip_id)
         s->mem_oob = 0;
     }
 
+    /* Images that include the OOB area have the same layout as
+     * s->storage, so if the block layer can map them we operate on the
+     * mapping directly.  */
+    if (s->bdrv && !s->mem_oob) {
+        s->storage = bdrv_mmap(s->bdrv);
+        s->mapped = !!s->storage;
+    }
+
     if (!s->bdrv)
         pagesize += 1 << s->page_shift;
     if (pagesize)
@@ -525,7 +534,7 @@ static void glue(nand_blk_write_, PAGE_SIZE)(struct nand_flash_s *s)
     if (PAGE(s->addr) >= s->pages)
         return;
 
-    if (!s->bdrv) {
+    if (!s->bdrv || s->mapped) {
         memcpy(s->storage + PAGE_START(s->addr) + (s->addr & PAGE_MASK) +
                         s->offset, s->io, s->iolen);
     } else if (s->mem_oob) {
@@ -573,7 +582,7 @@ static void glue(nand_blk_erase_, PAGE_SIZE)(struct nand_flash_s *s)
     if (PAGE(addr) >= s->pages)
         return;
 
-    if (!s->bdrv) {
+    if (!s->bdrv || s->mapped) {
         memset(s->storage + PAGE_START(addr),
                         0xff, (PAGE_SIZE + OOB_SIZE) << s->erase_shift);
     } else if (s->mem_oob) {
@@ -615,7 +624,7 @@ static void glue(nand_blk_load_, PAGE_SIZE)(struct nand_flash_s *s,
     if (PAGE(addr) >= s->pages)
         return;
 
-    if (s->bdrv) {
+    if (s->bdrv && !s->mapped) {
         if (s->mem_oob) {
             if (bdrv_read(s->bdrv, SECTOR(addr), s->io, PAGE_SECTORS) == -1)
                 printf("%s: read error in sector %i\n",
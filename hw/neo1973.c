@@ -683,6 +683,8 @@ static void neo_i2c_setup(struct neo_board_s *s)
     s->cpu->i2s->opaque = s->wm;
     s->cpu->i2s->codec_out = wm8753_dac_dat;
     s->cpu->i2s->codec_in = wm8753_adc_dat;
+    s->cpu->i2s->codec_buffer = wm8753_dac_buffer;
+    s->cpu->i2s->codec_commit = wm8753_dac_commit;
     wm8753_data_req_set(s->wm, s->cpu->i2s->data_req, s->cpu->i2s);
 #endif
 }
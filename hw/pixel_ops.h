@@ -51,3 +51,119 @@ static inline unsigned int rgb_to_pixel32bgr(unsigned int r, unsigned int g,
 {
     return (b << 16) | (g << 8) | r;
 }
+
+/* Whole row converters for the common framebuffer formats.  Each returns
+ * the number of pixels converted, always a multiple of 8, and leaves the
+ * rest of the row to the caller's per-pixel code.  The SSE2 versions are
+ * used when the host CPU has it, otherwise nothing is converted here.  */
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+# include <emmintrin.h>
+# define PIXEL_OPS_SSE2
+
+static inline int pixel_ops_sse2(void)
+{
+    static int sse2 = -1;
+
+    if (sse2 < 0) {
+# if defined(__x86_64__)
+        sse2 = 1;	/* Part of the architecture */
+# else
+        uint32_t a, d;
+        __asm__ __volatile__ ("pushl %%ebx\n\tcpuid\n\tpopl %%ebx"
+                        : "=a" (a), "=d" (d) : "0" (1) : "ecx");
+        sse2 = (d >> 26) & 1;
+# endif
+    }
+    return sse2;
+}
+
+/* RGB565 to 32-bit xRGB */
+static inline int rgb565_to_pixel32_row(uint8_t *dest, const uint8_t *src,
+                int width)
+{
+    __m128i p, r, g, b, gb;
+    int n = width & ~7;
+    int i;
+
+    if (!pixel_ops_sse2())
+        return 0;
+
+    for (i = 0; i < n; i += 8, src += 16, dest += 32) {
+        p = _mm_loadu_si128((const __m128i *) src);
+        r = _mm_slli_epi16(_mm_srli_epi16(p, 11), 3);
+        g = _mm_and_si128(_mm_srli_epi16(p, 3), _mm_set1_epi16(0xfc));
+        b = _mm_and_si128(_mm_slli_epi16(p, 3), _mm_set1_epi16(0xf8));
+        gb = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        _mm_storeu_si128((__m128i *) dest + 0, _mm_unpacklo_epi16(gb, r));
+        _mm_storeu_si128((__m128i *) dest + 1, _mm_unpackhi_epi16(gb, r));
+    }
+    return n;
+}
+
+/* RGB565 to 15-bit RGB */
+static inline int rgb565_to_pixel15_row(uint8_t *dest, const uint8_t *src,
+                int width)
+{
+    __m128i p;
+    int n = width & ~7;
+    int i;
+
+    if (!pixel_ops_sse2())
+        return 0;
+
+    for (i = 0; i < n; i += 8, src += 16, dest += 16) {
+        p = _mm_loadu_si128((const __m128i *) src);
+        p = _mm_or_si128(_mm_and_si128(p, _mm_set1_epi16(0x001f)),
+                        _mm_and_si128(_mm_srli_epi16(p, 1),
+                                _mm_set1_epi16(0x7fe0)));
+        _mm_storeu_si128((__m128i *) dest, p);
+    }
+    return n;
+}
+
+/* 32-bit words with the colour in the low 24 bits to 32-bit xRGB */
+static inline int rgb888_to_pixel32_row(uint8_t *dest, const uint8_t *src,
+                int width)
+{
+    __m128i mask = _mm_set1_epi32(0x00ffffff);
+    int n = width & ~7;
+    int i;
+
+    if (!pixel_ops_sse2())
+        return 0;
+
+    for (i = 0; i < n; i += 4, src += 16, dest += 16)
+        _mm_storeu_si128((__m128i *) dest, _mm_and_si128(mask,
+                                _mm_loadu_si128((const __m128i *) src)));
+    return n;
+}
+
+/* Check that len bytes of src, a multiple of 16, all repeat the 32-bit
+ * pattern.  Used by the VNC server to find single colour tiles.  */
+static inline int pixel_block_is_fill(const uint8_t *src, int len,
+                uint32_t pattern)
+{
+    __m128i p = _mm_set1_epi32(pattern);
+    int i;
+
+    for (i = 0; i < len; i += 16)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(p,
+                        _mm_loadu_si128((const __m128i *) (src + i)))) != 0xffff)
+            return 0;
+    return 1;
+}
+#endif
+
+/* RGB565 to 16-bit RGB is a copy on little-endian hosts */
+static inline int rgb565_to_pixel16_row(uint8_t *dest, const uint8_t *src,
+                int width)
+{
+#ifndef WORDS_BIGENDIAN
+    int n = width & ~7;
+
+    memcpy(dest, src, n << 1);
+    return n;
+#else
+    return 0;
+#endif
+}
@@ -22,6 +22,7 @@ struct pxa2xx_lcdc_s {
     int irqlevel;
 
     int invalidated;
+    int shared;		/* Frontend reads the frame in place */
     DisplayState *ds;
     drawfn *line_fn[2];
     int dest_width;
@@ -674,7 +675,7 @@ static void pxa2xx_palette_parse(struct pxa2xx_lcdc_s *s, int ch, int bpp)
 static void pxa2xx_lcdc_dma0_redraw_horiz(struct pxa2xx_lcdc_s *s,
                 uint8_t *fb, int *miny, int *maxy)
 {
-    int y, src_width, dest_width, dirty[2];
+    int y, src_width, dest_width, dirty[2], share;
     uint8_t *src, *dest;
     ram_addr_t x, addr, new_addr, start, end;
     drawfn fn = 0;
@@ -692,6 +693,22 @@ static void pxa2xx_lcdc_dma0_redraw_horiz(struct pxa2xx_lcdc_s *s,
     else if (s->bpp > pxa_lcdc_8bpp)
         src_width *= 2;
 
+    /* When the frontend can read the frame in place there is nothing
+     * to convert, only the changed rows need reporting.  */
+#ifndef WORDS_BIGENDIAN
+    share = !s->transp && s->bpp == pxa_lcdc_16bpp && s->ds->depth == 16 &&
+            src_width == s->xres * 2;
+#else
+    share = 0;
+#endif
+    if (share && (!s->shared || s->ds->data != fb))
+        share = dpy_share(s->ds, fb, src_width);
+    if (!share && s->shared) {
+        dpy_share(s->ds, NULL, 0);
+        s->invalidated = 1;
+    }
+    s->shared = share;
+
     dest = s->ds->data;
     dest_width = s->xres * s->dest_width;
 
@@ -707,8 +724,9 @@ static void pxa2xx_lcdc_dma0_redraw_horiz(struct pxa2xx_lcdc_s *s,
             dirty[0] |= dirty[1];
         }
         if (dirty[0] || s->invalidated) {
-            fn((uint32_t *) s->dma_ch[0].palette,
-                            dest, src, s->xres, s->dest_width);
+            if (!share)
+                fn((uint32_t *) s->dma_ch[0].palette,
+                                dest, src, s->xres, s->dest_width);
             if (addr < start)
                 start = addr;
             end = new_addr;
@@ -886,6 +904,12 @@ static void pxa2xx_lcdc_orientation(void *opaque, int angle)
 {
     struct pxa2xx_lcdc_s *s = (struct pxa2xx_lcdc_s *) opaque;
 
+    /* Only the horizontal path knows about sharing */
+    if (s->shared) {
+        dpy_share(s->ds, NULL, 0);
+        s->shared = 0;
+    }
+
     if (angle) {
         s->dma_ch[0].redraw = pxa2xx_lcdc_dma0_redraw_vert;
     } else {
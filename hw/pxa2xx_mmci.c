@@ -114,23 +114,28 @@ static void pxa2xx_mmci_int_update(struct pxa2xx_mmci_s *s)
 
 static void pxa2xx_mmci_fifo_update(struct pxa2xx_mmci_s *s)
 {
+    int n, start;
+
     if (!s->active)
         return;
 
     if (s->cmdat & CMDAT_WR_RD) {
         while (s->bytesleft && s->tx_len) {
-            sd_write_data(s->card, s->tx_fifo[s->tx_start ++]);
-            s->tx_start &= 0x1f;
-            s->tx_len --;
-            s->bytesleft --;
+            n = MIN(MIN(s->bytesleft, s->tx_len), 32 - s->tx_start);
+            sd_write_block(s->card, s->tx_fifo + s->tx_start, n);
+            s->tx_start = (s->tx_start + n) & 0x1f;
+            s->tx_len -= n;
+            s->bytesleft -= n;
         }
         if (s->bytesleft)
             s->intreq |= INT_TXFIFO_REQ;
     } else
         while (s->bytesleft && s->rx_len < 32) {
-            s->rx_fifo[(s->rx_start + (s->rx_len ++)) & 0x1f] =
-                sd_read_data(s->card);
-            s->bytesleft --;
+            start = (s->rx_start + s->rx_len) & 0x1f;
+            n = MIN(MIN(s->bytesleft, 32 - s->rx_len), 32 - start);
+            sd_read_block(s->card, s->rx_fifo + start, n);
+            s->rx_len += n;
+            s->bytesleft -= n;
             s->intreq |= INT_RXFIFO_REQ;
         }
 
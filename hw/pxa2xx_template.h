@@ -27,6 +27,24 @@
 # define SWAP_WORDS	1
 #endif
 
+/* Conversion of whole rows, see pixel_ops.h.  Only usable when the
+   destination pixels are contiguous, not for rotated output.  */
+#if BITS == 16
+# define ROW16_FN(d, s, w)	rgb565_to_pixel16_row(d, s, w)
+#elif BITS == 15 && defined(PIXEL_OPS_SSE2)
+# define ROW16_FN(d, s, w)	rgb565_to_pixel15_row(d, s, w)
+#elif BITS == 32 && defined(PIXEL_OPS_SSE2)
+# define ROW16_FN(d, s, w)	rgb565_to_pixel32_row(d, s, w)
+# define ROW24_FN(d, s, w)	rgb888_to_pixel32_row(d, s, w)
+#endif
+#define ROW(fn, srcstep)					\
+    if (deststep == (BITS + 7) / 8) {			\
+        int n = fn(dest, src, width);			\
+        dest += n * deststep;				\
+        src += n * srcstep;				\
+        width -= n;					\
+    }
+
 #define FN_2(x)		FN(x + 1) FN(x)
 #define FN_4(x)		FN_2(x + 2) FN_2(x)
 
@@ -107,6 +125,9 @@ static void glue(pxa2xx_draw_line16_, BITS)(uint32_t *palette,
 {
     uint32_t data;
     unsigned int r, g, b;
+#ifdef ROW16_FN
+    ROW(ROW16_FN, 2)
+#endif
     while (width > 0) {
         data = *(uint32_t *) src;
 #ifdef SWAP_WORDS
@@ -330,6 +351,9 @@ static void glue(pxa2xx_draw_line24_, BITS)(uint32_t *palette,
 {
     uint32_t data;
     unsigned int r, g, b;
+#ifdef ROW24_FN
+    ROW(ROW24_FN, 4)
+#endif
     while (width > 0) {
         data = *(uint32_t *) src;
 #ifdef SWAP_WORDS
@@ -423,6 +447,13 @@ static drawfn glue(glue(pxa2xx_draw_fn_, BITS), t)[16] =
 };
 
 #undef BITS
+#undef ROW
+#ifdef ROW16_FN
+# undef ROW16_FN
+#endif
+#ifdef ROW24_FN
+# undef ROW24_FN
+#endif
 #undef COPY_PIXEL
 #undef SKIP_PIXEL
 
@@ -111,6 +111,9 @@ qemu_irq *s3c_pic_get(struct s3c_pic_state_s *s);
 struct s3c_dma_state_s;
 struct s3c_dma_state_s *s3c_dma_init(target_phys_addr_t base, qemu_irq *pic);
 qemu_irq *s3c_dma_get(struct s3c_dma_state_s *s);
+typedef int (*s3c_dma_fifo_fn)(void *opaque, uint8_t *buf, int len);
+void s3c_dma_fifo_register(struct s3c_dma_state_s *s, target_phys_addr_t addr,
+                s3c_dma_fifo_fn read, s3c_dma_fifo_fn write, void *opaque);
 
 /* GPIO TODO: remove this out, replace with qemu_irq or sumpthin */
 typedef void (*gpio_handler_t)(int line, int level, void *opaque);
@@ -159,6 +162,8 @@ void s3c_lcd_reset(struct s3c_lcd_state_s *s);
 struct s3c_mmci_state_s;
 struct s3c_mmci_state_s *s3c_mmci_init(target_phys_addr_t base, uint16_t model,
                 struct sd_card_s *mmc, qemu_irq irq, qemu_irq *dma);
+void s3c_mmci_dma_attach(struct s3c_mmci_state_s *s,
+                struct s3c_dma_state_s *dma);
 void s3c_mmci_reset(struct s3c_mmci_state_s *s);
 
 /* s3c24xx_rtc.c */
@@ -171,6 +176,8 @@ struct s3c_udc_state_s;
 struct s3c_udc_state_s *s3c_udc_init(target_phys_addr_t base, qemu_irq irq,
                 qemu_irq *dma);
 void s3c_udc_reset(struct s3c_udc_state_s *s);
+void s3c_udc_dma_attach(struct s3c_udc_state_s *s,
+                struct s3c_dma_state_s *dma);
 
 /* s3c2410.c */
 struct s3c_spi_state_s;
@@ -240,6 +247,9 @@ struct s3c_i2s_state_s { /* XXX move to .c */
     int rx_len;
     void (*codec_out)(void *, uint32_t);
     uint32_t (*codec_in)(void *);
+    /* Optional, used by the DMA engine to pass whole blocks of samples */
+    uint8_t *(*codec_buffer)(void *, int *);
+    void (*codec_commit)(void *);
     void *opaque;
 
     uint16_t buffer;
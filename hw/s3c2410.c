@@ -686,11 +686,20 @@ static int s3c_clkpwr_load(QEMUFile *f, void *opaque, int version_id)
 
 /* DMA controller */
 #define S3C_DMA_CH_N	4
+#define S3C_DMA_FIFO_N	8
+#define S3C_DMA_BULK	4096	/* Bytes moved at once by the fast path */
 
 struct s3c_dma_ch_state_s;
 struct s3c_dma_state_s {	/* Modelled as an interrupt controller */
     target_phys_addr_t base;
     qemu_irq *drqs;
+    int fifos;
+    struct s3c_dma_fifo_s {
+        target_phys_addr_t addr;
+        s3c_dma_fifo_fn read;
+        s3c_dma_fifo_fn write;
+        void *opaque;
+    } fifo[S3C_DMA_FIFO_N];
     struct s3c_dma_ch_state_s {
         qemu_irq intr;
         int curr_tc;
@@ -707,6 +716,74 @@ struct s3c_dma_state_s {	/* Modelled as an interrupt controller */
     } ch[S3C_DMA_CH_N];
 };
 
+/* Check that a span can be accessed without side effects.  */
+static int s3c_dma_is_mem(target_phys_addr_t addr, int len, int rom)
+{
+    target_phys_addr_t page;
+    uint32_t pd;
+
+    for (page = addr & TARGET_PAGE_MASK; page < addr + len;
+                    page += TARGET_PAGE_SIZE) {
+        pd = cpu_get_physical_page_desc(page) & ~TARGET_PAGE_MASK;
+        if (pd != IO_MEM_RAM && !(rom && pd == IO_MEM_ROM))
+            return 0;
+    }
+    return 1;
+}
+
+static struct s3c_dma_fifo_s *s3c_dma_fifo_find(struct s3c_dma_state_s *s,
+                target_phys_addr_t addr)
+{
+    int i;
+    for (i = 0; i < s->fifos; i ++)
+        if (s->fifo[i].addr == addr)
+            return &s->fifo[i];
+    return 0;
+}
+
+/* Move as many transfer units as possible with one bulk copy, when
+ * both ends are memory, or one end is memory and the other a FIFO with
+ * a bulk interface.  Returns the number of units moved.  */
+static int s3c_dma_ch_bulk(struct s3c_dma_state_s *s,
+                struct s3c_dma_ch_state_s *ch, int unit)
+{
+    uint8_t buffer[S3C_DMA_BULK];
+    struct s3c_dma_fifo_s *fifo;
+    int len, src_fixed, dst_fixed;
+
+    src_fixed = ch->isrcc & 1;					/* INC */
+    dst_fixed = ch->idstc & 1;					/* INC */
+    len = MIN(ch->curr_tc, sizeof(buffer) / unit) * unit;
+
+    if (!src_fixed && !dst_fixed) {
+        if (!s3c_dma_is_mem(ch->csrc, len, 1) ||
+                        !s3c_dma_is_mem(ch->cdst, len, 0))
+            return 0;
+        cpu_physical_memory_read(ch->csrc, buffer, len);
+        cpu_physical_memory_write(ch->cdst, buffer, len);
+    } else if (src_fixed && !dst_fixed) {
+        fifo = s3c_dma_fifo_find(s, ch->csrc);
+        if (!fifo || !fifo->read || !s3c_dma_is_mem(ch->cdst, len, 0))
+            return 0;
+        len = fifo->read(fifo->opaque, buffer, len) / unit * unit;
+        cpu_physical_memory_write(ch->cdst, buffer, len);
+    } else if (!src_fixed && dst_fixed) {
+        fifo = s3c_dma_fifo_find(s, ch->cdst);
+        if (!fifo || !fifo->write || !s3c_dma_is_mem(ch->csrc, len, 1))
+            return 0;
+        cpu_physical_memory_read(ch->csrc, buffer, len);
+        len = fifo->write(fifo->opaque, buffer, len) / unit * unit;
+    } else
+        return 0;
+
+    if (!src_fixed)
+        ch->csrc += len;
+    if (!dst_fixed)
+        ch->cdst += len;
+    ch->curr_tc -= len / unit;
+    return len / unit;
+}
+
 static inline void s3c_dma_ch_run(struct s3c_dma_state_s *s,
                 struct s3c_dma_ch_state_s *ch)
 {
@@ -722,15 +799,19 @@ static inline void s3c_dma_ch_run(struct s3c_dma_state_s *s,
             return;
         }
         ch->running = 1;
-        while (ch->curr_tc --) {
-            for (t = 0; t < burst; t ++) {
-                cpu_physical_memory_read(ch->csrc, buffer, width);
-                cpu_physical_memory_write(ch->cdst, buffer, width);
-
-                if (!(ch->isrcc & 1))				/* INT */
-                    ch->csrc += width;
-                if (!(ch->idstc & 1))				/* INT */
-                    ch->cdst += width;
+        while (ch->curr_tc > 0) {
+            /* Fall back to one access per unit for I/O with side effects */
+            if (!s3c_dma_ch_bulk(s, ch, width * burst)) {
+                for (t = 0; t < burst; t ++) {
+                    cpu_physical_memory_read(ch->csrc, buffer, width);
+                    cpu_physical_memory_write(ch->cdst, buffer, width);
+
+                    if (!(ch->isrcc & 1))			/* INC */
+                        ch->csrc += width;
+                    if (!(ch->idstc & 1))			/* INC */
+                        ch->cdst += width;
+                }
+                ch->curr_tc --;
             }
 
             if (!(ch->con & (1 << 27)) && !ch->req)		/* SERVMODE */
@@ -970,6 +1051,24 @@ qemu_irq *s3c_dma_get(struct s3c_dma_state_s *s)
     return s->drqs;
 }
 
+/* Let the channels transfer to or from the FIFO register at ADDR in
+ * bulk.  READ fills BUF and WRITE consumes it, moving at most LEN bytes
+ * in whole transfer units, and return the number of bytes moved.  They
+ * must raise and lower the DMA request as the register accesses would.  */
+void s3c_dma_fifo_register(struct s3c_dma_state_s *s, target_phys_addr_t addr,
+                s3c_dma_fifo_fn read, s3c_dma_fifo_fn write, void *opaque)
+{
+    if (s->fifos >= S3C_DMA_FIFO_N) {
+        printf("%s: too many FIFOs\n", __FUNCTION__);
+        return;
+    }
+    s->fifo[s->fifos].addr = addr;
+    s->fifo[s->fifos].read = read;
+    s->fifo[s->fifos].write = write;
+    s->fifo[s->fifos].opaque = opaque;
+    s->fifos ++;
+}
+
 /* PWM timers controller */
 struct s3c_timer_state_s;
 struct s3c_timers_state_s {
@@ -1301,6 +1400,22 @@ struct s3c_uart_state_s {
     int chr_num;
     CharDriverState *chr[UART_MAX_CHR];
 
+    /* Host side buffers.  Received data waits in rxbuf until there's
+     * room in the FIFO, transmitted data is collected in txbuf and
+     * written to the chardevs in one go when tx_timer expires.  */
+#define UART_BUF_LEN	4096
+#define UART_TX_DELAY	(ticks_per_sec / 1000)	/* Collect Tx data for 1 ms */
+    uint8_t rxbuf[UART_BUF_LEN];
+    int rxbufstart;
+    int rxbuflen;
+    uint8_t txbuf[UART_BUF_LEN];
+    int txlen;
+    QEMUTimer *tx_timer;
+    QEMUTimer *rx_timer;	/* Only used with -serial-pacing */
+    int64_t char_time;		/* Time to shift one character at the
+                                 * current line settings */
+    int64_t tx_done;		/* When the last character queued is out */
+
     uint8_t lcontrol;
     uint8_t fcontrol;
     uint8_t mcontrol;
@@ -1319,6 +1434,28 @@ static void s3c_uart_reset(struct s3c_uart_state_s *s)
 
     s->rxstart = 0;
     s->rxlen = 0;
+    s->tx_done = 0;
+
+    /* Drop whatever the host side buffers still hold */
+    s->rxbufstart = 0;
+    s->rxbuflen = 0;
+    s->txlen = 0;
+    qemu_del_timer(s->rx_timer);
+    qemu_del_timer(s->tx_timer);
+}
+
+/* Number of characters still being shifted out, always 0 unless the
+ * baud rate is emulated.  */
+static int s3c_uart_tx_pending(struct s3c_uart_state_s *s)
+{
+    int64_t left;
+    if (!serial_pacing)
+        return 0;
+
+    left = s->tx_done - qemu_get_clock(vm_clock);
+    if (left <= 0)
+        return 0;
+    return (left + s->char_time - 1) / s->char_time;
 }
 
 static void s3c_uart_err(struct s3c_uart_state_s *s, int err)
@@ -1356,6 +1493,9 @@ inline static void s3c_uart_full(struct s3c_uart_state_s *s, int pulse)
 
 inline static void s3c_uart_empty(struct s3c_uart_state_s *s, int pulse)
 {
+    if (s3c_uart_tx_pending(s) >= ((s->fcontrol & 1) ? 16 : 1))
+        return;
+
     switch ((s->control >> 2) & 3) {		/* TransmitMode */
     case 1:
         if ((s->control & (1 << 9)) || pulse)	/* TxInterruptType */
@@ -1378,8 +1518,6 @@ static void s3c_uart_params_update(struct s3c_uart_state_s *s)
 {
     QEMUSerialSetParams ssp;
     int i;
-    if (!s->chr)
-        return;
 
     /* XXX Calculate PCLK frequency from clock manager registers */
     ssp.speed = (S3C_PCLK_FREQ >> 4) / (s->brdiv + 1);
@@ -1401,43 +1539,125 @@ static void s3c_uart_params_update(struct s3c_uart_state_s *s)
 
     ssp.stop_bits = (s->lcontrol & (1 << 2)) ? 2 : 1;
 
+    s->char_time = muldiv64(1 + ssp.data_bits + ssp.stop_bits +
+                    (ssp.parity != 'N'), ticks_per_sec, ssp.speed);
+
     for (i = 0; i < s->chr_num; i ++)
         qemu_chr_ioctl(s->chr[i], CHR_IOCTL_SERIAL_SET_PARAMS, &ssp);
 }
 
-static int s3c_uart_is_empty(void *opaque)
+/* Move up to LEN characters from the host buffer to the Rx FIFO.  */
+static void s3c_uart_fill(struct s3c_uart_state_s *s, int len)
 {
-    struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
+    int i, n;
     if (s->fcontrol & 1)			/* FIFOEnable */
-        return 16 - s->rxlen;
+        n = 16 - s->rxlen;
     else
-        return 1 - s->rxlen;
+        n = 1 - s->rxlen;
+    n = MIN(MIN(n, len), s->rxbuflen);
+    if (n <= 0)
+        return;
+
+    if (s->fcontrol & 1)			/* FIFOEnable */
+        for (i = 0; i < n; i ++) {
+            s->rxfifo[(s->rxstart + s->rxlen ++) & 15] =
+                    s->rxbuf[s->rxbufstart ++];
+            s->rxbufstart &= UART_BUF_LEN - 1;
+        }
+    else {
+        s->rxlen = 1;
+        s->data = s->rxbuf[s->rxbufstart ++];
+        s->rxbufstart &= UART_BUF_LEN - 1;
+    }
+    s->rxbuflen -= n;
+
+    s3c_uart_full(s, 1);
+    for (i = 0; i < s->chr_num; i ++)
+        qemu_chr_accept_input(s->chr[i]);
 }
 
-static void s3c_uart_rx(void *opaque, const uint8_t *buf, int size)
+/* Refill the Rx FIFO right away or, when emulating the baud rate, one
+ * character at a time.  */
+static void s3c_uart_refill(struct s3c_uart_state_s *s)
+{
+    if (!s->rxbuflen)
+        return;
+
+    if (!serial_pacing)
+        s3c_uart_fill(s, UART_BUF_LEN);
+    else if (!qemu_timer_pending(s->rx_timer))
+        qemu_mod_timer(s->rx_timer,
+                        qemu_get_clock(vm_clock) + s->char_time);
+}
+
+static void s3c_uart_rx_tick(void *opaque)
 {
     struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
-    int left;
-    if (s->fcontrol & 1) {			/* FIFOEnable */
-        if (s->rxlen + size > 16) {
-            size = 16 - s->rxlen;
-            s3c_uart_err(s, 1);
-        }
+    s3c_uart_fill(s, 1);
+    s3c_uart_refill(s);
+}
 
-        left = 16 - ((s->rxstart + s->rxlen) & 15);
-        if (size > left) {
-            memcpy(s->rxfifo + ((s->rxstart + s->rxlen) & 15), buf, left);
-            memcpy(s->rxfifo, buf + left, size - left);
-        } else
-            memcpy(s->rxfifo + ((s->rxstart + s->rxlen) & 15), buf, size);
-        s->rxlen += size;
-    } else {
-        if (s->rxlen + size > 1)
-            s3c_uart_err(s, 1);
-        s->rxlen = 1;
-        s->data = buf[0];
+static int s3c_uart_is_empty(void *opaque)
+{
+    struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
+    return UART_BUF_LEN - s->rxbuflen;
+}
+
+static void s3c_uart_rx(void *opaque, const uint8_t *buf, int size)
+{
+    struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
+    int start, left;
+    if (s->rxbuflen + size > UART_BUF_LEN) {
+        size = UART_BUF_LEN - s->rxbuflen;
+        s3c_uart_err(s, 1);
     }
-    s3c_uart_full(s, 1);
+
+    start = (s->rxbufstart + s->rxbuflen) & (UART_BUF_LEN - 1);
+    left = UART_BUF_LEN - start;
+    if (size > left) {
+        memcpy(s->rxbuf + start, buf, left);
+        memcpy(s->rxbuf, buf + left, size - left);
+    } else
+        memcpy(s->rxbuf + start, buf, size);
+    s->rxbuflen += size;
+
+    s3c_uart_refill(s);
+}
+
+static void s3c_uart_tx_flush(struct s3c_uart_state_s *s)
+{
+    int i;
+    if (!s->txlen)
+        return;
+
+    for (i = 0; i < s->chr_num; i ++)
+        qemu_chr_write(s->chr[i], s->txbuf, s->txlen);
+    s->txlen = 0;
+}
+
+static void s3c_uart_tx_tick(void *opaque)
+{
+    struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
+    s3c_uart_tx_flush(s);
+    if (serial_pacing)
+        s3c_uart_empty(s, 1);
+}
+
+static void s3c_uart_tx(struct s3c_uart_state_s *s, uint8_t ch)
+{
+    int64_t now;
+    if (s->txlen >= UART_BUF_LEN)
+        s3c_uart_tx_flush(s);
+    s->txbuf[s->txlen ++] = ch;
+
+    if (serial_pacing) {
+        /* The data goes out when the guest sees the line idle again */
+        now = qemu_get_clock(vm_clock);
+        s->tx_done = MAX(s->tx_done, now) + s->char_time;
+        qemu_mod_timer(s->tx_timer, s->tx_done);
+    } else if (s->txlen == 1)
+        qemu_mod_timer(s->tx_timer,
+                        qemu_get_clock(vm_clock) + UART_TX_DELAY);
 }
 
 /* S3C2410 UART doesn't seem to understand break conditions.  */
@@ -1461,6 +1681,7 @@ static uint32_t s3c_uart_read(void *opaque, target_phys_addr_t addr)
 {
     struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
     uint8_t ret;
+    int i;
     addr -= s->base;
 
     switch (addr) {
@@ -1473,7 +1694,7 @@ static uint32_t s3c_uart_read(void *opaque, target_phys_addr_t addr)
     case S3C_UMCON:
         return s->mcontrol;
     case S3C_UTRSTAT:
-        return 6 | !!s->rxlen;
+        return (s3c_uart_tx_pending(s) ? 0 : 6) | !!s->rxlen;
     case S3C_UERSTAT:
         /* XXX: UERSTAT[3] is Reserved but Linux thinks it is BREAK */
         ret = s->errstat;
@@ -1482,7 +1703,9 @@ static uint32_t s3c_uart_read(void *opaque, target_phys_addr_t addr)
         return ret;
     case S3C_UFSTAT:
         s3c_uart_update(s);
-        return s->rxlen ? s->rxlen | (1 << 8) : 0;
+        i = s3c_uart_tx_pending(s);
+        return (s->rxlen ? s->rxlen | (1 << 8) : 0) |
+                (i >= 16 ? 1 << 9 : i << 4);
     case S3C_UMSTAT:
         s3c_uart_update(s);
         return 0x11;
@@ -1495,6 +1718,8 @@ static uint32_t s3c_uart_read(void *opaque, target_phys_addr_t addr)
                 s->rxstart &= 15;
             } else
                 ret = s->data;
+            if (!serial_pacing)
+                s3c_uart_fill(s, UART_BUF_LEN);
             return ret;
         }
         return 0;
@@ -1511,7 +1736,6 @@ static void s3c_uart_write(void *opaque, target_phys_addr_t addr,
                 uint32_t value)
 {
     struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
-    uint8_t ch;
     int i, afc;
     addr -= s->base;
 
@@ -1537,6 +1761,7 @@ static void s3c_uart_write(void *opaque, target_phys_addr_t addr,
             s->rxlen = 0;
         s->fcontrol = value & 0xf1;
         s3c_uart_update(s);
+        s3c_uart_refill(s);
         break;
     case S3C_UMCON:
         if ((s->mcontrol ^ value) & (1 << 4)) {
@@ -1548,9 +1773,7 @@ static void s3c_uart_write(void *opaque, target_phys_addr_t addr,
         s3c_uart_update(s);
         break;
     case S3C_UTXH:
-        ch = value & 0xff;
-        for (i = 0; i < s->chr_num; i ++)
-            qemu_chr_write(s->chr[i], &ch, 1);
+        s3c_uart_tx(s, value & 0xff);
         s3c_uart_empty(s, 1);
         s3c_uart_update(s);
         break;
@@ -1579,6 +1802,9 @@ static CPUWriteMemoryFunc *s3c_uart_writefn[] = {
 static void s3c_uart_save(QEMUFile *f, void *opaque)
 {
     struct s3c_uart_state_s *s = (struct s3c_uart_state_s *) opaque;
+    int i;
+    s3c_uart_tx_flush(s);
+
     qemu_put_8s(f, &s->data);
     qemu_put_buffer(f, s->rxfifo, sizeof(s->rxfifo));
     qemu_put_be32(f, s->rxstart);
@@ -1589,6 +1815,10 @@ static void s3c_uart_save(QEMUFile *f, void *opaque)
     qemu_put_be16s(f, &s->control);
     qemu_put_be16s(f, &s->brdiv);
     qemu_put_8s(f, &s->errstat);
+
+    qemu_put_be32(f, s->rxbuflen);
+    for (i = 0; i < s->rxbuflen; i ++)
+        qemu_put_byte(f, s->rxbuf[(s->rxbufstart + i) & (UART_BUF_LEN - 1)]);
 }
 
 static int s3c_uart_load(QEMUFile *f, void *opaque, int version_id)
@@ -1605,6 +1835,19 @@ static int s3c_uart_load(QEMUFile *f, void *opaque, int version_id)
     qemu_get_be16s(f, &s->brdiv);
     qemu_get_8s(f, &s->errstat);
 
+    s->rxbufstart = 0;
+    s->rxbuflen = 0;
+    if (version_id >= 1) {
+        s->rxbuflen = qemu_get_be32(f);
+        if (s->rxbuflen < 0 || s->rxbuflen > UART_BUF_LEN)
+            return -EINVAL;
+        qemu_get_buffer(f, s->rxbuf, s->rxbuflen);
+    }
+
+    s3c_uart_params_update(s);
+    s->tx_done = 0;
+    s3c_uart_refill(s);
+
     return 0;
 }
 
@@ -1618,14 +1861,17 @@ struct s3c_uart_state_s *s3c_uart_init(target_phys_addr_t base,
     s->base = base;
     s->irq = irqs;
     s->dma = dma;
+    s->tx_timer = qemu_new_timer(vm_clock, s3c_uart_tx_tick, s);
+    s->rx_timer = qemu_new_timer(vm_clock, s3c_uart_rx_tick, s);
 
     s3c_uart_reset(s);
+    s3c_uart_params_update(s);
 
     iomemtype = cpu_register_io_memory(0, s3c_uart_readfn,
                     s3c_uart_writefn, s);
     cpu_register_physical_memory(s->base, 0xfff, iomemtype);
 
-    register_savevm("s3c24xx_uart", base, 0, s3c_uart_save, s3c_uart_load, s);
+    register_savevm("s3c24xx_uart", base, 1, s3c_uart_save, s3c_uart_load, s);
 
     return s;
 }
@@ -2474,10 +2720,35 @@ static void s3c_i2s_reset(struct s3c_i2s_state_s *s)
 #define S3C_IISFCON	0x0c	/* IIS FIFO Interface register */
 #define S3C_IISFIFO	0x10	/* IIS FIFO register */
 
+/* Move one half-word through the FIFO, a sample is made of two */
+static uint16_t s3c_i2s_in(struct s3c_i2s_state_s *s)
+{
+    uint32_t ret;
+
+    s->rx_len --;
+    s3c_i2s_update(s);
+    s->cycle ^= 1;
+    if (s->cycle) {
+        s->buffer = (uint16_t) (ret = s->codec_in(s->opaque));
+        return ret >> 16;
+    } else
+        return s->buffer;
+}
+
+static void s3c_i2s_out(struct s3c_i2s_state_s *s, uint16_t value)
+{
+    s->tx_len --;
+    s3c_i2s_update(s);
+    if (s->cycle)
+        s->codec_out(s->opaque, value | ((uint32_t) s->buffer << 16));
+    else
+        s->buffer = value;
+    s->cycle ^= 1;
+}
+
 static uint32_t s3c_i2s_read(void *opaque, target_phys_addr_t addr)
 {
     struct s3c_i2s_state_s *s = (struct s3c_i2s_state_s *) opaque;
-    uint32_t ret;
     addr -= s->base;
 
     switch (addr) {
@@ -2492,16 +2763,8 @@ static uint32_t s3c_i2s_read(void *opaque, target_phys_addr_t addr)
                 (MAX(32 - s->tx_len, 0) << 6) |
                 MIN(s->rx_len, 32);
     case S3C_IISFIFO:
-        if (s->rx_len > 0) {
-            s->rx_len --;
-            s3c_i2s_update(s);
-            s->cycle ^= 1;
-            if (s->cycle) {
-                s->buffer = (uint16_t) (ret = s->codec_in(s->opaque));
-                return ret >> 16;
-            } else
-                return s->buffer;
-        }
+        if (s->rx_len > 0)
+            return s3c_i2s_in(s);
     default:
         printf("%s: Bad register 0x%lx\n", __FUNCTION__, addr);
         break;
@@ -2532,15 +2795,8 @@ static void s3c_i2s_write(void *opaque, target_phys_addr_t addr,
         s3c_i2s_update(s);
         break;
     case S3C_IISFIFO:
-        if (s->tx_len && s->tx_en) {
-            s->tx_len --;
-            s3c_i2s_update(s);
-            if (s->cycle)
-                s->codec_out(s->opaque, value | ((uint32_t) s->buffer << 16));
-            else
-                s->buffer = (uint16_t) value;
-            s->cycle ^= 1;
-        }
+        if (s->tx_len && s->tx_en)
+            s3c_i2s_out(s, value);
         break;
     default:
         printf("%s: Bad register 0x%lx\n", __FUNCTION__, addr);
@@ -2593,6 +2849,66 @@ static int s3c_i2s_load(QEMUFile *f, void *opaque, int version_id)
     return 0;
 }
 
+/* Bulk access to IISFIFO for the DMA engine.  Whole samples are handed
+ * to the codec in one block if it can take them that way, so that a DMA
+ * period reaches the audio backend in one piece.  */
+static int s3c_i2s_fifo_read(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_i2s_state_s *s = (struct s3c_i2s_state_s *) opaque;
+    uint16_t value;
+    int i, n;
+
+    n = MIN(len >> 1, s->rx_len);
+    for (i = 0; i < n; i ++) {
+        value = s3c_i2s_in(s);
+        buf[(i << 1) + 0] = value >> 0;
+        buf[(i << 1) + 1] = value >> 8;
+    }
+    return n << 1;
+}
+
+static int s3c_i2s_fifo_write(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_i2s_state_s *s = (struct s3c_i2s_state_s *) opaque;
+    uint32_t *out;
+    int i, n, samples;
+
+    if (!s->tx_en)
+        return 0;
+    n = MIN(len >> 1, s->tx_len);
+    if (!s->codec_buffer) {
+        for (i = 0; i < n; i ++)
+            s3c_i2s_out(s, buf[(i << 1) + 0] | (buf[(i << 1) + 1] << 8));
+        return n << 1;
+    }
+
+    i = 0;
+    if (s->cycle && i < n) {
+        s3c_i2s_out(s, buf[0] | (buf[1] << 8));
+        i ++;
+    }
+
+    samples = (n - i) >> 1;
+    if (samples) {
+        /* The codec may take fewer samples than asked for, the DMA
+         * engine then retries with the rest.  */
+        out = (uint32_t *) s->codec_buffer(s->opaque, &samples);
+        s->tx_len -= samples << 1;
+        for (; samples; samples --, i += 2, out ++)
+            *out = ((uint32_t) buf[(i << 1) + 0] << 16) |
+                    ((uint32_t) buf[(i << 1) + 1] << 24) |
+                    (buf[(i << 1) + 2] << 0) | (buf[(i << 1) + 3] << 8);
+        s->codec_commit(s->opaque);
+    }
+
+    if (i == n - 1) {
+        s3c_i2s_out(s, buf[i << 1] | (buf[(i << 1) + 1] << 8));
+        i ++;
+    }
+    s3c_i2s_update(s);
+    return i << 1;
+}
+
 static void s3c_i2s_data_req(void *opaque, int tx, int rx)
 {
     struct s3c_i2s_state_s *s = (struct s3c_i2s_state_s *) opaque;
@@ -2893,12 +3209,15 @@ struct s3c_state_s *s3c2410_init(unsigned int sdram_size, DisplayState *ds,
     s->timers = s3c_timers_init(0x51000000, &s->irq[S3C_PIC_TIMER0], s->drq);
 
     s->udc = s3c_udc_init(0x52000000, s->irq[S3C_PIC_USBD], s->drq);
+    s3c_udc_dma_attach(s->udc, s->dma);
 
     s->wdt = s3c_wdt_init(0x53000000, s->irq[S3C_PIC_WDT]);
 
     s->i2c = s3c_i2c_init(0x54000000, s->irq[S3C_PIC_IIC]);
 
     s->i2s = s3c_i2s_init(0x55000000, s->drq);
+    s3c_dma_fifo_register(s->dma, 0x55000000 + S3C_IISFIFO,
+                    s3c_i2s_fifo_read, s3c_i2s_fifo_write, s->i2s);
 
     s->io = s3c_gpio_init(0x56000000, s->irq);
 
@@ -2913,6 +3232,7 @@ struct s3c_state_s *s3c2410_init(unsigned int sdram_size, DisplayState *ds,
 
     s->mmci = s3c_mmci_init(0x5a000000, 0x2410, mmc,
                     s->irq[S3C_PIC_SDI], s->drq);
+    s3c_mmci_dma_attach(s->mmci, s->dma);
 
     if (usb_enabled) {
         usb_ohci_init_memio(0x49000000, 3, -1, s->irq[S3C_PIC_USBH]);
@@ -10,6 +10,7 @@
 #include "s3c.h"
 #include "hw.h"
 #include "console.h"
+#include "pixel_ops.h"
 
 typedef void (*s3c_drawfn_t)(uint32_t *, uint8_t *, const uint8_t *, int, int);
 
@@ -46,6 +47,12 @@ struct s3c_lcd_state_s {
     int src_width;
     int dest_width;
     s3c_drawfn_t fn;
+
+    /* Copy of the framebuffer contents last drawn, to find the columns
+     * that changed within the dirty pages.  */
+    uint8_t *shadow;
+    int shadow_size;
+    int shared;		/* Frontend reads the framebuffer in place */
 };
 
 static void s3c_lcd_update(struct s3c_lcd_state_s *s)
@@ -394,12 +401,41 @@ static void s3c_lcd_palette_load(struct s3c_lcd_state_s *s)
     }
 }
 
+static int s3c_lcd_shareable(struct s3c_lcd_state_s *s)
+{
+#ifndef WORDS_BIGENDIAN
+    if (s->bpp == 12 && s->frm565)			/* 16 bpp, 5:6:5 */
+        return s->ds->depth == 16;
+    if (s->bpp == 13)					/* 24 bpp */
+        return s->ds->depth == 32 && !s->ds->bgr;
+#endif
+    return 0;
+}
+
+/* Find the span of changed bytes in a row, rounded to 32-bit words since
+ * the line functions read whole words.  Returns zero if nothing changed.  */
+static int s3c_lcd_row_diff(const uint8_t *row, const uint8_t *shadow,
+                int len, int *start, int *end)
+{
+    int i, j;
+
+    for (i = 0; i < len && row[i] == shadow[i]; i ++);
+    if (i == len)
+        return 0;
+    for (j = len; row[j - 1] == shadow[j - 1]; j --);
+
+    *start = i & ~3;
+    *end = MIN((j + 3) & ~3, len);
+    return 1;
+}
+
 static void s3c_update_display(void *opaque)
 {
     struct s3c_lcd_state_s *s = (struct s3c_lcd_state_s *) opaque;
-    int y, src_width, dest_width, dirty[2], miny, maxy;
+    int y, src_width, dest_width, dirty[2], miny;
+    int x0, x1, rx0, rx1, ry, start_b, end_b, bits, invalidate, share;
     ram_addr_t x, addr, new_addr, start, end;
-    uint8_t *src, *dest;
+    uint8_t *src, *dest, *shadow;
     if (!s->enable || !s->dest_width)
         return;
 
@@ -413,15 +449,42 @@ static void s3c_update_display(void *opaque)
     src = s->fb;
     src_width = s->src_width;
 
+    /* When the frontend can read the framebuffer in place there is
+     * nothing to convert, only the changed areas need reporting.  */
+    share = s3c_lcd_shareable(s);
+    if (share && (!s->shared || s->ds->data != s->fb))
+        share = dpy_share(s->ds, s->fb, src_width);
+    if (!share && s->shared) {
+        dpy_share(s->ds, NULL, 0);
+        s->invalidate = 1;
+    }
+    s->shared = share;
+
     dest = s->ds->data;
     dest_width = s->width * s->dest_width;
 
+    if (s->shadow_size < s->height * src_width) {
+        qemu_free(s->shadow);
+        s->shadow_size = s->height * src_width;
+        s->shadow = qemu_malloc(s->shadow_size);
+        s->invalidate = 1;
+    }
+    shadow = s->shadow;
+    invalidate = s->invalidate;
+
+    /* Column ranges can only be drawn for formats with a whole number
+     * of pixels per 32-bit word, the rest are drawn a full row at a time */
+    bits = (src_width << 3) / s->width;
+    if (bits != 1 && bits != 2 && bits != 4 && bits != 8 &&
+                    bits != 16 && bits != 32)
+        bits = 0;
+
     addr = (ram_addr_t) (s->fb - (void *) phys_ram_base);
     start = addr + s->height * src_width;
     end = addr;
     dirty[0] = dirty[1] = cpu_physical_memory_get_dirty(start, VGA_DIRTY_FLAG);
     miny = s->height;
-    maxy = 0;
+    rx0 = rx1 = ry = 0;
     for (y = 0; y < s->height; y ++) {
         new_addr = addr + src_width;
         for (x = addr + TARGET_PAGE_SIZE; x < new_addr;
@@ -429,27 +492,64 @@ static void s3c_update_display(void *opaque)
             dirty[1] = cpu_physical_memory_get_dirty(x, VGA_DIRTY_FLAG);
             dirty[0] |= dirty[1];
         }
-        if (dirty[0] || s->invalidate) {
-            s->fn(s->palette, dest, src, s->width, s->dest_width);
-            maxy = y;
+        x0 = x1 = 0;
+        if (dirty[0] || invalidate) {
             end = new_addr;
             if (y < miny) {
                 miny = y;
                 start = addr;
             }
+
+            start_b = 0;
+            end_b = src_width;
+            if (share) {
+                x0 = 0;
+                x1 = s->width;
+            } else if (invalidate || !bits ||
+                    s3c_lcd_row_diff(src, shadow, src_width, &start_b, &end_b)) {
+                if (!bits) {
+                    start_b = 0;
+                    end_b = src_width;
+                }
+                x0 = bits ? (start_b << 3) / bits : 0;
+                x1 = bits ? (end_b << 3) / bits : s->width;
+                s->fn(s->palette, dest + x0 * s->dest_width, src + start_b,
+                                x1 - x0, s->dest_width);
+                memcpy(shadow + start_b, src + start_b, end_b - start_b);
+            }
+        }
+
+        /* Merge the changed spans of consecutive rows into rectangles
+         * while they overlap, report each rectangle when it ends.  */
+        if (rx1 > rx0 && (x1 <= x0 || x0 > rx1 || x1 < rx0)) {
+            dpy_update(s->ds, rx0, ry, rx1 - rx0, y - ry);
+            rx0 = rx1 = 0;
+        }
+        if (x1 > x0) {
+            if (rx1 > rx0) {
+                rx0 = MIN(rx0, x0);
+                rx1 = MAX(rx1, x1);
+            } else {
+                rx0 = x0;
+                rx1 = x1;
+                ry = y;
+            }
         }
+
         addr = new_addr;
         dirty[0] = dirty[1];
         src += src_width;
         dest += dest_width;
+        shadow += src_width;
     }
+    if (rx1 > rx0)
+        dpy_update(s->ds, rx0, ry, rx1 - rx0, y - ry);
 
     s->invalidate = 0;
     if (end > start)
         cpu_physical_memory_reset_dirty(start, end, VGA_DIRTY_FLAG);
     s->srcpnd |= (1 << 1);			/* INT_FrSyn */
     s3c_lcd_update(s);
-    dpy_update(s->ds, 0, miny, s->width, maxy);
 }
 
 static void s3c_invalidate_display(void *opaque)
@@ -70,7 +70,7 @@ void s3c_mmci_reset(struct s3c_mmci_state_s *s)
 
 static void s3c_mmci_fifo_run(struct s3c_mmci_state_s *s)
 {
-    int len, dmalevel = 0;
+    int len, start, n, dmalevel = 0;
     if (!s->data)
         goto dmaupdate;
 
@@ -79,9 +79,11 @@ static void s3c_mmci_fifo_run(struct s3c_mmci_state_s *s)
         s->dstatus &= ~3;
         s->dstatus |= 1 << 0;					/* RxDatOn */
         while (s->fifolen < 64 && s->blklen_cnt) {
-            s->fifo[(s->fifostart + s->fifolen ++) & 63] =
-                    sd_read_data(s->card);
-            if (!(-- s->blklen_cnt))
+            start = (s->fifostart + s->fifolen) & 63;
+            n = MIN(MIN(64 - s->fifolen, 64 - start), s->blklen_cnt);
+            sd_read_block(s->card, s->fifo + start, n);
+            s->fifolen += n;
+            if (!(s->blklen_cnt -= n))
                 if (-- s->blknum_cnt)
                     s->blklen_cnt = s->blklen;
         }
@@ -98,10 +100,11 @@ static void s3c_mmci_fifo_run(struct s3c_mmci_state_s *s)
         s->dstatus &= ~3;
         s->dstatus |= 1 << 0;					/* TxDatOn */
         while (s->fifolen && s->blklen_cnt) {
-            sd_write_data(s->card, s->fifo[s->fifostart ++]);
-            s->fifostart &= 63;
-            s->fifolen --;
-            if (!(-- s->blklen_cnt))
+            n = MIN(MIN(s->fifolen, 64 - s->fifostart), s->blklen_cnt);
+            sd_write_block(s->card, s->fifo + s->fifostart, n);
+            s->fifostart = (s->fifostart + n) & 63;
+            s->fifolen -= n;
+            if (!(s->blklen_cnt -= n))
                 if (-- s->blknum_cnt)
                     s->blklen_cnt = s->blklen;
         }
@@ -446,6 +449,57 @@ static CPUWriteMemoryFunc *s3c_mmci_writefn[] = {
     s3c_mmci_writew,
 };
 
+/* Bulk access to SDIDAT for the DMA engine, same as a series of register
+ * accesses but the data is copied a FIFO-full at a time.  */
+static int s3c_mmci_dma_read(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_mmci_state_s *s = (struct s3c_mmci_state_s *) opaque;
+    int n, done = 0;
+
+    while (done < len && s->fifolen) {
+        n = MIN(MIN(len - done, s->fifolen), 64 - s->fifostart);
+        memcpy(buf + done, s->fifo + s->fifostart, n);
+        s->fifostart = (s->fifostart + n) & 63;
+        s->fifolen -= n;
+        done += n;
+        s3c_mmci_fifo_run(s);
+    }
+
+    return done;
+}
+
+static int s3c_mmci_dma_write(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_mmci_state_s *s = (struct s3c_mmci_state_s *) opaque;
+    int n, start, done = 0;
+
+    while (done < len && s->fifolen < 64) {
+        start = (s->fifostart + s->fifolen) & 63;
+        n = MIN(MIN(len - done, 64 - s->fifolen), 64 - start);
+        memcpy(s->fifo + start, buf + done, n);
+        s->fifolen += n;
+        done += n;
+        s3c_mmci_fifo_run(s);
+    }
+
+    return done;
+}
+
+void s3c_mmci_dma_attach(struct s3c_mmci_state_s *s,
+                struct s3c_dma_state_s *dma)
+{
+    target_phys_addr_t addr;
+
+    if (!s)
+        return;
+
+    for (addr = 0; addr <= S3C_SDIMAX; addr ++)
+        if (s->map[addr] == S3C_SDIDAT)
+            break;
+    s3c_dma_fifo_register(dma, s->base + addr,
+                    s3c_mmci_dma_read, s3c_mmci_dma_write, s);
+}
+
 static void s3c_mmci_cardirq(void *opaque, int line, int level)
 {
     struct s3c_mmci_state_s *s = (struct s3c_mmci_state_s *) opaque;
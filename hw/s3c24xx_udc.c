@@ -31,10 +31,17 @@ struct s3c_udc_state_s {
     } ep0;
 
 #define S3C_EPS 5
-    struct {
+    struct s3c_udc_ep_s {
+        struct s3c_udc_state_s *udc;
+        int num;
+
         int start, len;
         uint8_t fifo[S3C_USB_FIFO_LEN];
+        /* Points to FIFO, or to the data of out_packet while the guest
+         * reads it in place.  */
+        uint8_t *buf;
         USBPacket *packet;
+        USBPacket *out_packet;
         int packet_len;
 
         uint8_t in_csr[2];
@@ -57,6 +64,23 @@ struct s3c_udc_state_s {
     uint8_t address;
 };
 
+/* Give the host OUT packet, which the guest has finished reading,
+ * back to the gadget and switch back to the FIFO.  */
+static void s3c_udc_out_release(struct s3c_udc_state_s *s, int ep)
+{
+    USBPacket *packet = s->ep1[ep].out_packet;
+    if (s->ep1[ep].buf != s->ep1[ep].fifo) {
+        s->ep1[ep].buf = s->ep1[ep].fifo;
+        s->ep1[ep].start = 0;
+        s->ep1[ep].len = 0;
+    }
+
+    if (packet) {
+        s->ep1[ep].out_packet = 0;
+        packet->complete_cb(packet, packet->complete_opaque);
+    }
+}
+
 void s3c_udc_reset(struct s3c_udc_state_s *s)
 {
     int i;
@@ -84,6 +108,7 @@ void s3c_udc_reset(struct s3c_udc_state_s *s)
         s->ep1[i].fifo_cnt = 0x00;
         s->ep1[i].dma_size = 0;
         s->ep1[i].packet = 0;
+        s3c_udc_out_release(s, i);
     }
 }
 
@@ -113,19 +138,38 @@ static void s3c_udc_queue_packet(uint8_t *dst, uint8_t *src,
 }
 
 static void s3c_udc_dequeue_packet(uint8_t *dst, uint8_t *src,
-                int *fstart, int *flen)
+                int *fstart, int *flen, int len)
 {
     int chunk;
-    while (*flen) {
-        chunk = MIN(*flen, S3C_USB_FIFO_LEN - *fstart);
+    *flen -= len;
+    while (len) {
+        chunk = MIN(len, S3C_USB_FIFO_LEN - *fstart);
         memcpy(dst, src + *fstart, chunk);
-        *flen -= chunk;
+        len -= chunk;
         dst += chunk;
         *fstart += chunk;
         *fstart &= S3C_USB_FIFO_LEN - 1;
     }
 }
 
+/* In DMA mode keep the request asserted for as long as the endpoint
+ * can move data in the direction it is configured for.  */
+static void s3c_udc_dma_update(struct s3c_udc_state_s *s, int ep)
+{
+    int req = 0;
+    if ((s->ep1[ep].control & (1 << 0)) &&		/* DMA_MODE_EN */
+                    s->ep1[ep].dma_size) {
+        if (s->ep1[ep].in_csr[1] & (1 << 5))		/* MODE_IN */
+            req = (s->ep1[ep].control & (1 << 1)) &&	/* IN_DMA_RUN */
+                    !(s->ep1[ep].in_csr[0] & (1 << 0)) &&	/* IN_PKT_RDY */
+                    s->ep1[ep].len < S3C_USB_FIFO_LEN;
+        else
+            req = (s->ep1[ep].control & (1 << 2)) &&	/* OUT_DMA_RUN */
+                    s->ep1[ep].len > 0;
+    }
+    qemu_set_irq(s->dma[S3C_RQ_USB_EP1 + (ep << 4)], req);
+}
+
 static void s3c_udc_ep0_rdy(struct s3c_udc_state_s *s, uint8_t value)
 {
     USBPacket *packet = s->ep0.packet;
@@ -140,7 +184,7 @@ static void s3c_udc_ep0_rdy(struct s3c_udc_state_s *s, uint8_t value)
         if (value & (1 << 1)) {
             packet->len = s->ep0.len;
             s3c_udc_dequeue_packet(packet->data, s->ep0.fifo,
-                            &s->ep0.start, &s->ep0.len);
+                            &s->ep0.start, &s->ep0.len, s->ep0.len);
         } else
             packet->len = 0;
 
@@ -172,8 +216,8 @@ static void s3c_udc_ep1_rdy(struct s3c_udc_state_s *s, int ep, uint8_t value)
 
         /* TODO: check that packet->len >= s->ep1[ep].len */
         packet->len = s->ep1[ep].len;
-        s3c_udc_dequeue_packet(packet->data, s->ep1[ep].fifo,
-                        &s->ep1[ep].start, &s->ep1[ep].len);
+        s3c_udc_dequeue_packet(packet->data, s->ep1[ep].buf,
+                        &s->ep1[ep].start, &s->ep1[ep].len, s->ep1[ep].len);
 
         /* Signal completion of IN token */
         s->ep1[ep].packet = 0;
@@ -182,6 +226,60 @@ static void s3c_udc_ep1_rdy(struct s3c_udc_state_s *s, int ep, uint8_t value)
     }
 }
 
+/* DMA channel reading from an OUT endpoint FIFO.  */
+static int s3c_udc_dma_read(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_udc_ep_s *e = (struct s3c_udc_ep_s *) opaque;
+    struct s3c_udc_state_s *s = e->udc;
+    int ep = e->num;
+
+    if (e->in_csr[1] & (1 << 5))			/* MODE_IN */
+        return 0;
+    len = MIN(MIN(len, e->len), e->dma_size);
+    s3c_udc_dequeue_packet(buf, e->buf, &e->start, &e->len, len);
+    e->dma_size -= len;
+
+    if (!e->len) {
+        e->out_csr[0] &= ~(1 << 0);			/* OUT_PKT_RDY */
+        s3c_udc_out_release(s, ep);
+    }
+    s3c_udc_dma_update(s, ep);
+    return len;
+}
+
+/* DMA channel writing to an IN endpoint FIFO.  The whole transfer, up
+ * to a full FIFO, is sent to the host as one packet, without the
+ * short packet heuristics of the register interface.  */
+static int s3c_udc_dma_write(void *opaque, uint8_t *buf, int len)
+{
+    struct s3c_udc_ep_s *e = (struct s3c_udc_ep_s *) opaque;
+    struct s3c_udc_state_s *s = e->udc;
+    USBPacket *packet;
+    int ep = e->num;
+
+    if (!(e->in_csr[1] & (1 << 5)) ||			/* MODE_IN */
+                    (e->in_csr[0] & (1 << 0)))		/* IN_PKT_RDY */
+        return 0;
+    len = MIN(MIN(len, S3C_USB_FIFO_LEN - e->len), e->dma_size);
+    s3c_udc_queue_packet(e->buf, buf, e->start, &e->len, len);
+    e->dma_size -= len;
+
+    if (!e->dma_size || e->len >= S3C_USB_FIFO_LEN) {
+        e->in_csr[0] |= 1 << 0;				/* IN_PKT_RDY */
+        if (e->packet) {
+            packet = e->packet;
+            packet->len = e->len;
+            s3c_udc_dequeue_packet(packet->data, e->buf,
+                            &e->start, &e->len, e->len);
+            e->in_csr[0] &= ~(1 << 0);			/* IN_PKT_RDY */
+            e->packet = 0;
+            packet->complete_cb(packet, packet->complete_opaque);
+        }
+    }
+    s3c_udc_dma_update(s, ep);
+    return len;
+}
+
 #define S3C_FUNC_ADDR	0x140	/* Function address register */
 #define S3C_PWR		0x144	/* Power management register */
 #define S3C_EP_INT	0x148	/* Endpoint interrupt register */
@@ -280,13 +378,14 @@ static uint32_t s3c_udc_read(void *opaque, target_phys_addr_t addr)
         if (unlikely(!s->ep1[ep].len))
             printf("%s: Endpoint%i underrun\n", __FUNCTION__, ep + 1);
         else {
-            ret = s->ep1[ep].fifo[s->ep1[ep].start ++];
+            ret = s->ep1[ep].buf[s->ep1[ep].start ++];
             s->ep1[ep].len --;
         }
         s->ep1[ep].start &= S3C_USB_FIFO_LEN - 1;
         if (s->ep1[ep].out_csr[1] & (1 << 7))		/* AUTO_CLR */
             if (s->ep1[ep].len <= 0) {
                 s->ep1[ep].out_csr[0] &= ~(1 << 0);	/* OUT_PKT_READY */
+                s3c_udc_out_release(s, ep);
             }
         return ret;
     case S3C_MAXP:
@@ -412,15 +511,17 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
         if (s->index >= S3C_EPS || s->index == 0)
             goto bad_reg;
         s->ep1[s->index - 1].in_csr[1] = value & 0xf0;
+        s3c_udc_dma_update(s, s->index - 1);
         break;
 
     case S3C_OUT_CSR1:
         if (s->index >= S3C_EPS || s->index == 0)
             goto bad_reg;
         if (s->ep1[s->index - 1].out_csr[0] & (1 << 0)) {	/* OUT_PKT_R */
-            if (value & (1 << 4))		/* FIFO_FLUSH */
+            if (value & (1 << 4)) {		/* FIFO_FLUSH */
                 s->ep1[s->index - 1].len = 0;
-            else if (!(value & (1 << 0)) &&	/* OUT_PKT_RDY */
+                s3c_udc_out_release(s, s->index - 1);
+            } else if (!(value & (1 << 0)) &&	/* OUT_PKT_RDY */
                             s->ep1[s->index - 1].len) {
                 value |= 1 << 0;		/* OUT_PKT_RDY */
                 s3c_udc_interrupt(s, s->index);
@@ -428,6 +529,9 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
         }
         s->ep1[s->index - 1].out_csr[0] = value &
                 (0xa0 | (s->ep1[s->index - 1].out_csr[0] & 0x41));
+        if (!(s->ep1[s->index - 1].out_csr[0] & (1 << 0)) &&	/* OUT_PKT_R */
+                        !s->ep1[s->index - 1].len)
+            s3c_udc_out_release(s, s->index - 1);
         break;
 
     case S3C_OUT_CSR2:
@@ -451,7 +555,7 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
             goto bad_reg;
         if (unlikely(s->ep1[ep].len >= S3C_USB_FIFO_LEN))
             printf("%s: Endpoint%i overrun\n", __FUNCTION__, ep + 1);
-        s->ep1[ep].fifo[(s->ep1[ep].start + s->ep1[ep].len ++) &
+        s->ep1[ep].buf[(s->ep1[ep].start + s->ep1[ep].len ++) &
                 (S3C_USB_FIFO_LEN - 1)] = value;
         if (s->ep1[ep].in_csr[1] & (1 << 7))		/* AUTO_SET */
             if (s->ep1[ep].len >= (s->ep1[ep].maxpacket << 3)) {
@@ -473,6 +577,7 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
         if (!ep --)
             goto bad_reg;
         s->ep1[ep].control = value;
+        s3c_udc_dma_update(s, ep);
         break;
 
     case S3C_EP_DMA_UNIT:
@@ -492,6 +597,7 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
             goto bad_reg;
         s->ep1[ep].dma_size &= 0xfff00;
         s->ep1[ep].dma_size |= (value & 0xff) << 0;
+        s3c_udc_dma_update(s, ep);
         break;
 
     case S3C_EP_DMA_TTC_M:
@@ -499,6 +605,7 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
             goto bad_reg;
         s->ep1[ep].dma_size &= 0xf00ff;
         s->ep1[ep].dma_size |= (value & 0xff) << 8;
+        s3c_udc_dma_update(s, ep);
         break;
 
     case S3C_EP_DMA_TTC_H:
@@ -506,6 +613,7 @@ static void s3c_udc_write(void *opaque, target_phys_addr_t addr,
             goto bad_reg;
         s->ep1[ep].dma_size &= 0x0ffff;
         s->ep1[ep].dma_size |= (value & 0xf) << 16;
+        s3c_udc_dma_update(s, ep);
         break;
 
     bad_reg:
@@ -649,13 +757,23 @@ static int s3c_udc_handle_packet(USBDevice *dev, USBPacket *p)
                 s3c_udc_interrupt(s, 0);
                 break;
             }
+            if ((s->ep1[ep].control & (1 << 0)) &&	/* DMA_MODE_EN */
+                    (s->ep1[ep].in_csr[0] & (1 << 0))) {/* IN_PKT_RDY */
+                /* A DMA transfer is already waiting in the FIFO */
+                ret = s->ep1[ep].len;
+                s3c_udc_dequeue_packet(p->data, s->ep1[ep].buf,
+                                &s->ep1[ep].start, &s->ep1[ep].len, ret);
+                s->ep1[ep].in_csr[0] &= ~(1 << 0);	/* IN_PKT_RDY */
+                s3c_udc_dma_update(s, ep);
+                s->frame ++;
+                break;
+            }
             if (!(s->ep1[ep].in_csr[1] & (1 << 4)) ||	/* IN_DMA_INT_MASK */
                     !(s->ep1[ep].control & (1 << 0))) {	/* DMA_MODE_EN */
                 s->ep1[ep].in_csr[0] &= ~(1 << 0);	/* IN_PKT_RDY */
                 s->ep1[ep].in_csr[0] &= ~(1 << 3);	/* FIFO_FLUSH */
                 s3c_udc_interrupt(s, p->devep);
             }
-            /* TODO: DMA */
             s->ep1[ep].packet = p;
         }
         s->frame ++;
@@ -691,21 +809,39 @@ static int s3c_udc_handle_packet(USBDevice *dev, USBPacket *p)
                 s3c_udc_interrupt(s, 0);
                 break;
             }
-            s3c_udc_queue_packet(s->ep1[ep].fifo, p->data,
-                            s->ep1[ep].start,
-                            &s->ep1[ep].len, p->len);
+            if (unlikely(s->ep1[ep].out_packet)) {
+                ret = USB_RET_NAK;
+                break;
+            }
+            if (!s->ep1[ep].len && p->len &&
+                            p->len <= S3C_USB_FIFO_LEN) {
+                /* Let the guest read the packet in place */
+                s->ep1[ep].buf = p->data;
+                s->ep1[ep].start = 0;
+                s->ep1[ep].len = p->len;
+            } else
+                s3c_udc_queue_packet(s->ep1[ep].fifo, p->data,
+                                s->ep1[ep].start,
+                                &s->ep1[ep].len, p->len);
             if (!(s->ep1[ep].out_csr[1] & (1 << 5)) ||	/* OUT_DMA_INT_MASK */
                     !(s->ep1[ep].control & (1 << 0))) {	/* DMA_MODE_EN */
                 s->ep1[ep].out_csr[0] |= 1 << 0;	/* OUT_PKT_RDY */
                 s3c_udc_interrupt(s, p->devep);
             }
-            /* TODO: DMA */
+            s3c_udc_dma_update(s, ep);
+
+            /* Hold the host back until the guest is done with the data,
+             * unless DMA has already consumed it.  */
+            if (s->ep1[ep].buf == p->data) {
+                s->ep1[ep].out_packet = p;
+                ret = USB_RET_ASYNC;
+            }
         }
-        /* Perhaps it is a good idea to return USB_RET_ASYNC here and in
-         * USB_TOKEN_SETUP and trigger completion only after OUT_PKT_RDY
-         * condition is serviced by the guest to avoid potential overruns
-         * and so that the host can know about timeouts (seems there's no
-         * way to indicate other errors asynchronously).  */
+        /* Perhaps it is a good idea to return USB_RET_ASYNC also in
+         * USB_TOKEN_SETUP and for EP0 and trigger completion only after
+         * OUT_PKT_RDY condition is serviced by the guest to avoid potential
+         * overruns and so that the host can know about timeouts (seems
+         * there's no way to indicate other errors asynchronously).  */
         break;
     default:
     fail:
@@ -729,13 +865,15 @@ static void s3c_udc_handle_destroy(USBDevice *dev)
         s->ep1[i].out_csr[0] = 0;
         s->ep1[i].out_csr[1] = 0;
         s->ep1[i].packet = 0;
+        s->ep1[i].out_packet = 0;
+        s->ep1[i].buf = s->ep1[i].fifo;
     }
 }
 
 struct s3c_udc_state_s *s3c_udc_init(target_phys_addr_t base,
                 qemu_irq irq, qemu_irq *dma)
 {
-    int iomemtype;
+    int i, iomemtype;
     struct s3c_udc_state_s *s = (struct s3c_udc_state_s *)
             qemu_mallocz(sizeof(struct s3c_udc_state_s));
 
@@ -748,6 +886,12 @@ struct s3c_udc_state_s *s3c_udc_init(target_phys_addr_t base,
     s->dev.handle_destroy = s3c_udc_handle_destroy;
     s->dev.opaque = s;
 
+    for (i = 0; i < S3C_EPS - 1; i ++) {
+        s->ep1[i].udc = s;
+        s->ep1[i].num = i;
+        s->ep1[i].buf = s->ep1[i].fifo;
+    }
+
     s3c_udc_reset(s);
 
     iomemtype = cpu_register_io_memory(0, s3c_udc_readfn,
@@ -760,3 +904,12 @@ struct s3c_udc_state_s *s3c_udc_init(target_phys_addr_t base,
 
     return s;
 }
+
+void s3c_udc_dma_attach(struct s3c_udc_state_s *s,
+                struct s3c_dma_state_s *dma)
+{
+    int i;
+    for (i = 0; i < S3C_EPS - 1; i ++)
+        s3c_dma_fifo_register(dma, s->base + S3C_EP1_FIFO + (i << 2),
+                        s3c_udc_dma_read, s3c_udc_dma_write, &s->ep1[i]);
+}
@@ -44,6 +44,22 @@ do { printf("SD: " fmt , ##args); } while (0)
 
 typedef struct SDState SDState;
 
+#define SD_XFER_SECTORS	64	/* Size of an asynchronous block request */
+
+/* A run of consecutive sectors moved with one asynchronous request.
+   CMD18 reads are prefetched into a pair of these while the host drains
+   the card, CMD25 writes are collected into another pair and written
+   out while the host sends the following blocks.  */
+struct sd_xfer_s {
+    SDState *sd;
+    uint8_t *buf;
+    int64_t sector;
+    int count;		/* Sectors held, 0 if empty */
+    int busy;		/* Request in flight */
+    int discard;	/* Contents stale by the time the request completes */
+    int write;
+};
+
 typedef enum {
     sd_r0 = 0,    /* no response */
     sd_r1,        /* normal response command */
@@ -87,6 +103,9 @@ struct SDState {
     uint32_t data_offset;
     uint8_t data[512];
     uint8_t *buf;
+    struct sd_xfer_s rd[2];
+    struct sd_xfer_s wr[2];
+    int wr_cur;		/* Write window being filled */
     qemu_irq readonly_cb;
     qemu_irq inserted_cb;
     BlockDriverState *bdrv;
@@ -316,6 +335,123 @@ static void sd_response_r7_make(SDState *sd, uint8_t *response)
     response[3] = (sd->vhs >>  0) & 0xff;
 }
 
+static int sd_xfer_busy(SDState *sd)
+{
+    return sd->wr[0].busy || sd->wr[1].busy;
+}
+
+static void sd_xfer_cb(void *opaque, int ret)
+{
+    struct sd_xfer_s *x = (struct sd_xfer_s *) opaque;
+    SDState *sd = x->sd;
+
+    x->busy = 0;
+    if (ret < 0) {
+        printf("sd_xfer_cb: %s error on host side\n",
+                        x->write ? "write" : "read");
+        /* A failed prefetch is retried synchronously if the data is
+           actually requested, a lost write has to be reported now.  */
+        if (x->write)
+            sd->card_status |= CC_ERROR;
+    }
+    if (ret < 0 || x->discard || x->write)
+        x->count = 0;
+
+    /* The card stays busy until all of CMD25's data is on the medium */
+    if (x->write && !sd_xfer_busy(sd) && sd->state == sd_programming_state)
+        sd->state = sd_transfer_state;
+}
+
+static void sd_xfer_start(SDState *sd, struct sd_xfer_s *x)
+{
+    BlockDriverAIOCB *acb;
+
+    x->busy = 1;
+    x->discard = 0;
+    if (x->write)
+        acb = bdrv_aio_write(sd->bdrv, x->sector, x->buf, x->count,
+                        sd_xfer_cb, x);
+    else
+        acb = bdrv_aio_read(sd->bdrv, x->sector, x->buf, x->count,
+                        sd_xfer_cb, x);
+    if (!acb)
+        sd_xfer_cb(x, -1);
+}
+
+static void sd_xfer_wait(struct sd_xfer_s *x)
+{
+    if (!x->busy)
+        return;
+
+    qemu_aio_wait_start();
+    /* The completion signal may have been delivered already */
+    qemu_aio_poll();
+    while (x->busy)
+        qemu_aio_wait();
+    qemu_aio_wait_end();
+}
+
+static void sd_prefetch(SDState *sd, struct sd_xfer_s *x, int64_t sector)
+{
+    uint64_t nb_sectors;
+
+    if (x->busy)
+        return;
+
+    bdrv_get_geometry(sd->bdrv, &nb_sectors);
+    x->sector = sector;
+    x->count = MIN(SD_XFER_SECTORS, (int64_t) nb_sectors - sector);
+    if (x->count <= 0) {
+        x->count = 0;
+        return;
+    }
+    sd_xfer_start(sd, x);
+}
+
+/* Drop any prefetched data, called before the medium is modified */
+static void sd_prefetch_drop(SDState *sd)
+{
+    int i;
+
+    for (i = 0; i < 2; i ++) {
+        sd->rd[i].discard = 1;
+        if (!sd->rd[i].busy)
+            sd->rd[i].count = 0;
+    }
+}
+
+/* Send out the collected CMD25 data.  */
+static void sd_write_issue(SDState *sd)
+{
+    struct sd_xfer_s *x = &sd->wr[sd->wr_cur];
+
+    if (!x->count || x->busy)
+        return;
+
+    sd_xfer_start(sd, x);
+    sd->wr_cur ^= 1;
+}
+
+/* Wait for the writes in flight, the card is busy until they complete */
+static void sd_write_flush(SDState *sd)
+{
+    sd_write_issue(sd);
+    sd_xfer_wait(&sd->wr[0]);
+    sd_xfer_wait(&sd->wr[1]);
+}
+
+/* Forget the CMD25 data not sent yet, called when the medium it was
+   meant for is gone.  Only the requests already in flight complete.  */
+static void sd_write_drop(SDState *sd)
+{
+    int i;
+
+    for (i = 0; i < 2; i ++) {
+        sd_xfer_wait(&sd->wr[i]);
+        sd->wr[i].count = 0;
+    }
+}
+
 static void sd_reset(SDState *sd, BlockDriverState *bdrv)
 {
     uint32_t size;
@@ -331,6 +467,11 @@ static void sd_reset(SDState *sd, BlockDriverState *bdrv)
 
     sect = (size >> (HWBLOCK_SHIFT + SECTOR_SHIFT + WPGROUP_SHIFT)) + 1;
 
+    /* A plain reset comes through sd_do_command(), which has already
+       written the pending data out, a medium change must not.  */
+    sd_write_drop(sd);
+    sd_prefetch_drop(sd);
+
     sd->state = sd_idle_state;
     sd->rca = 0x0000;
     sd_set_ocr(sd);
@@ -357,6 +498,8 @@ static void sd_reset(SDState *sd, BlockDriverState *bdrv)
 static void sd_cardchange(void *opaque)
 {
     SDState *sd = opaque;
+    sd_write_drop(sd);
+    sd_prefetch_drop(sd);
     qemu_set_irq(sd->inserted_cb, bdrv_is_inserted(sd->bdrv));
     if (bdrv_is_inserted(sd->bdrv)) {
         sd_reset(sd, sd->bdrv);
@@ -716,8 +859,11 @@ static sd_rsp_type_t sd_normal_command(SDState *sd, struct sd_request_s req)
 
         case sd_receivingdata_state:
             sd->state = sd_programming_state;
-            /* Bzzzzzzztt .... Operation complete.  */
-            sd->state = sd_transfer_state;
+            sd_write_issue(sd);
+            /* Bzzzzzzztt .... Operation complete, unless there are
+             * writes in flight, which will complete it.  */
+            if (!sd_xfer_busy(sd))
+                sd->state = sd_transfer_state;
             return sd_r1b;
 
         default:
@@ -1168,6 +1314,11 @@ static int _sd_do_command(SDState *sd, struct sd_request_s *req,
         return 0;
     }
 
+    /* Only let the host stop the transfer and poll the status while the
+     * card is busy, other commands have to wait for the writes.  */
+    if ((req->cmd != 12 && req->cmd != 13) || (last_status & APP_CMD))
+        sd_write_flush(sd);
+
     sd->card_status &= ~CARD_STATUS_B;
     sd_set_status(sd);
 
@@ -1191,6 +1342,10 @@ static int _sd_do_command(SDState *sd, struct sd_request_s *req,
 
     sd->current_cmd = req->cmd;
 
+    /* Prefetched blocks go stale as soon as the host starts writing */
+    if (sd->state == sd_receivingdata_state)
+        sd_prefetch_drop(sd);
+
     switch (rtype) {
     case sd_r1:
     case sd_r1b:
@@ -1254,6 +1409,7 @@ static void sd_blk_read(SDState *sd, uint32_t addr, uint32_t len)
 
     if (!sd->bdrv || bdrv_read(sd->bdrv, addr >> 9, sd->buf, 1) == -1) {
         printf("sd_blk_read: read error on host side\n");
+        sd->card_status |= CARD_ECC_FAILED;
         return;
     }
 
@@ -1262,6 +1418,7 @@ static void sd_blk_read(SDState *sd, uint32_t addr, uint32_t len)
 
         if (bdrv_read(sd->bdrv, end >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_read: read error on host side\n");
+            sd->card_status |= CARD_ECC_FAILED;
             return;
         }
         memcpy(sd->data + 512 - (addr & 511), sd->buf, end & 511);
@@ -1276,6 +1433,7 @@ static void sd_blk_write(SDState *sd, uint32_t addr, uint32_t len)
     if ((addr & 511) || len < 512)
         if (!sd->bdrv || bdrv_read(sd->bdrv, addr >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_write: read error on host side\n");
+            sd->card_status |= CC_ERROR;
             return;
         }
 
@@ -1283,24 +1441,96 @@ static void sd_blk_write(SDState *sd, uint32_t addr, uint32_t len)
         memcpy(sd->buf + (addr & 511), sd->data, 512 - (addr & 511));
         if (bdrv_write(sd->bdrv, addr >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_write: write error on host side\n");
+            sd->card_status |= CC_ERROR;
             return;
         }
 
         if (bdrv_read(sd->bdrv, end >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_write: read error on host side\n");
+            sd->card_status |= CC_ERROR;
             return;
         }
         memcpy(sd->buf, sd->data + 512 - (addr & 511), end & 511);
-        if (bdrv_write(sd->bdrv, end >> 9, sd->buf, 1) == -1)
+        if (bdrv_write(sd->bdrv, end >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_write: write error on host side\n");
+            sd->card_status |= CC_ERROR;
+        }
     } else {
         memcpy(sd->buf + (addr & 511), sd->data, len);
-        if (!sd->bdrv || bdrv_write(sd->bdrv, addr >> 9, sd->buf, 1) == -1)
+        if (!sd->bdrv || bdrv_write(sd->bdrv, addr >> 9, sd->buf, 1) == -1) {
             printf("sd_blk_write: write error on host side\n");
+            sd->card_status |= CC_ERROR;
+        }
+    }
+}
+
+/* Serve a block of a multiple block read from the prefetch windows, and
+   keep the window following the one hit filled.  */
+static void sd_blk_read_multi(SDState *sd, uint32_t addr, uint32_t len)
+{
+    int64_t first = addr >> 9;
+    int64_t last = (addr + len - 1) >> 9;
+    struct sd_xfer_s *x;
+    int i;
+
+    if (!sd->bdrv) {
+        sd_blk_read(sd, addr, len);
+        return;
+    }
+
+    for (i = 0; i < 2; i ++) {
+        x = &sd->rd[i];
+        if (x->count && !x->discard &&
+                        first >= x->sector && last < x->sector + x->count)
+            break;
     }
+    if (i == 2) {
+        i = 0;
+        x = &sd->rd[0];
+        sd_xfer_wait(x);
+        sd_prefetch(sd, x, first);
+    }
+
+    sd_xfer_wait(x);
+    if (!x->count || last >= x->sector + x->count) {
+        sd_blk_read(sd, addr, len);
+        return;
+    }
+    memcpy(sd->data, x->buf + ((addr - (x->sector << 9))), len);
+
+    x = &sd->rd[i ^ 1];
+    if (!x->busy && (!x->count || x->sector != sd->rd[i].sector +
+                            sd->rd[i].count))
+        sd_prefetch(sd, x, sd->rd[i].sector + sd->rd[i].count);
+}
+
+/* Collect sector aligned blocks of a multiple block write, fall back
+   to a synchronous write otherwise.  */
+static void sd_blk_write_multi(SDState *sd, uint32_t addr, uint32_t len)
+{
+    struct sd_xfer_s *x = &sd->wr[sd->wr_cur];
+
+    if ((addr & 511) || len != 512 || !sd->bdrv) {
+        sd_write_flush(sd);
+        sd_blk_write(sd, addr, len);
+        return;
+    }
+
+    if (x->count && (addr >> 9) != x->sector + x->count)
+        sd_write_issue(sd);
+    x = &sd->wr[sd->wr_cur];
+    sd_xfer_wait(x);
+
+    if (!x->count)
+        x->sector = addr >> 9;
+    memcpy(x->buf + (x->count << 9), sd->data, 512);
+    if (++ x->count >= SD_XFER_SECTORS)
+        sd_write_issue(sd);
 }
 
 #define BLK_READ_BLOCK(a, len)	sd_blk_read(sd, a, len)
+#define BLK_READ_MULTI(a, len)	sd_blk_read_multi(sd, a, len)
+#define BLK_WRITE_MULTI(a, len)	sd_blk_write_multi(sd, a, len)
 #define BLK_WRITE_BLOCK(a, len)	sd_blk_write(sd, a, len)
 #define APP_READ_BLOCK(a, len)	memset(sd->data, 0xec, len)
 #define APP_WRITE_BLOCK(a, len)
@@ -1339,7 +1569,7 @@ static void _sd_write_data(SDState *sd, uint8_t value)
         if (sd->data_offset >= sd->blk_len) {
             /* TODO: Check CRC before committing */
             sd->state = sd_programming_state;
-            BLK_WRITE_BLOCK(sd->data_start, sd->data_offset);
+            BLK_WRITE_MULTI(sd->data_start, sd->data_offset);
             sd->blk_written ++;
             sd->data_start += sd->blk_len;
             sd->data_offset = 0;
@@ -1460,7 +1690,7 @@ static uint8_t _sd_read_data(SDState *sd)
 
     case 11:	/* CMD11:  READ_DAT_UNTIL_STOP */
         if (sd->data_offset == 0)
-            BLK_READ_BLOCK(sd->data_start, sd->blk_len);
+            BLK_READ_MULTI(sd->data_start, sd->blk_len);
         ret = sd->data[sd->data_offset ++];
 
         if (sd->data_offset >= sd->blk_len) {
@@ -1491,7 +1721,7 @@ static uint8_t _sd_read_data(SDState *sd)
 
     case 18:	/* CMD18:  READ_MULTIPLE_BLOCK */
         if (sd->data_offset == 0)
-            BLK_READ_BLOCK(sd->data_start, sd->blk_len);
+            BLK_READ_MULTI(sd->data_start, sd->blk_len);
         ret = sd->data[sd->data_offset ++];
 
         if (sd->data_offset >= sd->blk_len) {
@@ -1542,6 +1772,69 @@ static uint8_t _sd_read_data(SDState *sd)
     return ret;
 }
 
+/* Block transfers are copied straight out of and into sd->data, only the
+   bytes that start or finish a block go through _sd_read_data() and
+   _sd_write_data() which do the actual media access and state changes.  */
+static inline int sd_blk_xfer(SDState *sd, enum sd_state_e state)
+{
+    if (!sd->bdrv || !bdrv_is_inserted(sd->bdrv) || sd->state != state ||
+                    (sd->card_status & (ADDRESS_ERROR | WP_VIOLATION)))
+        return 0;
+
+    switch (sd->current_cmd) {
+    case 11:	/* CMD11:  READ_DAT_UNTIL_STOP */
+    case 17:	/* CMD17:  READ_SINGLE_BLOCK */
+    case 18:	/* CMD18:  READ_MULTIPLE_BLOCK */
+        return state == sd_sendingdata_state;
+    case 24:	/* CMD24:  WRITE_SINGLE_BLOCK */
+    case 25:	/* CMD25:  WRITE_MULTIPLE_BLOCK */
+        return state == sd_receivingdata_state;
+    }
+    return 0;
+}
+
+static void _sd_read_block(SDState *sd, uint8_t *buf, int len)
+{
+    int n;
+
+    while (len) {
+        n = 0;
+        if (sd->data_offset && sd_blk_xfer(sd, sd_sendingdata_state))
+            n = MIN(len, sd->blk_len - sd->data_offset - 1);
+
+        if (n > 0) {
+            memcpy(buf, sd->data + sd->data_offset, n);
+            sd->data_offset += n;
+        } else {
+            *buf = _sd_read_data(sd);
+            n = 1;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void _sd_write_block(SDState *sd, const uint8_t *buf, int len)
+{
+    int n;
+
+    while (len) {
+        n = 0;
+        if (sd_blk_xfer(sd, sd_receivingdata_state))
+            n = MIN(len, sd->blk_len - sd->data_offset - 1);
+
+        if (n > 0) {
+            memcpy(sd->data + sd->data_offset, buf, n);
+            sd->data_offset += n;
+        } else {
+            _sd_write_data(sd, *buf);
+            n = 1;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
 static int _sd_data_ready(SDState *sd)
 {
     return sd->state == sd_sendingdata_state;
@@ -1554,9 +1847,17 @@ static int _sd_data_ready(SDState *sd)
 struct sd_card_s *sd_init(BlockDriverState *bs, int is_spi)
 {
     SDState *sd;
+    int i;
 
     sd = (SDState *) qemu_mallocz(sizeof(SDState));
     sd->buf = qemu_memalign(512, 512);
+    for (i = 0; i < 2; i ++) {
+        sd->rd[i].sd = sd;
+        sd->rd[i].buf = qemu_memalign(512, SD_XFER_SECTORS << 9);
+        sd->wr[i].sd = sd;
+        sd->wr[i].buf = qemu_memalign(512, SD_XFER_SECTORS << 9);
+        sd->wr[i].write = 1;
+    }
     sd->spi = is_spi;
     sd_reset(sd, bs);
     bdrv_set_change_cb(sd->bdrv, sd_cardchange, sd);
@@ -1565,6 +1866,8 @@ struct sd_card_s *sd_init(BlockDriverState *bs, int is_spi)
     sd->card.do_command = (void *) _sd_do_command;
     sd->card.write_data = (void *) _sd_write_data;
     sd->card.read_data  = (void *) _sd_read_data;
+    sd->card.read_block = (void *) _sd_read_block;
+    sd->card.write_block = (void *) _sd_write_block;
     sd->card.data_ready = (void *) _sd_data_ready;
     return &sd->card;
 }
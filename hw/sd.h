@@ -110,6 +110,9 @@ typedef struct sd_card_s {
     void (*write_data)(void *opaque, uint8_t value);
     uint8_t (*read_data)(void *opaque);
     int (*data_ready)(void *opaque);
+    /* Optional, move a run of bytes of the current data transfer */
+    void (*read_block)(void *opaque, uint8_t *buf, int len);
+    void (*write_block)(void *opaque, const uint8_t *buf, int len);
     qemu_irq irq;
 } sd_card;
 
@@ -129,6 +132,25 @@ static inline uint8_t sd_read_data(struct sd_card_s *sd)
     return sd->read_data(sd->opaque);
 }
 
+static inline void sd_read_block(struct sd_card_s *sd, uint8_t *buf, int len)
+{
+    if (sd->read_block)
+        sd->read_block(sd->opaque, buf, len);
+    else
+        while (len --)
+            *buf ++ = sd->read_data(sd->opaque);
+}
+
+static inline void sd_write_block(struct sd_card_s *sd,
+                const uint8_t *buf, int len)
+{
+    if (sd->write_block)
+        sd->write_block(sd->opaque, buf, len);
+    else
+        while (len --)
+            sd->write_data(sd->opaque, *buf ++);
+}
+
 static inline int sd_data_ready(struct sd_card_s *sd)
 {
     return sd->data_ready(sd->opaque);
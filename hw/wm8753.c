@@ -891,6 +891,35 @@ void wm8753_dac_dat(void *opaque, uint32_t sample)
         wm8753_out_flush(s);
 }
 
+/* Let the digital audio interface write a block of samples straight
+ * into the output buffer, and push it out with wm8753_dac_commit().
+ * *samples is lowered to the number of samples that fit.  */
+uint8_t *wm8753_dac_buffer(void *opaque, int *samples)
+{
+    struct wm8753_s *s = (struct wm8753_s *) opaque;
+    uint8_t *ret;
+
+    if (s->idx_out + (*samples << 2) > sizeof(s->data_out))
+        wm8753_out_flush(s);
+    *samples = MIN(*samples, (int) (sizeof(s->data_out) - s->idx_out) >> 2);
+    ret = s->data_out + s->idx_out;
+    s->idx_out += *samples << 2;
+    s->req_out -= *samples << 2;
+    return ret;
+}
+
+void wm8753_dac_commit(void *opaque)
+{
+    struct wm8753_s *s = (struct wm8753_s *) opaque;
+    uint32_t *data = (uint32_t *) s->data_out;
+    int i;
+
+    if (s->outmask != 0xffffffff)
+        for (i = 0; i < s->idx_out >> 2; i ++)
+            data[i] &= s->outmask;
+    wm8753_out_flush(s);
+}
+
 uint32_t wm8753_adc_dat(void *opaque)
 {
     struct wm8753_s *s = (struct wm8753_s *) opaque;
@@ -1306,6 +1306,8 @@ static term_cmd_t term_cmds[] = {
       "tag|id", "restore a VM snapshot from its tag or id" },
     { "delvm", "s", do_delvm,
       "tag|id", "delete a VM snapshot from its tag or id" },
+    { "migrate", "FF?", do_migrate,
+      "filename [ramfile]", "save the VM state to 'filename' while the VM runs, then stop it" },
     { "stop", "", do_stop,
       "", "stop emulation", },
     { "c|cont", "", do_cont,
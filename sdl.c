@@ -49,10 +49,13 @@ static int absolute_enabled = 0;
 static int guest_cursor = 0;
 static int guest_x, guest_y;
 static SDL_Cursor *guest_sprite = 0;
+static int gui_iconified;
 
 static void sdl_update(DisplayState *ds, int x, int y, int w, int h)
 {
     //    printf("updating x=%d y=%d w=%d h=%d\n", x, y, w, h);
+    if (gui_iconified)
+        return;
     SDL_UpdateRect(screen, x, y, w, h);
 }
 
@@ -506,6 +509,13 @@ static void sdl_refresh(DisplayState *ds)
                 !ev->active.gain && !gui_fullscreen_initial_grab) {
                 sdl_grab_end();
             }
+            /* No need to blit while the window is iconified, the
+               emulated display is still refreshed as usual */
+            if (ev->active.state & SDL_APPACTIVE) {
+                gui_iconified = !ev->active.gain;
+                if (!gui_iconified)
+                    sdl_update(ds, 0, 0, screen->w, screen->h);
+            }
             break;
         default:
             break;
@@ -291,7 +291,7 @@ if_start(void)
 	}
 
 	/* Encapsulate the packet for sending */
-        if_encap(ifm->m_data, ifm->m_len);
+        if_encap(ifm);
 
         m_free(ifm);
 
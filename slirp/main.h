@@ -50,4 +50,4 @@ extern uint8_t client_ethaddr[6];
 #define PROTO_PPP 0x2
 #endif
 
-void if_encap(const uint8_t *ip_data, int ip_data_len);
+void if_encap(struct mbuf *ifm);
@@ -21,8 +21,9 @@ struct	mbuf *mbutl;
 char	*mclrefcnt;
 int mbuf_alloced = 0;
 struct mbuf m_freelist, m_usedlist;
-#define MBUF_THRESH 30
+#define MBUF_THRESH 64
 int mbuf_max = 0;
+int mbuf_free = 0;
 
 /*
  * Find a nice value for msize
@@ -41,15 +42,15 @@ m_init()
  * Get an mbuf from the free list, if there are none
  * malloc one
  *
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * m_free puts mbufs back on the free list as long as it holds fewer
+ * than MBUF_THRESH of them, so that the mbufs in flight during a bulk
+ * transfer are recycled rather than malloc()ed and free()d for every
+ * packet, while the memory taken by a burst is still given back
  */
 struct mbuf *
 m_get()
 {
 	register struct mbuf *m;
-	int flags = 0;
 
 	DEBUG_CALL("m_get");
 
@@ -57,18 +58,17 @@ m_get()
 		m = (struct mbuf *)malloc(MSIZE);
 		if (m == NULL) goto end_error;
 		mbuf_alloced++;
-		if (mbuf_alloced > MBUF_THRESH)
-			flags = M_DOFREE;
 		if (mbuf_alloced > mbuf_max)
 			mbuf_max = mbuf_alloced;
 	} else {
 		m = m_freelist.m_next;
 		remque(m);
+		mbuf_free--;
 	}
 
 	/* Insert it in the used list */
 	insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	m->m_flags = M_USEDLIST;
 
 	/* Initialise it */
 	m->m_size = MSIZE - sizeof(struct m_hdr);
@@ -101,12 +101,15 @@ m_free(m)
 	/*
 	 * Either free() it or put it on the free list
 	 */
-	if (m->m_flags & M_DOFREE) {
+	if (m->m_flags & M_FREELIST) {
+		/* already there */
+	} else if ((m->m_flags & M_DOFREE) || mbuf_free >= MBUF_THRESH) {
 		free(m);
 		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
+	} else {
 		insque(m,&m_freelist);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
+		mbuf_free++;
 	}
   } /* if(m) */
 }
@@ -67,6 +67,28 @@ sbreserve(sb, size)
 	}
 }
 
+/*
+ * Enlarge sb to size bytes, unlike sbreserve() keeping what it holds
+ */
+void
+sbgrow(sb, size)
+	struct sbuf *sb;
+	int size;
+{
+	char *data;
+
+	if (size <= sb->sb_datalen)
+		return;
+	data = (char *)malloc(size);
+	if (!data)
+		return;
+	sbcopy(sb, 0, sb->sb_cc, data);
+	free(sb->sb_data);
+	sb->sb_data = sb->sb_rptr = data;
+	sb->sb_wptr = data + sb->sb_cc;
+	sb->sb_datalen = size;
+}
+
 /*
  * Try and write() to the socket, whatever doesn't get written
  * append to the buffer... for a host with a fast net connection,
@@ -205,6 +205,7 @@ void slirp_select_fill(int *pnfds,
     struct timeval timeout;
     int nfds;
     int tmp_time;
+    int i;
 
     /* fail safe */
     global_readfds = NULL;
@@ -212,6 +213,12 @@ void slirp_select_fill(int *pnfds,
     global_xfds = NULL;
 
     nfds = *pnfds;
+
+    for (i = 0; i < so_npolled; i++)
+        if (so_polled[i])
+            so_polled[i]->so_poll = 0;
+    so_npolled = so_npolled_tcp = 0;
+
 	/*
 	 * First, TCP sockets
 	 */
@@ -244,8 +251,10 @@ void slirp_select_fill(int *pnfds,
 			 * Set for reading sockets which are accepting
 			 */
 			if (so->so_state & SS_FACCEPTCONN) {
-                                FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
+				if (soselect(so)) {
+					FD_SET(so->s, readfds);
+					UPD_NFDS(so->s);
+				}
 				continue;
 			}
 
@@ -253,8 +262,10 @@ void slirp_select_fill(int *pnfds,
 			 * Set for writing sockets which are connecting
 			 */
 			if (so->so_state & SS_ISFCONNECTING) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
+				if (soselect(so)) {
+					FD_SET(so->s, writefds);
+					UPD_NFDS(so->s);
+				}
 				continue;
 			}
 
@@ -262,7 +273,7 @@ void slirp_select_fill(int *pnfds,
 			 * Set for writing if we are connected, can send more, and
 			 * we have something to send
 			 */
-			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
+			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc && soselect(so)) {
 				FD_SET(so->s, writefds);
 				UPD_NFDS(so->s);
 			}
@@ -271,12 +282,14 @@ void slirp_select_fill(int *pnfds,
 			 * Set for reading (and urgent data) if we are connected, can
 			 * receive more, and we have room for it XXX /2 ?
 			 */
-			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
+			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2)) &&
+			    soselect(so)) {
 				FD_SET(so->s, readfds);
 				FD_SET(so->s, xfds);
 				UPD_NFDS(so->s);
 			}
 		}
+		so_npolled_tcp = so_npolled;
 
 		/*
 		 * UDP sockets
@@ -305,7 +318,8 @@ void slirp_select_fill(int *pnfds,
 			 * if the packets needed to be fragmented
 			 * (XXX <= 4 ?)
 			 */
-			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
+			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4 &&
+			    soselect(so)) {
 				FD_SET(so->s, readfds);
 				UPD_NFDS(so->s);
 			}
@@ -350,8 +364,8 @@ void slirp_select_fill(int *pnfds,
 
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
-    struct socket *so, *so_next;
-    int ret;
+    struct socket *so;
+    int ret, i;
 
     global_readfds = readfds;
     global_writefds = writefds;
@@ -380,10 +394,15 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 	 */
 	if (link_up) {
 		/*
-		 * Check TCP sockets
+		 * Check TCP sockets, only those slirp_select_fill() handed
+		 * to select() can have anything to do
 		 */
-		for (so = tcb.so_next; so != &tcb; so = so_next) {
-			so_next = so->so_next;
+		for (i = 0; i < so_npolled_tcp; i++) {
+			so = so_polled[i];
+
+			/* freed since */
+			if (!so)
+			   continue;
 
 			/*
 			 * FD_ISSET is meaningless on these sockets
@@ -496,10 +515,10 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 		 * Incoming packets are sent straight away, they're not buffered.
 		 * Incoming UDP data isn't buffered either.
 		 */
-		for (so = udb.so_next; so != &udb; so = so_next) {
-			so_next = so->so_next;
+		for (i = so_npolled_tcp; i < so_npolled; i++) {
+			so = so_polled[i];
 
-			if (so->s != -1 && FD_ISSET(so->s, readfds)) {
+			if (so && so->s != -1 && FD_ISSET(so->s, readfds)) {
                             sorecvfrom(so);
                         }
 		}
@@ -634,21 +653,32 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
 }
 
 /* output the IP packet to the ethernet device */
-void if_encap(const uint8_t *ip_data, int ip_data_len)
+void if_encap(struct mbuf *ifm)
 {
     uint8_t buf[1600];
-    struct ethhdr *eh = (struct ethhdr *)buf;
+    struct ethhdr *eh;
+    char *start = (ifm->m_flags & M_EXT) ? ifm->m_ext : ifm->m_dat;
 
-    if (ip_data_len + ETH_HLEN > sizeof(buf))
+    if (ifm->m_len + ETH_HLEN > sizeof(buf))
         return;
 
+    /* packets built by slirp leave IF_MAXLINKHDR bytes in front of the
+       IP header, and received ones the room of their own ethernet
+       header, so the header can usually be put there instead of
+       copying the whole packet */
+    if (ifm->m_data - start >= ETH_HLEN) {
+        eh = (struct ethhdr *)(ifm->m_data - ETH_HLEN);
+    } else {
+        eh = (struct ethhdr *)buf;
+        memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
+    }
+
     memcpy(eh->h_dest, client_ethaddr, ETH_ALEN);
     memcpy(eh->h_source, special_ethaddr, ETH_ALEN - 1);
     /* XXX: not correct */
     eh->h_source[5] = CTL_ALIAS;
     eh->h_proto = htons(ETH_P_IP);
-    memcpy(buf + sizeof(struct ethhdr), ip_data, ip_data_len);
-    slirp_output(buf, ip_data_len + ETH_HLEN);
+    slirp_output((uint8_t *)eh, ifm->m_len + ETH_HLEN);
 }
 
 int slirp_redir(int is_udp, int host_port,
@@ -24,6 +24,69 @@ so_init()
 }
 #endif
 
+/*
+ * Hash chains of the sockets in tcb and udb.  TCP sockets are keyed on
+ * the addresses and ports of both ends.  UDP (and ICMP) sockets only on
+ * the local ones, as udp_input() matches on those and rewrites the
+ * foreign side on every datagram.  Whoever changes the addresses of a
+ * queued socket calls sohash() to move it to its new chain, sofree()
+ * takes it out.
+ */
+#define SO_HASH_SIZE 1024
+
+static struct socket *tcp_hash[SO_HASH_SIZE];
+static struct socket *udp_hash[SO_HASH_SIZE];
+
+static inline int
+sohashfn(u_int32_t laddr, u_int lport, u_int32_t faddr, u_int fport)
+{
+	u_int32_t h;
+
+	h = laddr ^ (faddr * 31) ^ ((lport << 16) | fport);
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h & (SO_HASH_SIZE - 1);
+}
+
+static void
+sounhash(so)
+	struct socket *so;
+{
+	if (!so->so_hprev)
+	   return;
+	*so->so_hprev = so->so_hnext;
+	if (so->so_hnext)
+	   so->so_hnext->so_hprev = so->so_hprev;
+	so->so_hnext = NULL;
+	so->so_hprev = NULL;
+}
+
+/*
+ * (Re)insert a socket of the head list in the chain for its current
+ * addresses
+ */
+void
+sohash(head, so)
+	struct socket *head;
+	struct socket *so;
+{
+	struct socket **chain;
+
+	sounhash(so);
+	if (head == &tcb)
+	   chain = &tcp_hash[sohashfn(so->so_laddr.s_addr, so->so_lport,
+				so->so_faddr.s_addr, so->so_fport)];
+	else
+	   chain = &udp_hash[sohashfn(so->so_laddr.s_addr, so->so_lport, 0, 0)];
+
+	so->so_hnext = *chain;
+	if (so->so_hnext)
+	   so->so_hnext->so_hprev = &so->so_hnext;
+	*chain = so;
+	so->so_hprev = chain;
+}
+
 struct socket *
 solookup(head, laddr, lport, faddr, fport)
 	struct socket *head;
@@ -34,7 +97,12 @@ solookup(head, laddr, lport, faddr, fport)
 {
 	struct socket *so;
 
-	for (so = head->so_next; so != head; so = so->so_next) {
+	if (head == &tcb)
+	   so = tcp_hash[sohashfn(laddr.s_addr, lport, faddr.s_addr, fport)];
+	else
+	   so = udp_hash[sohashfn(laddr.s_addr, lport, 0, 0)];
+
+	for (; so; so = so->so_hnext) {
 		if (so->so_lport == lport &&
 		    so->so_laddr.s_addr == laddr.s_addr &&
 		    so->so_faddr.s_addr == faddr.s_addr &&
@@ -42,10 +110,38 @@ solookup(head, laddr, lport, faddr, fport)
 		   break;
 	}
 
-	if (so == head)
-	   return (struct socket *)NULL;
 	return so;
+}
 
+/*
+ * Same as solookup() but only match the local address and port, for
+ * UDP sockets which send to any foreign host
+ */
+struct socket *
+solookup_local(head, laddr, lport)
+	struct socket *head;
+	struct in_addr laddr;
+	u_int lport;
+{
+	struct socket *so;
+
+	if (head == &tcb) {
+		/* TCP chains are keyed on both ends */
+		for (so = head->so_next; so != head; so = so->so_next)
+			if (so->so_lport == lport &&
+			    so->so_laddr.s_addr == laddr.s_addr)
+			   return so;
+		return (struct socket *)NULL;
+	}
+
+	for (so = udp_hash[sohashfn(laddr.s_addr, lport, 0, 0)]; so;
+	     so = so->so_hnext) {
+		if (so->so_lport == lport &&
+		    so->so_laddr.s_addr == laddr.s_addr)
+		   break;
+	}
+
+	return so;
 }
 
 /*
@@ -82,6 +178,9 @@ sofree(so)
     tcp_last_so = &tcb;
   else if (so == udp_last_so)
     udp_last_so = &udb;
+  sounhash(so);
+  if (so->so_poll)
+    so_polled[so->so_poll - 1] = NULL;
 
   m_free(so->so_m);
 
@@ -91,6 +190,35 @@ sofree(so)
   free(so);
 }
 
+struct socket **so_polled;
+int so_npolled, so_npolled_tcp;
+static int so_polled_size;
+
+/*
+ * Remember that so is handed to select(), so that slirp_select_poll()
+ * only has to look at those sockets.  Returns 0 if there's no room.
+ */
+int
+soselect(so)
+	struct socket *so;
+{
+	struct socket **p;
+
+	if (so->so_poll)
+	   return 1;
+	if (so_npolled == so_polled_size) {
+		p = (struct socket **)realloc(so_polled,
+				(so_polled_size + 64) * sizeof(*so_polled));
+		if (!p)
+		   return 0;
+		so_polled = p;
+		so_polled_size += 64;
+	}
+	so_polled[so_npolled++] = so;
+	so->so_poll = so_npolled;
+	return 1;
+}
+
 /*
  * Read from so's socket into sb_snd, updating all relevant sbuf fields
  * NOTE: This will only be called if it is select()ed for reading, so
@@ -197,6 +325,15 @@ soread(so)
 	sb->sb_wptr += nn;
 	if (sb->sb_wptr >= (sb->sb_data + sb->sb_datalen))
 		sb->sb_wptr -= sb->sb_datalen;
+
+	/*
+	 * If we filled the buffer while the guest offers a larger
+	 * window, the buffer is what holds the transfer back
+	 */
+	if (sbspace(sb) < mss && sb->sb_datalen < TCP_MAXSPACE &&
+	    sb->sb_datalen < so->so_tcpcb->snd_wnd)
+		sbgrow(sb, min(sb->sb_datalen * 2,
+			       TCP_MAXSPACE - TCP_MAXSPACE % mss));
 	return nn;
 }
 
@@ -603,6 +740,7 @@ solisten(port, laddr, lport, flags)
 	   so->so_faddr = alias_addr;
 	else
 	   so->so_faddr = addr.sin_addr;
+	sohash(&tcb, so);
 
 	so->s = s;
 	return so;
@@ -51,6 +51,10 @@ struct socket {
   struct sbuf so_rcv;		/* Receive buffer */
   struct sbuf so_snd;		/* Send buffer */
   void * extra;			/* Extra pointer */
+
+  struct socket *so_hnext;	/* Next socket in the same hash chain */
+  struct socket **so_hprev;	/* Link pointing to us, NULL if not hashed */
+  int	so_poll;		/* so_polled[] index plus one, 0 if none */
 };
 
 
@@ -73,6 +77,10 @@ struct socket {
 
 extern struct socket tcb;
 
+/* Sockets handed to select() by slirp_select_fill(), TCP ones first */
+extern struct socket **so_polled;
+extern int so_npolled, so_npolled_tcp;
+
 
 #if defined(DECLARE_IOVEC) && !defined(HAVE_READV)
 struct iovec {
@@ -82,6 +90,9 @@ struct iovec {
 #endif
 
 struct socket * solookup _P((struct socket *, struct in_addr, u_int, struct in_addr, u_int));
+struct socket * solookup_local _P((struct socket *, struct in_addr, u_int));
+void sohash _P((struct socket *, struct socket *));
+int soselect _P((struct socket *));
 struct socket * socreate _P((void));
 void sofree _P((struct socket *));
 int soread _P((struct socket *));
@@ -44,8 +44,14 @@ typedef	u_int32_t	tcp_seq;
 
 extern struct socket *tcp_last_so;
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+/*
+ * Initial socket buffer sizes.  They are grown up to TCP_MAXSPACE
+ * while they rather than the windows limit a transfer, and the window
+ * scale requested is chosen so that a full buffer can be offered.
+ */
+#define TCP_SNDSPACE 32768
+#define TCP_RCVSPACE 32768
+#define TCP_MAXSPACE (1024 * 1024)
 
 /*
  * TCP header.
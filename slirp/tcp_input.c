@@ -250,6 +250,7 @@ tcp_input(m, iphlen, inso)
 	int todrop, acked, ourfinisacked, needoutput = 0;
 /*	int dropsocket = 0; */
 	int iss = 0;
+	int escape;
 	u_long tiwin;
 	int ret;
 /*	int ts_present = 0; */
@@ -413,6 +414,7 @@ findso:
 	  so->so_lport = ti->ti_sport;
 	  so->so_faddr = ti->ti_dst;
 	  so->so_fport = ti->ti_dport;
+	  sohash(&tcb, so);
 
 	  if ((so->so_iptos = tcp_tos(so)) == 0)
 	    so->so_iptos = ((struct ip *)ti)->ip_tos;
@@ -438,10 +440,9 @@ findso:
 		goto drop;
 
 	/* Unscale the window into a 32-bit value. */
-/*	if ((tiflags & TH_SYN) == 0)
- *		tiwin = ti->ti_win << tp->snd_scale;
- *	else
- */
+	if ((tiflags & TH_SYN) == 0)
+		tiwin = ti->ti_win << tp->snd_scale;
+	else
 		tiwin = ti->ti_win;
 
 	/*
@@ -665,6 +666,14 @@ findso:
 	    goto cont_input;
 	  }
 
+	  /*
+	   * The options are gone by the time a non-blocking connect
+	   * completes and we come back through cont_conn, so take the
+	   * MSS and window scale from the SYN now.
+	   */
+	  if (optp)
+	    tcp_dooptions(tp, (u_char *)optp, optlen, ti);
+
 	  if((tcp_fconnect(so) == -1) && (errno != EINPROGRESS) && (errno != EWOULDBLOCK)) {
 	    u_char code=ICMP_UNREACH_NET;
 	    DEBUG_MISC((dfd," tcp fconnect errno = %d-%s\n",
@@ -773,12 +782,11 @@ findso:
 			tp->t_state = TCPS_ESTABLISHED;
 
 			/* Do window scaling on this connection? */
-/*			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- * 				tp->snd_scale = tp->requested_s_scale;
- *				tp->rcv_scale = tp->request_r_scale;
- *			}
- */
+			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+				tp->snd_scale = tp->requested_s_scale;
+				tp->rcv_scale = tp->request_r_scale;
+			}
 			(void) tcp_reass(tp, (struct tcpiphdr *)0,
 				(struct mbuf *)0);
 			/*
@@ -1043,12 +1051,11 @@ trimthenstep6:
 		}
 
 		/* Do window scaling? */
-/*		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- *			tp->snd_scale = tp->requested_s_scale;
- *			tp->rcv_scale = tp->request_r_scale;
- *		}
- */
+		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+			tp->snd_scale = tp->requested_s_scale;
+			tp->rcv_scale = tp->request_r_scale;
+		}
 		(void) tcp_reass(tp, (struct tcpiphdr *)0, (struct mbuf *)0);
 		tp->snd_wl1 = ti->ti_seq - 1;
 		/* Avoid ack processing; snd_una==ti_ack  =>  dup ack */
@@ -1349,6 +1356,13 @@ dodata:
 	 * case PRU_RCVD).  If a FIN has already been received on this
 	 * connection then we just ignore the text.
 	 */
+	/*
+	 * Look at the segment before it is queued, the mbuf holding ti
+	 * is freed once the data has been handed on.
+	 */
+	escape = ti->ti_len && (unsigned)ti->ti_len <= 5 &&
+		 ((struct tcpiphdr_2 *)ti)->first_char == (char)27;
+
 	if ((ti->ti_len || (tiflags&TH_FIN)) &&
 	    TCPS_HAVERCVDFIN(tp->t_state) == 0) {
 		TCP_REASS(tp, ti, m, so, tiflags);
@@ -1358,6 +1372,19 @@ dodata:
 		 * buffer size.
 		 */
 		len = so->so_rcv.sb_datalen - (tp->rcv_adv - tp->rcv_nxt);
+
+		/*
+		 * If the peer filled the window we offered and it all went
+		 * straight on to the socket, the window is what limits the
+		 * transfer.  Grow the buffer behind it, only while empty
+		 * so that sbreserve() can simply reallocate it.
+		 */
+		if (SEQ_GEQ(tp->rcv_nxt, tp->rcv_adv) &&
+		    so->so_rcv.sb_cc == 0 &&
+		    so->so_rcv.sb_datalen < TCP_MAXSPACE &&
+		    so->so_rcv.sb_datalen < ((u_int32_t)TCP_MAXWIN << tp->rcv_scale))
+			sbreserve(&so->so_rcv, min(so->so_rcv.sb_datalen * 2,
+						   TCP_MAXSPACE));
 	} else {
 		m_free(m);
 		tiflags &= ~TH_FIN;
@@ -1441,8 +1468,7 @@ dodata:
  *	       ((so->so_iptos & IPTOS_LOWDELAY) &&
  *	       ((struct tcpiphdr_2 *)ti)->first_char == (char)27)) {
  */
-	if (ti->ti_len && (unsigned)ti->ti_len <= 5 &&
-	    ((struct tcpiphdr_2 *)ti)->first_char == (char)27) {
+	if (escape) {
 		tp->t_flags |= TF_ACKNOW;
 	}
 
@@ -1526,15 +1552,15 @@ tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti)
 			(void) tcp_mss(tp, mss);	/* sets t_maxseg */
 			break;
 
-/*		case TCPOPT_WINDOW:
- *			if (optlen != TCPOLEN_WINDOW)
- *				continue;
- *			if (!(ti->ti_flags & TH_SYN))
- *				continue;
- *			tp->t_flags |= TF_RCVD_SCALE;
- *			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
- *			break;
- */
+		case TCPOPT_WINDOW:
+			if (optlen != TCPOLEN_WINDOW)
+				continue;
+			if (!(ti->ti_flags & TH_SYN))
+				continue;
+			tp->t_flags |= TF_RCVD_SCALE;
+			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
+			break;
+
 /*		case TCPOPT_TIMESTAMP:
  *			if (optlen != TCPOLEN_TIMESTAMP)
  *				continue;
@@ -199,7 +199,11 @@ tcp_newtcpcb(so)
 	tp->seg_next = tp->seg_prev = (tcpiphdrp_32)tp;
 	tp->t_maxseg = TCP_MSS;
 
-	tp->t_flags = TCP_DO_RFC1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	/* window scaling is always offered, timestamps aren't done */
+	tp->t_flags = TCP_DO_RFC1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : TF_REQ_SCALE;
+	while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
+	       (TCP_MAXWIN << tp->request_r_scale) < TCP_MAXSPACE)
+		tp->request_r_scale++;
 	tp->t_socket = so;
 
 	/*
@@ -494,6 +498,7 @@ tcp_connect(inso)
 	/* Translate connections from localhost to the real hostname */
 	if (so->so_faddr.s_addr == 0 || so->so_faddr.s_addr == loopback_addr.s_addr)
 	   so->so_faddr = alias_addr;
+	sohash(&tcb, so);
 
 	/* Close the accept() socket, set right state */
 	if (inso->so_state & SS_FACCEPTONCE) {
@@ -835,6 +840,7 @@ tcp_emu(so, m)
 				if (ns->so_faddr.s_addr == 0 ||
 					ns->so_faddr.s_addr == loopback_addr.s_addr)
                   ns->so_faddr = alias_addr;
+				sohash(&tcb, ns);
 
 				ns->so_iptos = tcp_tos(ns);
 				tp = sototcpcb(ns);
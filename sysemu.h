@@ -43,6 +43,7 @@ int cpu_load(QEMUFile *f, void *opaque, int version_id);
 void do_savevm(const char *name);
 void do_loadvm(const char *name);
 void do_delvm(const char *name);
+void do_migrate(const char *filename, const char *ram_file);
 void do_info_snapshots(void);
 
 void main_loop_wait(int timeout);
@@ -87,6 +88,7 @@ extern int cursor_hide;
 extern int graphic_rotate;
 extern int no_quit;
 extern int semihosting_enabled;
+extern int serial_pacing;
 extern int autostart;
 extern int old_param;
 extern const char *bootp_filename;
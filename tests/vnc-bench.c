@@ -0,0 +1,294 @@
+/*
+ * Speed test for the VNC server's frame buffer scan and the hextile
+ * single colour check.
+ *
+ * "tiles" is the tile by tile compare of vnc_refresh_dirty().  Two
+ * alternatives are measured against it and are not used by the server:
+ * comparing a run of dirty tiles with one memcmp, and a fused SSE2
+ * compare and copy.  The scan is bound by memory bandwidth, so neither
+ * wins when the screen is static and both lose when tiles change.  The
+ * single colour check does use SSE2, see pixel_block_is_fill().
+ *
+ * Each frame repaints part of a 640x480 32 bpp screen and marks all of
+ * it dirty, as a guest redrawing its whole framebuffer does.  In the
+ * "desktop" scene a few small areas change, in the "video" scene all
+ * of the screen does.  The resulting dirty maps are checked to be the
+ * same for all the variants.
+ *
+ * This code is licensed under the GPL.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "hw/pixel_ops.h"
+
+#define WIDTH	640
+#define HEIGHT	480
+#define DEPTH	4
+#define LINESIZE	(WIDTH * DEPTH)
+#define TILES	(WIDTH / 16)
+#define FRAMES	2000
+#define ROUNDS	5	/* the best round is reported */
+
+static uint8_t *fb, *old;
+static uint8_t dirty[HEIGHT][TILES];
+
+static int64_t get_time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static int video;
+
+/* A window moving around, a blinking cursor and a status line, or
+   a full screen video */
+static void repaint(int frame)
+{
+    int x, y, x0, y0;
+    uint32_t *p;
+
+    if (video) {
+        for (y = 0; y < HEIGHT; y++) {
+            p = (uint32_t *) (fb + y * LINESIZE);
+            for (x = 0; x < WIDTH; x++)
+                p[x] = (x * 3 + y * 5 + frame) & 0xffffff;
+        }
+        return;
+    }
+
+    x0 = (frame * 8) % (WIDTH - 128);
+    y0 = (frame * 4) % (HEIGHT - 96);
+    for (y = y0; y < y0 + 96; y++) {
+        p = (uint32_t *) (fb + y * LINESIZE) + x0;
+        for (x = 0; x < 128; x++)
+            p[x] = 0x00203040 + frame + x;
+    }
+
+    for (y = 200; y < 216; y++) {
+        p = (uint32_t *) (fb + y * LINESIZE) + 320;
+        for (x = 0; x < 8; x++)
+            p[x] = (frame & 16) ? 0xffffff : 0;
+    }
+
+    p = (uint32_t *) (fb + (HEIGHT - 8) * LINESIZE);
+    p[frame % WIDTH] ^= 0x808080;
+}
+
+static void mark_all(void)
+{
+    memset(dirty, 1, sizeof(dirty));
+}
+
+static int scan_tiles(void)
+{
+    int x, y, has_dirty = 0;
+    uint8_t *ptr, *old_ptr;
+
+    for (y = 0; y < HEIGHT; y++) {
+        ptr = fb + y * LINESIZE;
+        old_ptr = old + y * LINESIZE;
+        for (x = 0; x < TILES; x++) {
+            if (dirty[y][x]) {
+                if (memcmp(old_ptr, ptr, 16 * DEPTH) == 0) {
+                    dirty[y][x] = 0;
+                } else {
+                    has_dirty = 1;
+                    memcpy(old_ptr, ptr, 16 * DEPTH);
+                }
+            }
+            ptr += 16 * DEPTH;
+            old_ptr += 16 * DEPTH;
+        }
+    }
+    return has_dirty;
+}
+
+static int scan_runs(void)
+{
+    int x, y, i, n, has_dirty = 0;
+    uint8_t *ptr, *old_ptr;
+
+    for (y = 0; y < HEIGHT; y++) {
+        x = 0;
+        while (x < TILES) {
+            if (!dirty[y][x]) {
+                x++;
+                continue;
+            }
+            for (n = x + 1; n < TILES && dirty[y][n]; n++);
+
+            ptr = fb + y * LINESIZE + x * 16 * DEPTH;
+            old_ptr = old + y * LINESIZE + x * 16 * DEPTH;
+            if (memcmp(old_ptr, ptr, (n - x) * 16 * DEPTH) == 0) {
+                for (; x < n; x++)
+                    dirty[y][x] = 0;
+                continue;
+            }
+
+            has_dirty = 1;
+            if (n - x > 1)
+                for (i = x; i < n; i++)
+                    if (memcmp(old_ptr + (i - x) * 16 * DEPTH,
+                               ptr + (i - x) * 16 * DEPTH, 16 * DEPTH) == 0)
+                        dirty[y][i] = 0;
+            memcpy(old_ptr, ptr, (n - x) * 16 * DEPTH);
+            x = n;
+        }
+    }
+    return has_dirty;
+}
+
+#ifdef PIXEL_OPS_SSE2
+static int tile_update_sse2(uint8_t *dest, const uint8_t *src, int len)
+{
+    __m128i eq = _mm_set1_epi8(-1);
+    int i;
+
+    for (i = 0; i < len; i += 16)
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+                                _mm_loadu_si128((const __m128i *) (dest + i)),
+                                _mm_loadu_si128((const __m128i *) (src + i))));
+    if (_mm_movemask_epi8(eq) == 0xffff)
+        return 0;
+
+    for (i = 0; i < len; i += 16)
+        _mm_storeu_si128((__m128i *) (dest + i),
+                        _mm_loadu_si128((const __m128i *) (src + i)));
+    return 1;
+}
+
+static int scan_sse2(void)
+{
+    int x, y, has_dirty = 0;
+    uint8_t *ptr, *old_ptr;
+
+    for (y = 0; y < HEIGHT; y++) {
+        ptr = fb + y * LINESIZE;
+        old_ptr = old + y * LINESIZE;
+        for (x = 0; x < TILES; x++) {
+            if (dirty[y][x]) {
+                if (tile_update_sse2(old_ptr, ptr, 16 * DEPTH))
+                    has_dirty = 1;
+                else
+                    dirty[y][x] = 0;
+            }
+            ptr += 16 * DEPTH;
+            old_ptr += 16 * DEPTH;
+        }
+    }
+    return has_dirty;
+}
+#endif
+
+static void bench_scan(const char *name, int (*scan)(void),
+                uint8_t *result)
+{
+    int64_t t, total, best = 0;
+    int frame, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        memset(fb, 0, HEIGHT * LINESIZE);
+        memset(old, 0, HEIGHT * LINESIZE);
+        total = 0;
+        for (frame = 0; frame < FRAMES; frame++) {
+            repaint(frame);
+            mark_all();
+            t = get_time_us();
+            scan();
+            total += get_time_us() - t;
+        }
+        if (!round || total < best)
+            best = total;
+    }
+    printf("%s: scan %-6s %8.2f us/frame\n", video ? "video" : "desktop",
+                    name, (double) best / FRAMES);
+
+    if (result[0] == 0xff)
+        memcpy(result, dirty, sizeof(dirty));
+    else if (memcmp(result, dirty, sizeof(dirty))) {
+        printf("scan %s: dirty map differs\n", name);
+        exit(1);
+    }
+}
+
+static int solid_plain(const uint32_t *irow)
+{
+    uint32_t bg = irow[0];
+    int i, j;
+
+    for (j = 0; j < 16; j++) {
+        for (i = 0; i < 16; i++)
+            if (irow[i] != bg)
+                return 0;
+        irow += WIDTH;
+    }
+    return 1;
+}
+
+#ifdef PIXEL_OPS_SSE2
+static int solid_sse2(const uint32_t *irow)
+{
+    uint32_t bg = irow[0];
+    int j;
+
+    for (j = 0; j < 16; j++) {
+        if (!pixel_block_is_fill((const uint8_t *) irow, 16 * DEPTH, bg))
+            return 0;
+        irow += WIDTH;
+    }
+    return 1;
+}
+#endif
+
+static void bench_solid(const char *name, int (*solid)(const uint32_t *))
+{
+    int64_t t, best = 0;
+    int frame, round, x, y, n;
+
+    for (round = 0; round < ROUNDS; round++) {
+        n = 0;
+        t = get_time_us();
+        for (frame = 0; frame < FRAMES / 10; frame++)
+            for (y = 0; y < HEIGHT; y += 16)
+                for (x = 0; x < WIDTH; x += 16)
+                    n += solid((const uint32_t *) (fb + y * LINESIZE) + x);
+        t = get_time_us() - t;
+        if (!round || t < best)
+            best = t;
+    }
+    printf("%s: solid %-5s %8.3f us/tile, %d solid\n",
+                    video ? "video" : "desktop", name,
+                    (double) best / (FRAMES / 10 * TILES * (HEIGHT / 16)), n);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t result[HEIGHT][TILES];
+
+    fb = malloc(HEIGHT * LINESIZE);
+    old = malloc(HEIGHT * LINESIZE);
+
+    for (video = 0; video < 2; video++) {
+        memset(result, 0xff, sizeof(result));
+
+        bench_scan("tiles", scan_tiles, &result[0][0]);
+        bench_scan("runs", scan_runs, &result[0][0]);
+#ifdef PIXEL_OPS_SSE2
+        if (pixel_ops_sse2())
+            bench_scan("sse2", scan_sse2, &result[0][0]);
+#endif
+
+        bench_solid("plain", solid_plain);
+#ifdef PIXEL_OPS_SSE2
+        if (pixel_ops_sse2())
+            bench_solid("sse2", solid_sse2);
+#endif
+    }
+    return 0;
+}
@@ -61,6 +61,7 @@ struct gadget_state_s {
         struct gadget_state_s *state;
 
         int busy;
+        int in;
         uint8_t buffer[4096];
         USBPacket packet;
     } ep[16];
@@ -141,6 +142,20 @@ next:
     }
 }
 
+static void gadget_ep_read(void *opaque);
+static void gadget_ep_write(void *opaque);
+
+/* Only poll the endpoint while the device can take another packet.  */
+static void gadget_ep_listen(struct ep_s *ep)
+{
+    if (ep->busy)
+        qemu_set_fd_handler(ep->fd, NULL, NULL, NULL);
+    else if (ep->in)
+        qemu_set_fd_handler(ep->fd, NULL, gadget_ep_read, ep);
+    else
+        qemu_set_fd_handler(ep->fd, gadget_ep_write, NULL, ep);
+}
+
 static void gadget_ep_run(struct ep_s *ep)
 {
     USBDevice *dev = ep->state->port.dev;
@@ -155,6 +170,7 @@ static void gadget_ep_run(struct ep_s *ep)
         gadget_stall(ep->state, &ep->packet);
     } else if (ret == USB_RET_ASYNC) {
         ep->busy = 1;
+        gadget_ep_listen(ep);
     } else {
         fprintf(stderr, "%s: EP%i packet unhandled: %i\n", __FUNCTION__,
                         ep->num, ret);
@@ -183,7 +199,10 @@ static void gadget_token_in(USBPacket *packet, void *opaque)
 {
     struct ep_s *ep = (struct ep_s *) opaque;
     sigset_t new, old;
-    ep->busy = 0;
+    if (ep->busy) {
+        ep->busy = 0;
+        gadget_ep_listen(ep);
+    }
     sigfillset(&new);
     /* The packets reach 1.5 kB and the loop alone, with unblocked
      * signals locks qemu up for ~10s until a 1.5 kB write succeeds
@@ -234,7 +253,11 @@ static void gadget_ep_read(void *opaque)
 
 static void gadget_nop(USBPacket *prev_packet, void *opaque)
 {
-    ((struct ep_s *) opaque)->busy = 0;
+    struct ep_s *ep = (struct ep_s *) opaque;
+    if (ep->busy) {
+        ep->busy = 0;
+        gadget_ep_listen(ep);
+    }
 }
 
 static void gadget_ep_write(void *opaque)
@@ -314,11 +337,8 @@ static int gadget_ep_open(struct gadget_state_s *hci,
     }
 
     ep->busy = 0;
-
-    if (desc->bEndpointAddress & USB_DIR_IN)
-        qemu_set_fd_handler(ep->fd, NULL, gadget_ep_read, ep);
-    else
-        qemu_set_fd_handler(ep->fd, gadget_ep_write, NULL, ep);
+    ep->in = !!(desc->bEndpointAddress & USB_DIR_IN);
+    gadget_ep_listen(ep);
 
     return 0;
 
@@ -46,6 +46,11 @@
 #include <sys/time.h>
 #include <zlib.h>
 
+#if !defined(_WIN32) && !defined(_BSD)
+/* linked in along with the AIO libraries */
+#include <pthread.h>
+#endif
+
 #ifndef _WIN32
 #include <sys/times.h>
 #include <sys/wait.h>
@@ -220,6 +225,10 @@ int daemonize = 0;
 const char *option_rom[MAX_OPTION_ROMS];
 int nb_option_roms;
 int semihosting_enabled = 0;
+int serial_pacing = 0;
+int tight_savevm_enabled = 0;
+int lazy_loadvm = 0;
+const char *shared_ram = NULL;
 int autostart = 1;
 #ifdef TARGET_ARM
 int old_param = 0;
@@ -4885,6 +4894,11 @@ void do_info_network(void)
 #define MTD_ALIAS "if=mtd"
 #define SD_ALIAS "index=0,if=sd"
 
+static void bdrv_flush_exit(void)
+{
+    bdrv_flush_all();
+}
+
 static int drive_add(const char *file, const char *fmt, ...)
 {
     va_list ap;
@@ -4932,6 +4946,9 @@ int drive_get_max_bus(BlockInterfaceType type)
     return max_bus;
 }
 
+/* size of the emulator side write-back cache for cache=writeback */
+#define DRIVE_WRITE_CACHE_SECTORS 2048
+
 static int drive_init(struct drive_opt *arg, int snapshot,
                       QEMUMachine *machine)
 {
@@ -4947,11 +4964,12 @@ static int drive_init(struct drive_opt *arg, int snapshot,
     int max_devs;
     int index;
     int cache;
+    int readahead;
     int bdrv_flags;
     char *str = arg->opt;
     char *params[] = { "bus", "unit", "if", "index", "cyls", "heads",
                        "secs", "trans", "media", "snapshot", "file",
-                       "cache", NULL };
+                       "cache", "readahead", NULL };
 
     if (check_params(buf, sizeof(buf), params, str) < 0) {
          fprintf(stderr, "qemu: unknowm parameter '%s' in '%s'\n",
@@ -4966,6 +4984,7 @@ static int drive_init(struct drive_opt *arg, int snapshot,
     translation = BIOS_ATA_TRANSLATION_AUTO;
     index = -1;
     cache = 1;
+    readahead = 0;
 
     if (!strcmp(machine->name, "realview") ||
         !strcmp(machine->name, "SS-5") ||
@@ -5113,12 +5132,22 @@ static int drive_init(struct drive_opt *arg, int snapshot,
             cache = 0;
         else if (!strcmp(buf, "on"))
             cache = 1;
+        else if (!strcmp(buf, "writeback"))
+            cache = 2;
         else {
            fprintf(stderr, "qemu: invalid cache option\n");
            return -1;
         }
     }
 
+    if (get_param_value(buf, sizeof(buf), "readahead", str)) {
+        readahead = strtol(buf, NULL, 0);
+        if (readahead < 0 || readahead > 4096) {
+            fprintf(stderr, "qemu: '%s' invalid readahead size\n", str);
+            return -1;
+        }
+    }
+
     if (arg->file == NULL)
         get_param_value(file, sizeof(file), "file", str);
     else
@@ -5226,6 +5255,11 @@ static int drive_init(struct drive_opt *arg, int snapshot,
                         file);
         return -1;
     }
+    if (cache == 2)
+        bdrv_set_write_cache(bdrv, DRIVE_WRITE_CACHE_SECTORS);
+    /* the size is given in kilobytes */
+    if (readahead)
+        bdrv_set_readahead(bdrv, readahead * 2);
     return 0;
 }
 
@@ -5664,11 +5698,11 @@ static void dumb_resize(DisplayState *ds, int w, int h)
 {
 }
 
+/* The display controllers raise frame interrupts from their update
+   functions, so keep calling them even though nothing is shown.  */
 static void dumb_refresh(DisplayState *ds)
 {
-#if defined(CONFIG_SDL)
     vga_hw_update();
-#endif
 }
 
 static void dumb_display_init(DisplayState *ds)
@@ -6072,6 +6106,7 @@ typedef struct SaveStateEntry {
     char idstr[256];
     int instance_id;
     int version_id;
+    SaveLiveStateHandler *save_live_state;
     SaveStateHandler *save_state;
     LoadStateHandler *load_state;
     void *opaque;
@@ -6080,12 +6115,15 @@ typedef struct SaveStateEntry {
 
 static SaveStateEntry *first_se;
 
-int register_savevm(const char *idstr,
-                    int instance_id,
-                    int version_id,
-                    SaveStateHandler *save_state,
-                    LoadStateHandler *load_state,
-                    void *opaque)
+/* A device with a save_live_state handler has its state saved while
+   the VM is still running, see qemu_savevm_state_begin().  */
+int register_savevm_live(const char *idstr,
+                         int instance_id,
+                         int version_id,
+                         SaveLiveStateHandler *save_live_state,
+                         SaveStateHandler *save_state,
+                         LoadStateHandler *load_state,
+                         void *opaque)
 {
     SaveStateEntry *se, **pse;
 
@@ -6095,6 +6133,7 @@ int register_savevm(const char *idstr,
     pstrcpy(se->idstr, sizeof(se->idstr), idstr);
     se->instance_id = instance_id;
     se->version_id = version_id;
+    se->save_live_state = save_live_state;
     se->save_state = save_state;
     se->load_state = load_state;
     se->opaque = opaque;
@@ -6108,48 +6147,210 @@ int register_savevm(const char *idstr,
     return 0;
 }
 
+int register_savevm(const char *idstr,
+                    int instance_id,
+                    int version_id,
+                    SaveStateHandler *save_state,
+                    LoadStateHandler *load_state,
+                    void *opaque)
+{
+    return register_savevm_live(idstr, instance_id, version_id,
+                                NULL, save_state, load_state, opaque);
+}
+
 #define QEMU_VM_FILE_MAGIC   0x5145564d
 #define QEMU_VM_FILE_VERSION 0x00000002
 
-static int qemu_savevm_state(QEMUFile *f)
+/* the total size field follows the magic and the version */
+#define QEMU_VM_TOTAL_LEN_POS 8
+
+static int64_t qemu_savevm_record_start(QEMUFile *f, SaveStateEntry *se)
+{
+    int64_t len_pos;
+    int len;
+
+    /* ID string */
+    len = strlen(se->idstr);
+    qemu_put_byte(f, len);
+    qemu_put_buffer(f, (uint8_t *)se->idstr, len);
+
+    qemu_put_be32(f, se->instance_id);
+    qemu_put_be32(f, se->version_id);
+
+    /* record size: filled later */
+    len_pos = qemu_ftell(f);
+    qemu_put_be32(f, 0);
+    return len_pos;
+}
+
+static void qemu_savevm_record_end(QEMUFile *f, int64_t len_pos)
+{
+    int64_t cur_pos;
+
+    /* fill record size */
+    cur_pos = qemu_ftell(f);
+    qemu_fseek(f, len_pos, SEEK_SET);
+    qemu_put_be32(f, cur_pos - len_pos - 4);
+    qemu_fseek(f, cur_pos, SEEK_SET);
+}
+
+/* Saving is split in three steps so that devices registered with
+   register_savevm_live() can send most of their state while the VM
+   is still running:
+
+   - qemu_savevm_state_begin() writes the file header,
+   - qemu_savevm_state_iterate() is called with the VM running until it
+     returns 1, meaning that every live device is ready to finish,
+   - qemu_savevm_state_complete() is called with the VM stopped and
+     saves the remaining state of all devices.
+
+   Each step returns a negative value if a live device failed to save
+   its state, the file is unusable then.
+
+   Every call of a save_live_state handler produces a record of its
+   own, so the load handler of a live device gets called once per
+   record.  */
+static int qemu_savevm_state_begin(QEMUFile *f)
 {
     SaveStateEntry *se;
-    int len, ret;
-    int64_t cur_pos, len_pos, total_len_pos;
+    int64_t len_pos;
+    int ret;
 
     qemu_put_be32(f, QEMU_VM_FILE_MAGIC);
     qemu_put_be32(f, QEMU_VM_FILE_VERSION);
-    total_len_pos = qemu_ftell(f);
     qemu_put_be64(f, 0); /* total size */
 
     for(se = first_se; se != NULL; se = se->next) {
-        /* ID string */
-        len = strlen(se->idstr);
-        qemu_put_byte(f, len);
-        qemu_put_buffer(f, (uint8_t *)se->idstr, len);
+        if (!se->save_live_state)
+            continue;
+        len_pos = qemu_savevm_record_start(f, se);
+        ret = se->save_live_state(f, QEMU_VM_STAGE_START, se->opaque);
+        qemu_savevm_record_end(f, len_pos);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
 
-        qemu_put_be32(f, se->instance_id);
-        qemu_put_be32(f, se->version_id);
+static int qemu_savevm_state_iterate(QEMUFile *f)
+{
+    SaveStateEntry *se;
+    int64_t len_pos;
+    int ret, done;
 
-        /* record size: filled later */
-        len_pos = qemu_ftell(f);
-        qemu_put_be32(f, 0);
-        se->save_state(f, se->opaque);
+    done = 1;
+    for(se = first_se; se != NULL; se = se->next) {
+        if (!se->save_live_state)
+            continue;
+        len_pos = qemu_savevm_record_start(f, se);
+        ret = se->save_live_state(f, QEMU_VM_STAGE_PART, se->opaque);
+        qemu_savevm_record_end(f, len_pos);
+        if (ret < 0)
+            return ret;
+        if (!ret)
+            done = 0;
+    }
+    return done;
+}
 
-        /* fill record size */
-        cur_pos = qemu_ftell(f);
-        len = cur_pos - len_pos - 4;
-        qemu_fseek(f, len_pos, SEEK_SET);
-        qemu_put_be32(f, len);
-        qemu_fseek(f, cur_pos, SEEK_SET);
+static int qemu_savevm_state_complete(QEMUFile *f)
+{
+    SaveStateEntry *se;
+    int64_t cur_pos, len_pos;
+    int ret;
+
+    for(se = first_se; se != NULL; se = se->next) {
+        len_pos = qemu_savevm_record_start(f, se);
+        ret = 0;
+        if (se->save_live_state)
+            ret = se->save_live_state(f, QEMU_VM_STAGE_END, se->opaque);
+        else
+            se->save_state(f, se->opaque);
+        qemu_savevm_record_end(f, len_pos);
+        if (ret < 0)
+            return ret;
     }
     cur_pos = qemu_ftell(f);
-    qemu_fseek(f, total_len_pos, SEEK_SET);
-    qemu_put_be64(f, cur_pos - total_len_pos - 8);
+    qemu_fseek(f, QEMU_VM_TOTAL_LEN_POS, SEEK_SET);
+    qemu_put_be64(f, cur_pos - QEMU_VM_TOTAL_LEN_POS - 8);
     qemu_fseek(f, cur_pos, SEEK_SET);
 
-    ret = 0;
-    return ret;
+    return 0;
+}
+
+/* Save the VM state to f while the VM keeps running, then stop it for
+   the last step.  done() is called once the state is complete, with
+   the VM stopped, or with a negative ret and the VM possibly still
+   running if the save failed.  */
+
+/* time in ms the guest runs for between two iterations */
+#define LIVE_SAVE_INTERVAL 10
+
+typedef void LiveSaveDoneFunc(QEMUFile *f, int ret, void *opaque);
+
+typedef struct LiveSaveState {
+    QEMUFile *f;
+    QEMUTimer *timer;
+    LiveSaveDoneFunc *done;
+    void *opaque;
+} LiveSaveState;
+
+static LiveSaveState *live_save;
+
+static void qemu_savevm_live_timer(void *opaque)
+{
+    LiveSaveState *s = opaque;
+    int ret;
+
+    /* go back to the main loop so that the guest dirties pages between
+       iterations, a bottom half would be run again straight away */
+    ret = qemu_savevm_state_iterate(s->f);
+    if (!ret) {
+        qemu_mod_timer(s->timer,
+                       qemu_get_clock(rt_clock) + LIVE_SAVE_INTERVAL);
+        return;
+    }
+
+    /* the images must be complete once the VM is reported stopped,
+       after a failure the VM just keeps running */
+    if (ret > 0) {
+        vm_stop(0);
+        qemu_aio_flush();
+        ret = bdrv_flush_all();
+        if (ret >= 0)
+            ret = qemu_savevm_state_complete(s->f);
+    }
+    qemu_free_timer(s->timer);
+    live_save = NULL;
+    s->done(s->f, ret, s->opaque);
+    qemu_free(s);
+}
+
+static void qemu_savevm_live(QEMUFile *f, LiveSaveDoneFunc *done, void *opaque)
+{
+    LiveSaveState *s;
+    int ret;
+
+    ret = qemu_savevm_state_begin(f);
+    s = vm_running && ret >= 0 ? qemu_mallocz(sizeof(LiveSaveState)) : NULL;
+    if (!s) {
+        /* nothing changes while the VM is stopped, save everything now */
+        vm_stop(0);
+        qemu_aio_flush();
+        if (ret >= 0)
+            ret = bdrv_flush_all();
+        if (ret >= 0)
+            ret = qemu_savevm_state_complete(f);
+        done(f, ret, opaque);
+        return;
+    }
+
+    s->f = f;
+    s->done = done;
+    s->opaque = opaque;
+    s->timer = qemu_new_timer(rt_clock, qemu_savevm_live_timer, s);
+    live_save = s;
+    qemu_mod_timer(s->timer, qemu_get_clock(rt_clock));
 }
 
 static SaveStateEntry *find_se(const char *idstr, int instance_id)
@@ -6204,8 +6405,9 @@ static int qemu_loadvm_state(QEMUFile *f)
         } else {
             ret = se->load_state(f, se->opaque, version_id);
             if (ret < 0) {
-                fprintf(stderr, "qemu: warning: error while loading state for instance 0x%x of device '%s'\n",
+                fprintf(stderr, "qemu: error while loading state for instance 0x%x of device '%s'\n",
                         instance_id, idstr);
+                goto the_end;
             }
         }
         /* always seek to exact end of record */
@@ -6272,36 +6474,39 @@ static int bdrv_snapshot_find(BlockDriverState *bs, QEMUSnapshotInfo *sn_info,
     return ret;
 }
 
-void do_savevm(const char *name)
+static void ram_lazy_finish(void);
+static int qemu_loadvm_state_lazy(QEMUFile *f, QEMUFile *lazy_f);
+
+/* set while a state is saved with its RAM in a separate file */
+static int ram_save_external;
+/* set while savevm saves a state, the drives that support it are
+   snapshotted once the state is complete */
+static int ram_save_snapshot;
+
+typedef struct SaveVMRequest {
+    BlockDriverState *bs;
+    char name[256];
+    int has_name;
+    int saved_vm_running;
+} SaveVMRequest;
+
+/* called once the VM state is written, with the VM stopped */
+static void do_savevm_finish(QEMUFile *f, int ret, void *opaque)
 {
-    BlockDriverState *bs, *bs1;
+    SaveVMRequest *req = opaque;
+    BlockDriverState *bs = req->bs, *bs1;
     QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
-    int must_delete, ret, i;
-    BlockDriverInfo bdi1, *bdi = &bdi1;
-    QEMUFile *f;
-    int saved_vm_running;
+    int must_delete, i;
 #ifdef _WIN32
     struct _timeb tb;
 #else
     struct timeval tv;
 #endif
 
-    bs = get_bs_snapshots();
-    if (!bs) {
-        term_printf("No block device can accept snapshots\n");
-        return;
-    }
-
-    /* ??? Should this occur after vm_stop?  */
-    qemu_aio_flush();
-
-    saved_vm_running = vm_running;
-    vm_stop(0);
-
+    ram_save_snapshot = 0;
     must_delete = 0;
-    if (name) {
-        ret = bdrv_snapshot_find(bs, old_sn, name);
-        if (ret >= 0) {
+    if (req->has_name) {
+        if (bdrv_snapshot_find(bs, old_sn, req->name) >= 0) {
             must_delete = 1;
         }
     }
@@ -6310,8 +6515,8 @@ void do_savevm(const char *name)
         pstrcpy(sn->name, sizeof(sn->name), old_sn->name);
         pstrcpy(sn->id_str, sizeof(sn->id_str), old_sn->id_str);
     } else {
-        if (name)
-            pstrcpy(sn->name, sizeof(sn->name), name);
+        if (req->has_name)
+            pstrcpy(sn->name, sizeof(sn->name), req->name);
     }
 
     /* fill auxiliary fields */
@@ -6326,19 +6531,6 @@ void do_savevm(const char *name)
 #endif
     sn->vm_clock_nsec = qemu_get_clock(vm_clock);
 
-    if (bdrv_get_info(bs, bdi) < 0 || bdi->vm_state_offset <= 0) {
-        term_printf("Device %s does not support VM state snapshots\n",
-                    bdrv_get_device_name(bs));
-        goto the_end;
-    }
-
-    /* save the VM state */
-    f = qemu_fopen_bdrv(bs, bdi->vm_state_offset, 1);
-    if (!f) {
-        term_printf("Could not open VM state file\n");
-        goto the_end;
-    }
-    ret = qemu_savevm_state(f);
     sn->vm_state_size = qemu_ftell(f);
     qemu_fclose(f);
     if (ret < 0) {
@@ -6367,18 +6559,181 @@ void do_savevm(const char *name)
     }
 
  the_end:
-    if (saved_vm_running)
+    if (req->saved_vm_running)
         vm_start();
+    qemu_free(req);
+}
+
+void do_savevm(const char *name)
+{
+    BlockDriverState *bs;
+    BlockDriverInfo bdi1, *bdi = &bdi1;
+    SaveVMRequest *req;
+    QEMUFile *f;
+
+    if (live_save) {
+        term_printf("A VM state save is already in progress\n");
+        return;
+    }
+
+    bs = get_bs_snapshots();
+    if (!bs) {
+        term_printf("No block device can accept snapshots\n");
+        return;
+    }
+
+    /* ??? Should this occur after vm_stop?  */
+    qemu_aio_flush();
+    /* the new state may overwrite the one the RAM is loaded from */
+    ram_lazy_finish();
+
+    if (bdrv_get_info(bs, bdi) < 0 || bdi->vm_state_offset <= 0) {
+        term_printf("Device %s does not support VM state snapshots\n",
+                    bdrv_get_device_name(bs));
+        return;
+    }
+
+    req = qemu_mallocz(sizeof(SaveVMRequest));
+    if (!req)
+        return;
+    req->bs = bs;
+    req->saved_vm_running = vm_running;
+    if (name) {
+        pstrcpy(req->name, sizeof(req->name), name);
+        req->has_name = 1;
+    }
+
+    /* save the VM state, the snapshots are taken when it is complete */
+    f = qemu_fopen_bdrv(bs, bdi->vm_state_offset, 1);
+    if (!f) {
+        term_printf("Could not open VM state file\n");
+        qemu_free(req);
+        return;
+    }
+    ram_save_snapshot = 1;
+    qemu_savevm_live(f, do_savevm_finish, req);
+}
+
+/* Write the guest RAM as is to a file that instances restoring the
+   state can map with -shared-ram.  The file is replaced, not rewritten,
+   as it may be mapped by running instances, this one included.  */
+static int ram_save_file(const char *filename)
+{
+    char tmp[1024];
+    ram_addr_t addr;
+    int fd, len, ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0)
+        return -errno;
+    ret = 0;
+    for (addr = 0; addr < phys_ram_size; addr += len) {
+        len = write(fd, phys_ram_base + addr, phys_ram_size - addr);
+        if (len < 0 && errno == EINTR) {
+            len = 0;
+        } else if (len <= 0) {
+            ret = -EIO;
+            break;
+        }
+    }
+    if (close(fd) < 0 && !ret)
+        ret = -errno;
+    if (!ret && rename(tmp, filename) < 0)
+        ret = -errno;
+    if (ret)
+        unlink(tmp);
+    return ret;
+}
+
+#ifndef _WIN32
+/* Map the guest RAM copy-on-write from a file written by ram_save_file(),
+   at 'addr' if not NULL.  The instances started from the same file
+   share the pages that they do not modify.  */
+static uint8_t *ram_map_shared(const char *filename, uint8_t *addr)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size != phys_ram_size) {
+        fprintf(stderr, "qemu: '%s' is not a RAM file of %d bytes\n",
+                filename, phys_ram_size);
+        exit(1);
+    }
+    p = mmap(addr, phys_ram_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | (addr ? MAP_FIXED : 0), fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("qemu: could not map the RAM file");
+        exit(1);
+    }
+    return p;
+}
+#endif
+
+static void do_migrate_finish(QEMUFile *f, int ret, void *opaque)
+{
+    char *ram_file = opaque;
+    int64_t size = qemu_ftell(f);
+
+    qemu_fclose(f);
+    ram_save_external = 0;
+    if (ret >= 0 && ram_file) {
+        ret = ram_save_file(ram_file);
+        size += phys_ram_size;
+    }
+    qemu_free(ram_file);
+    if (ret < 0)
+        term_printf("Error %d while writing VM state\n", ret);
+    else
+        term_printf("VM state saved (%" PRId64 " bytes), VM stopped\n", size);
+}
+
+/* Save the VM state to a file while the VM runs and leave it stopped,
+   so that another instance can continue with -incoming.  If ram_file
+   is given, the RAM is written there instead, once the VM is stopped,
+   for use with -shared-ram.  */
+void do_migrate(const char *filename, const char *ram_file)
+{
+    QEMUFile *f;
+
+    if (live_save) {
+        term_printf("A VM state save is already in progress\n");
+        return;
+    }
+
+    qemu_aio_flush();
+    if (bdrv_flush_all() < 0) {
+        term_printf("Could not write back the cached disk sectors\n");
+        return;
+    }
+    ram_lazy_finish();
+
+    f = qemu_fopen(filename, "wb");
+    if (!f) {
+        term_printf("Could not open VM state file %s\n", filename);
+        return;
+    }
+    ram_save_external = ram_file != NULL;
+    qemu_savevm_live(f, do_migrate_finish,
+                     ram_file ? qemu_strdup(ram_file) : NULL);
 }
 
 void do_loadvm(const char *name)
 {
     BlockDriverState *bs, *bs1;
     BlockDriverInfo bdi1, *bdi = &bdi1;
-    QEMUFile *f;
+    QEMUFile *f, *lazy_f;
     int i, ret;
     int saved_vm_running;
 
+    if (live_save) {
+        term_printf("A VM state save is in progress\n");
+        return;
+    }
+
     bs = get_bs_snapshots();
     if (!bs) {
         term_printf("No block device supports snapshots\n");
@@ -6390,6 +6745,7 @@ void do_loadvm(const char *name)
 
     saved_vm_running = vm_running;
     vm_stop(0);
+    ram_lazy_finish();
 
     for(i = 0; i <= nb_drives; i++) {
         bs1 = drives_table[i].bdrv;
@@ -6431,7 +6787,10 @@ void do_loadvm(const char *name)
         term_printf("Could not open VM state file\n");
         goto the_end;
     }
-    ret = qemu_loadvm_state(f);
+    lazy_f = NULL;
+    if (lazy_loadvm)
+        lazy_f = qemu_fopen_bdrv(bs, bdi->vm_state_offset, 0);
+    ret = qemu_loadvm_state_lazy(f, lazy_f);
     qemu_fclose(f);
     if (ret < 0) {
         term_printf("Error %d while loading VM state\n", ret);
@@ -6446,12 +6805,18 @@ void do_delvm(const char *name)
     BlockDriverState *bs, *bs1;
     int i, ret;
 
+    if (live_save) {
+        term_printf("A VM state save is in progress\n");
+        return;
+    }
+
     bs = get_bs_snapshots();
     if (!bs) {
         term_printf("No block device supports snapshots\n");
         return;
     }
 
+    ram_lazy_finish();
     for(i = 0; i <= nb_drives; i++) {
         bs1 = drives_table[i].bdrv;
         if (bdrv_has_snapshot(bs1)) {
@@ -7093,170 +7458,1207 @@ static int ram_load_v1(QEMUFile *f, void *opaque)
 }
 
 #define BDRV_HASH_BLOCK_SIZE 1024
-#define IOBUF_SIZE 4096
+#define IOBUF_SIZE 32768
 #define RAM_CBLOCK_MAGIC 0xfabe
 
-typedef struct RamCompressState {
+typedef struct RamDecompressState {
     z_stream zstream;
     QEMUFile *f;
     uint8_t buf[IOBUF_SIZE];
-} RamCompressState;
+} RamDecompressState;
 
-static int ram_compress_open(RamCompressState *s, QEMUFile *f)
+static int ram_decompress_open(RamDecompressState *s, QEMUFile *f)
 {
     int ret;
     memset(s, 0, sizeof(*s));
     s->f = f;
-    ret = deflateInit2(&s->zstream, 1,
-                       Z_DEFLATED, 15,
-                       9, Z_DEFAULT_STRATEGY);
+    ret = inflateInit(&s->zstream);
     if (ret != Z_OK)
         return -1;
-    s->zstream.avail_out = IOBUF_SIZE;
-    s->zstream.next_out = s->buf;
     return 0;
 }
 
-static void ram_put_cblock(RamCompressState *s, const uint8_t *buf, int len)
-{
-    qemu_put_be16(s->f, RAM_CBLOCK_MAGIC);
-    qemu_put_be16(s->f, len);
-    qemu_put_buffer(s->f, buf, len);
-}
-
-static int ram_compress_buf(RamCompressState *s, const uint8_t *buf, int len)
+static int ram_decompress_buf(RamDecompressState *s, uint8_t *buf, int len)
 {
-    int ret;
+    int ret, clen;
 
-    s->zstream.avail_in = len;
-    s->zstream.next_in = (uint8_t *)buf;
-    while (s->zstream.avail_in > 0) {
-        ret = deflate(&s->zstream, Z_NO_FLUSH);
-        if (ret != Z_OK)
+    s->zstream.avail_out = len;
+    s->zstream.next_out = buf;
+    while (s->zstream.avail_out > 0) {
+        if (s->zstream.avail_in == 0) {
+            if (qemu_get_be16(s->f) != RAM_CBLOCK_MAGIC)
+                return -1;
+            clen = qemu_get_be16(s->f);
+            if (clen > IOBUF_SIZE)
+                return -1;
+            qemu_get_buffer(s->f, s->buf, clen);
+            s->zstream.avail_in = clen;
+            s->zstream.next_in = s->buf;
+        }
+        ret = inflate(&s->zstream, Z_PARTIAL_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
             return -1;
-        if (s->zstream.avail_out == 0) {
-            ram_put_cblock(s, s->buf, IOBUF_SIZE);
-            s->zstream.avail_out = IOBUF_SIZE;
-            s->zstream.next_out = s->buf;
         }
     }
     return 0;
 }
 
-static void ram_compress_close(RamCompressState *s)
+static void ram_decompress_close(RamDecompressState *s)
 {
-    int len, ret;
+    inflateEnd(&s->zstream);
+}
 
-    /* compress last bytes */
-    for(;;) {
-        ret = deflate(&s->zstream, Z_FINISH);
-        if (ret == Z_OK || ret == Z_STREAM_END) {
-            len = IOBUF_SIZE - s->zstream.avail_out;
-            if (len > 0) {
-                ram_put_cblock(s, s->buf, len);
-            }
-            s->zstream.avail_out = IOBUF_SIZE;
-            s->zstream.next_out = s->buf;
-            if (ret == Z_STREAM_END)
-                break;
-        } else {
-            goto fail;
-        }
+/* From version 4, a RAM record is a list of segments of at most
+   RAM_SEG_SIZE bytes, each compressed as a zlib stream of its own so
+   that several host CPUs can work on them.  A segment is stored as its
+   be32 uncompressed size, its be32 compressed size and the compressed
+   data; an empty segment ends the record.  */
+#define RAM_SEG_SIZE    (256 * 1024)
+/* number of segments compressed or decompressed in one batch */
+#define RAM_SEG_BATCH   16
+
+typedef struct RamSegment {
+    uint8_t *data;
+    int len;
+    uint8_t *cdata;
+    int clen;
+    int ret;
+} RamSegment;
+
+typedef struct RamSegState {
+    QEMUFile *f;
+    int count;          /* segments filled in the current batch */
+    int len;            /* bytes used in the last one */
+    int ret;            /* negative once a segment failed to compress */
+} RamSegState;
+
+static RamSegment ram_segs[RAM_SEG_BATCH];
+static int ram_segs_decompress;
+
+/* file offset of each segment written since the save started, for the
+   page index saved at its end */
+static int64_t *ram_seg_offsets;
+static int ram_seg_total;
+static int ram_seg_offsets_size;
+
+static void ram_seg_add_offset(int64_t offset)
+{
+    int64_t *p;
+
+    if (ram_seg_total == ram_seg_offsets_size) {
+        p = qemu_malloc(2 * (ram_seg_offsets_size + 64) * sizeof(int64_t));
+        if (!p)
+            return;
+        memcpy(p, ram_seg_offsets, ram_seg_total * sizeof(int64_t));
+        qemu_free(ram_seg_offsets);
+        ram_seg_offsets = p;
+        ram_seg_offsets_size = 2 * (ram_seg_offsets_size + 64);
     }
-fail:
-    deflateEnd(&s->zstream);
+    ram_seg_offsets[ram_seg_total ++] = offset;
 }
 
-typedef struct RamDecompressState {
-    z_stream zstream;
-    QEMUFile *f;
-    uint8_t buf[IOBUF_SIZE];
-} RamDecompressState;
+static int ram_seg_compress(RamSegment *seg)
+{
+    z_stream zs;
+    int ret;
 
-static int ram_decompress_open(RamDecompressState *s, QEMUFile *f)
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15,
+                     9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    zs.next_in = seg->data;
+    zs.avail_in = seg->len;
+    zs.next_out = seg->cdata;
+    zs.avail_out = compressBound(RAM_SEG_SIZE);
+    ret = deflate(&zs, Z_FINISH);
+    seg->clen = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int ram_seg_decompress(RamSegment *seg)
 {
+    z_stream zs;
     int ret;
-    memset(s, 0, sizeof(*s));
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK)
+        return -1;
+    zs.next_in = seg->cdata;
+    zs.avail_in = seg->clen;
+    zs.next_out = seg->data;
+    zs.avail_out = seg->len;
+    ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END && zs.avail_out == 0 ? 0 : -1;
+}
+
+static void ram_seg_process(RamSegment *seg)
+{
+    if (ram_segs_decompress)
+        seg->ret = ram_seg_decompress(seg);
+    else
+        seg->ret = ram_seg_compress(seg);
+}
+
+#if !defined(_WIN32) && !defined(_BSD)
+/* The segments of a batch are handed out to the worker threads and to
+   the main thread, which then waits for all of them to be done.  */
+#define RAM_SEG_MAX_THREADS (RAM_SEG_BATCH - 1)
+
+static int ram_seg_threads;
+static pthread_mutex_t ram_seg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ram_seg_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ram_seg_done = PTHREAD_COND_INITIALIZER;
+static int ram_seg_next;    /* next segment to process */
+static int ram_seg_count;   /* segments in the batch */
+static int ram_seg_pending; /* segments not processed yet */
+
+/* Process segments of the current batch until none is left, with
+   ram_seg_lock held.  */
+static void ram_seg_work_locked(void)
+{
+    RamSegment *seg;
+
+    while (ram_seg_next < ram_seg_count) {
+        seg = &ram_segs[ram_seg_next ++];
+        pthread_mutex_unlock(&ram_seg_lock);
+        ram_seg_process(seg);
+        pthread_mutex_lock(&ram_seg_lock);
+        if (!-- ram_seg_pending)
+            pthread_cond_signal(&ram_seg_done);
+    }
+}
+
+static void *ram_seg_thread(void *opaque)
+{
+    pthread_mutex_lock(&ram_seg_lock);
+    for (;;) {
+        ram_seg_work_locked();
+        pthread_cond_wait(&ram_seg_work, &ram_seg_lock);
+    }
+    return NULL;
+}
+
+static void ram_seg_start_threads(void)
+{
+    pthread_t thread;
+    sigset_t set, old;
+    long n;
+
+    n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n > RAM_SEG_MAX_THREADS)
+        n = RAM_SEG_MAX_THREADS;
+    /* the workers must not take the signals the main loop relies on */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    for (ram_seg_threads = 0; ram_seg_threads < n; ram_seg_threads ++)
+        if (pthread_create(&thread, NULL, ram_seg_thread, NULL))
+            break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void ram_seg_run(int count)
+{
+    static int started;
+
+    if (!started) {
+        ram_seg_start_threads();
+        started = 1;
+    }
+    pthread_mutex_lock(&ram_seg_lock);
+    ram_seg_next = 0;
+    ram_seg_count = count;
+    ram_seg_pending = count;
+    if (ram_seg_threads)
+        pthread_cond_broadcast(&ram_seg_work);
+    ram_seg_work_locked();
+    while (ram_seg_pending)
+        pthread_cond_wait(&ram_seg_done, &ram_seg_lock);
+    pthread_mutex_unlock(&ram_seg_lock);
+}
+#else
+static void ram_seg_run(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i ++)
+        ram_seg_process(&ram_segs[i]);
+}
+#endif
+
+static int ram_seg_alloc_buffers(void)
+{
+    int i;
+
+    if (ram_segs[0].data)
+        return 0;
+    for (i = 0; i < RAM_SEG_BATCH; i ++) {
+        ram_segs[i].data = qemu_malloc(RAM_SEG_SIZE);
+        ram_segs[i].cdata = qemu_malloc(compressBound(RAM_SEG_SIZE));
+        if (!ram_segs[i].data || !ram_segs[i].cdata)
+            goto fail;
+    }
+    return 0;
+
+ fail:
+    for (i = 0; i < RAM_SEG_BATCH; i ++) {
+        qemu_free(ram_segs[i].data);
+        qemu_free(ram_segs[i].cdata);
+        ram_segs[i].data = ram_segs[i].cdata = NULL;
+    }
+    return -1;
+}
+
+static int ram_seg_open(RamSegState *s, QEMUFile *f)
+{
+    if (ram_seg_alloc_buffers() < 0)
+        return -1;
     s->f = f;
-    ret = inflateInit(&s->zstream);
-    if (ret != Z_OK)
+    s->count = 0;
+    s->len = 0;
+    s->ret = 0;
+    return 0;
+}
+
+/* compress the segments of the batch and write them in order, nothing
+   is written any more once a segment failed */
+static void ram_seg_flush(RamSegState *s)
+{
+    RamSegment *seg;
+    int i;
+
+    if (s->len)
+        ram_segs[s->count ++].len = s->len;
+    s->len = 0;
+    if (s->ret < 0) {
+        s->count = 0;
+        return;
+    }
+    ram_segs_decompress = 0;
+    ram_seg_run(s->count);
+    for (i = 0; i < s->count; i ++) {
+        seg = &ram_segs[i];
+        if (seg->ret < 0) {
+            fprintf(stderr, "qemu: could not compress the RAM state\n");
+            s->ret = -EIO;
+            break;
+        }
+        ram_seg_add_offset(qemu_ftell(s->f));
+        qemu_put_be32(s->f, seg->len);
+        qemu_put_be32(s->f, seg->clen);
+        qemu_put_buffer(s->f, seg->cdata, seg->clen);
+    }
+    s->count = 0;
+}
+
+/* Return room for 'len' bytes in the current segment.  An entry never
+   spans two segments.  */
+static uint8_t *ram_seg_alloc(RamSegState *s, int len)
+{
+    uint8_t *p;
+
+    if (s->len + len > RAM_SEG_SIZE) {
+        ram_segs[s->count ++].len = s->len;
+        s->len = 0;
+        if (s->count == RAM_SEG_BATCH)
+            ram_seg_flush(s);
+    }
+    p = ram_segs[s->count].data + s->len;
+    s->len += len;
+    return p;
+}
+
+static int ram_seg_close(RamSegState *s)
+{
+    ram_seg_flush(s);
+    qemu_put_be32(s->f, 0);
+    return s->ret;
+}
+
+/* Versions 3 and later of the RAM state are a list of pages, each
+   preceded by its address ORed with RAM_SAVE_FLAG_* bits.  Version 3
+   compressed the whole record in a single zlib stream.  A live save
+   sends the whole RAM first, then keeps resending the pages that the
+   guest dirtied since they were last sent, so a page may appear
+   several times in the file.  */
+#define RAM_SAVE_FLAG_FULL      0x01 /* the page follows */
+#define RAM_SAVE_FLAG_COMPRESS  0x02 /* the page is filled with one byte */
+#define RAM_SAVE_FLAG_MEM_SIZE  0x04 /* the address is the RAM size */
+#define RAM_SAVE_FLAG_EXTERNAL  0x40 /* with MEM_SIZE, the RAM content is
+                                        in a separate file */
+#define RAM_SAVE_FLAG_EOS       0x08 /* end of record */
+#define RAM_SAVE_FLAG_PAGE      0x10 /* same as the page at the be32
+                                        address that follows */
+#define RAM_SAVE_FLAG_DISK      0x20 /* same as the drive sectors given
+                                        by a drive index byte and a be64
+                                        sector number */
+
+/* amount of RAM scanned for dirty pages per live iteration */
+#define RAM_SAVE_CHUNK          (4 << 20)
+/* a live save stops the VM once a pass over the whole RAM sent less
+   than RAM_SAVE_MAX_DELTA bytes, or after RAM_SAVE_MAX_PASSES passes */
+#define RAM_SAVE_MAX_DELTA      (1 << 20)
+#define RAM_SAVE_MAX_PASSES     16
+/* amount of the drives indexed per live iteration with -tight-savevm,
+   the VM is only stopped once they are all indexed */
+#define RAM_SAVE_INDEX_CHUNK    (16 << 20)
+
+static ram_addr_t ram_save_addr;
+static int ram_save_delta;
+static int ram_save_passes;
+static int ram_save_indexed;
+
+/* pages sent in full, indexed by a hash of their content: address plus
+   one, 0 if free */
+static ram_addr_t *ram_page_hash;
+static int ram_page_hash_size;
+
+/* start an entry and return room for its 'len' bytes of data */
+static uint8_t *ram_put_header(RamSegState *s, ram_addr_t addr, int flags,
+                               int len)
+{
+    uint8_t *p;
+
+    p = ram_seg_alloc(s, 4 + len);
+    cpu_to_be32wu((uint32_t *)p, addr | flags);
+    return p + 4;
+}
+
+static int ram_page_is_uniform(const uint8_t *p)
+{
+    const unsigned long *w = (const unsigned long *)p;
+    unsigned long v;
+    int i;
+
+    v = p[0] * (~0UL / 0xff);
+    for (i = 0; i < TARGET_PAGE_SIZE / sizeof(unsigned long); i ++)
+        if (w[i] != v)
+            return 0;
+    return 1;
+}
+
+static unsigned int ram_page_hash_key(const uint8_t *p)
+{
+    const uint32_t *w = (const uint32_t *)p;
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < TARGET_PAGE_SIZE / 4; i ++)
+        h = (h ^ w[i]) * 16777619u;
+    return h & (ram_page_hash_size - 1);
+}
+
+static void ram_page_hash_init(void)
+{
+    qemu_free(ram_page_hash);
+    for (ram_page_hash_size = 1;
+         ram_page_hash_size < (phys_ram_size >> TARGET_PAGE_BITS);
+         ram_page_hash_size <<= 1);
+    ram_page_hash = qemu_mallocz(ram_page_hash_size * sizeof(ram_addr_t));
+    if (!ram_page_hash)
+        ram_page_hash_size = 0;
+}
+
+static void ram_page_hash_fini(void)
+{
+    qemu_free(ram_page_hash);
+    ram_page_hash = NULL;
+    ram_page_hash_size = 0;
+}
+
+/* Where the last content sent for each page can be found, saved in the
+   "ram-index" record so that the RAM can be loaded on demand: a segment
+   number and the offset of the page data in it, or one of the RAM_LOC_*
+   values and the byte value of a uniform page or a sector number.  */
+#define RAM_LOC_UNIFORM 0xffffffff
+#define RAM_LOC_DISK    0xffffff00 /* ORed with the drive index */
+
+typedef struct RamPageLoc {
+    uint32_t seg;
+    uint32_t offset;
+} RamPageLoc;
+
+static RamPageLoc *ram_page_loc;
+
+static void ram_page_loc_init(void)
+{
+    int i, n = phys_ram_size >> TARGET_PAGE_BITS;
+
+    qemu_free(ram_page_loc);
+    ram_page_loc = qemu_malloc(n * sizeof(RamPageLoc));
+    for (i = 0; ram_page_loc && i < n; i ++) {
+        ram_page_loc[i].seg = RAM_LOC_UNIFORM;
+        ram_page_loc[i].offset = 0;
+    }
+    ram_seg_total = 0;
+}
+
+static void ram_page_loc_set(ram_addr_t addr, uint32_t seg, uint32_t offset)
+{
+    if (ram_page_loc) {
+        ram_page_loc[addr >> TARGET_PAGE_BITS].seg = seg;
+        ram_page_loc[addr >> TARGET_PAGE_BITS].offset = offset;
+    }
+}
+
+/* Return whether pages may refer to the sectors of a drive.  They must
+   still hold the same data when the state is loaded, which is only
+   certain for read-only drives, and for the drives that savevm
+   snapshots together with the state once the VM is 'stopped'.  */
+static int ram_save_disk_usable(BlockDriverState *bs, int stopped)
+{
+    if (!bs)
+        return 0;
+    if (bdrv_is_read_only(bs))
+        return 1;
+    return stopped && ram_save_snapshot &&
+           bdrv_has_snapshot(bs) && bdrv_snapshot_supported(bs);
+}
+
+/* Index at most 'max_bytes' more of each drive that may be used by
+   ram_save_find_disk(), all of them if zero.  Return 1 once every
+   drive is indexed or cannot be.  */
+static int ram_save_index_disks(int64_t max_bytes)
+{
+    BlockDriverState *bs;
+    int i, done;
+
+    done = 1;
+    for (i = 0; i < nb_drives && i < 256; i ++) {
+        bs = drives_table[i].bdrv;
+        if (ram_save_disk_usable(bs, 1) &&
+            !bdrv_hash_index(bs, TARGET_PAGE_SIZE, max_bytes))
+            done = 0;
+    }
+    return done;
+}
+
+/* Look for the content of the page at 'addr' in the drives indexed by
+   ram_save_index_disks().  */
+static int ram_save_find_disk(const uint8_t *p, int64_t *sector_num)
+{
+    BlockDriverState *bs;
+    int i;
+
+    for (i = 0; i < nb_drives && i < 256; i ++) {
+        bs = drives_table[i].bdrv;
+        if (!ram_save_disk_usable(bs, !vm_running))
+            continue;
+        *sector_num = bdrv_hash_find(bs, p, TARGET_PAGE_SIZE);
+        if (*sector_num >= 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Send the page at 'addr', or a reference to a page with the same
+   content that the loader already has.  'end' is the end of the range
+   being sent: the pages of the range after 'addr' may have been
+   modified without being sent yet, but are no longer flagged dirty.  */
+static void ram_save_page(RamSegState *s, ram_addr_t addr, ram_addr_t end)
+{
+    uint8_t *p = phys_ram_base + addr;
+    uint8_t *buf;
+    ram_addr_t *entry, ref;
+    int64_t sector_num;
+    int index;
+
+    if (ram_page_is_uniform(p)) {
+        buf = ram_put_header(s, addr, RAM_SAVE_FLAG_COMPRESS, 1);
+        buf[0] = p[0];
+        ram_page_loc_set(addr, RAM_LOC_UNIFORM, p[0]);
+        return;
+    }
+
+    entry = NULL;
+    if (ram_page_hash_size) {
+        entry = &ram_page_hash[ram_page_hash_key(p)];
+        ref = *entry - 1;
+        if (*entry && ref != addr && (ref < addr || ref >= end) &&
+            !cpu_physical_memory_get_dirty(ref, MIGRATION_DIRTY_FLAG) &&
+            !memcmp(phys_ram_base + ref, p, TARGET_PAGE_SIZE)) {
+            buf = ram_put_header(s, addr, RAM_SAVE_FLAG_PAGE, 4);
+            cpu_to_be32wu((uint32_t *)buf, ref);
+            if (ram_page_loc)
+                ram_page_loc[addr >> TARGET_PAGE_BITS] =
+                    ram_page_loc[ref >> TARGET_PAGE_BITS];
+            return;
+        }
+    }
+
+    if (tight_savevm_enabled) {
+        index = ram_save_find_disk(p, &sector_num);
+        if (index >= 0 && sector_num <= 0xffffffff) {
+            buf = ram_put_header(s, addr, RAM_SAVE_FLAG_DISK, 9);
+            buf[0] = index;
+            cpu_to_be32wu((uint32_t *)(buf + 1), sector_num >> 32);
+            cpu_to_be32wu((uint32_t *)(buf + 5), sector_num);
+            ram_page_loc_set(addr, RAM_LOC_DISK | index, sector_num);
+            return;
+        }
+    }
+
+    buf = ram_put_header(s, addr, RAM_SAVE_FLAG_FULL, TARGET_PAGE_SIZE);
+    memcpy(buf, p, TARGET_PAGE_SIZE);
+    ram_page_loc_set(addr, ram_seg_total + s->count, s->len - TARGET_PAGE_SIZE);
+    if (entry)
+        *entry = addr + 1;
+}
+
+/* Send the pages of [start, end) dirtied since they were last sent and
+   return the number of bytes sent.  */
+static int ram_save_range(RamSegState *s, ram_addr_t start,
+                          ram_addr_t end)
+{
+    static uint8_t dirty[RAM_SAVE_CHUNK >> TARGET_PAGE_BITS];
+    ram_addr_t addr;
+    int i, n, sent;
+
+    n = (end - start) >> TARGET_PAGE_BITS;
+    for (i = 0; i < n; i ++)
+        dirty[i] = cpu_physical_memory_get_dirty(start +
+                        (i << TARGET_PAGE_BITS), MIGRATION_DIRTY_FLAG);
+    /* pages written to from now on will be sent again */
+    cpu_physical_memory_reset_dirty(start, end, MIGRATION_DIRTY_FLAG);
+
+    sent = 0;
+    for (i = 0, addr = start; i < n; i ++, addr += TARGET_PAGE_SIZE)
+        if (dirty[i]) {
+            ram_save_page(s, addr, end);
+            sent += TARGET_PAGE_SIZE;
+        }
+    return sent;
+}
+
+static int ram_save_live(QEMUFile *f, int stage, void *opaque)
+{
+    RamSegState s1, *s = &s1;
+    ram_addr_t addr, end;
+    int i, ret;
+
+    if (ram_seg_open(s, f) < 0)
+        return -ENOMEM;
+
+    ret = 0;
+    if (ram_save_external) {
+        /* written by do_migrate_finish() */
+        if (stage == QEMU_VM_STAGE_START)
+            ram_put_header(s, phys_ram_size,
+                           RAM_SAVE_FLAG_MEM_SIZE | RAM_SAVE_FLAG_EXTERNAL, 0);
+        ret = 1;
+        stage = 0;
+    }
+    switch (stage) {
+    case QEMU_VM_STAGE_START:
+        for (i = 0; i < phys_ram_size >> TARGET_PAGE_BITS; i ++)
+            phys_ram_dirty[i] |= MIGRATION_DIRTY_FLAG;
+        ram_save_addr = 0;
+        ram_save_delta = 0;
+        ram_save_passes = 0;
+        ram_page_hash_init();
+        ram_page_loc_init();
+        ram_put_header(s, phys_ram_size, RAM_SAVE_FLAG_MEM_SIZE, 0);
+        ram_save_indexed = 1;
+        if (tight_savevm_enabled) {
+            /* the writable drives changed since they were last indexed */
+            for (i = 0; i < nb_drives; i ++)
+                if (drives_table[i].bdrv &&
+                    !bdrv_is_read_only(drives_table[i].bdrv))
+                    bdrv_hash_reset(drives_table[i].bdrv);
+            /* the drives are indexed a slice per iteration, but a
+               stopped VM goes straight to the last stage */
+            ram_save_indexed = 0;
+            if (!vm_running)
+                ram_save_indexed = ram_save_index_disks(0);
+        }
+        break;
+
+    case QEMU_VM_STAGE_PART:
+        end = MIN(ram_save_addr + RAM_SAVE_CHUNK, phys_ram_size);
+        ram_save_delta += ram_save_range(s, ram_save_addr, end);
+        ram_save_addr = end;
+        if (!ram_save_indexed)
+            ram_save_indexed = ram_save_index_disks(RAM_SAVE_INDEX_CHUNK);
+        if (ram_save_addr >= phys_ram_size) {
+            ram_save_passes ++;
+            ret = ram_save_passes >= RAM_SAVE_MAX_PASSES ||
+                    (ram_save_delta < RAM_SAVE_MAX_DELTA && ram_save_indexed);
+            ram_save_addr = 0;
+            ram_save_delta = 0;
+        }
+        break;
+
+    case QEMU_VM_STAGE_END:
+        for (addr = 0; addr < phys_ram_size; addr += RAM_SAVE_CHUNK)
+            ram_save_range(s, addr, MIN(addr + RAM_SAVE_CHUNK, phys_ram_size));
+        ram_page_hash_fini();
+        ret = 1;
+        break;
+    }
+
+    if (ram_seg_close(s) < 0)
+        return -EIO;
+    return ret;
+}
+
+/* Return the size of the data of an entry, -1 if the flags are
+   invalid.  */
+static int ram_entry_size(int flags)
+{
+    if (flags & RAM_SAVE_FLAG_COMPRESS)
+        return 1;
+    if (flags & RAM_SAVE_FLAG_PAGE)
+        return 4;
+    if (flags & RAM_SAVE_FLAG_DISK)
+        return 9;
+    if (flags & RAM_SAVE_FLAG_FULL)
+        return TARGET_PAGE_SIZE;
+    return -1;
+}
+
+static int ram_load_entry(ram_addr_t addr, int flags, const uint8_t *buf)
+{
+    ram_addr_t ref;
+    int64_t sector_num;
+    int i;
+
+    if (addr >= phys_ram_size)
         return -1;
+    if (flags & RAM_SAVE_FLAG_COMPRESS) {
+        memset(phys_ram_base + addr, buf[0], TARGET_PAGE_SIZE);
+    } else if (flags & RAM_SAVE_FLAG_PAGE) {
+        ref = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+        if (ref >= phys_ram_size || (ref & ~TARGET_PAGE_MASK))
+            return -1;
+        memcpy(phys_ram_base + addr, phys_ram_base + ref, TARGET_PAGE_SIZE);
+    } else if (flags & RAM_SAVE_FLAG_DISK) {
+        sector_num = 0;
+        for (i = 1; i < 9; i ++)
+            sector_num = (sector_num << 8) | buf[i];
+        if (buf[0] >= nb_drives ||
+            bdrv_read(drives_table[buf[0]].bdrv, sector_num,
+                      phys_ram_base + addr, TARGET_PAGE_SIZE / 512) < 0) {
+            fprintf(stderr, "Error while reading sector %d:%" PRId64 "\n",
+                    buf[0], sector_num);
+            return -1;
+        }
+    } else {
+        memcpy(phys_ram_base + addr, buf, TARGET_PAGE_SIZE);
+    }
     return 0;
 }
 
-static int ram_decompress_buf(RamDecompressState *s, uint8_t *buf, int len)
+static int ram_load_v3(QEMUFile *f, void *opaque)
 {
-    int ret, clen;
+    RamDecompressState s1, *s = &s1;
+    static uint8_t buf[TARGET_PAGE_SIZE];
+    ram_addr_t addr;
+    int flags, len;
 
-    s->zstream.avail_out = len;
-    s->zstream.next_out = buf;
-    while (s->zstream.avail_out > 0) {
-        if (s->zstream.avail_in == 0) {
-            if (qemu_get_be16(s->f) != RAM_CBLOCK_MAGIC)
+    if (ram_decompress_open(s, f) < 0)
+        return -EINVAL;
+    for (;;) {
+        if (ram_decompress_buf(s, buf, 4) < 0)
+            goto error;
+        addr = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+        flags = addr & ~TARGET_PAGE_MASK;
+        addr &= TARGET_PAGE_MASK;
+
+        if (flags & RAM_SAVE_FLAG_EOS)
+            break;
+        if (flags & RAM_SAVE_FLAG_MEM_SIZE) {
+            if (addr != phys_ram_size)
+                goto error;
+            continue;
+        }
+        len = ram_entry_size(flags);
+        if (len < 0 || ram_decompress_buf(s, buf, len) < 0 ||
+            ram_load_entry(addr, flags, buf) < 0)
+            goto error;
+    }
+    ram_decompress_close(s);
+    return 0;
+
+ error:
+    fprintf(stderr, "Error while loading RAM state\n");
+    ram_decompress_close(s);
+    return -EINVAL;
+}
+
+static int ram_load_segment(const uint8_t *p, int len)
+{
+    const uint8_t *end = p + len;
+    ram_addr_t addr;
+    int flags, size;
+
+    while (p < end) {
+        if (end - p < 4)
+            return -1;
+        addr = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        flags = addr & ~TARGET_PAGE_MASK;
+        addr &= TARGET_PAGE_MASK;
+        p += 4;
+        if (flags & RAM_SAVE_FLAG_MEM_SIZE) {
+            if (addr != phys_ram_size)
                 return -1;
-            clen = qemu_get_be16(s->f);
-            if (clen > IOBUF_SIZE)
+            if ((flags & RAM_SAVE_FLAG_EXTERNAL) && !shared_ram) {
+                fprintf(stderr, "The RAM of this VM state is in a separate "
+                        "file, use -shared-ram\n");
                 return -1;
-            qemu_get_buffer(s->f, s->buf, clen);
-            s->zstream.avail_in = clen;
-            s->zstream.next_in = s->buf;
+            }
+            continue;
         }
-        ret = inflate(&s->zstream, Z_PARTIAL_FLUSH);
-        if (ret != Z_OK && ret != Z_STREAM_END) {
+        size = ram_entry_size(flags);
+        if (size < 0 || end - p < size || ram_load_entry(addr, flags, p) < 0)
             return -1;
+        p += size;
+    }
+    return 0;
+}
+
+/* Read the segments of a record in batches, decompress each batch in
+   parallel and apply its segments in order, since an entry may refer
+   to a page loaded by an earlier one.  */
+static int ram_load_v4(QEMUFile *f, void *opaque)
+{
+    RamSegment *seg;
+    int i, count, eor;
+
+    if (ram_seg_alloc_buffers() < 0)
+        return -ENOMEM;
+    eor = 0;
+    while (!eor) {
+        for (count = 0; count < RAM_SEG_BATCH; count ++) {
+            seg = &ram_segs[count];
+            seg->len = qemu_get_be32(f);
+            if (!seg->len) {
+                eor = 1;
+                break;
+            }
+            seg->clen = qemu_get_be32(f);
+            if (seg->len < 0 || seg->len > RAM_SEG_SIZE ||
+                seg->clen < 0 || seg->clen > compressBound(RAM_SEG_SIZE))
+                goto error;
+            qemu_get_buffer(f, seg->cdata, seg->clen);
         }
+        ram_segs_decompress = 1;
+        ram_seg_run(count);
+        for (i = 0; i < count; i ++)
+            if (ram_segs[i].ret < 0 ||
+                ram_load_segment(ram_segs[i].data, ram_segs[i].len) < 0)
+                goto error;
     }
     return 0;
+
+ error:
+    fprintf(stderr, "Error while loading RAM state\n");
+    return -EINVAL;
 }
 
-static void ram_decompress_close(RamDecompressState *s)
+/* The "ram-index" record follows the last RAM record and tells where
+   the last content of each page is, so that the RAM can be loaded on
+   demand.  It holds the be32 sizes before and after compression of a
+   zlib compressed table: the be32 number of pages and their RamPageLoc,
+   then the be32 number of segments and their be64 offsets.  */
+static void ram_index_save(QEMUFile *f, void *opaque)
+{
+    int i, n = phys_ram_size >> TARGET_PAGE_BITS;
+    uint8_t *buf, *cbuf, *p;
+    uLongf clen;
+    int len;
+
+    len = 4 + n * 8 + 4 + ram_seg_total * 8;
+    buf = qemu_malloc(len);
+    clen = compressBound(len);
+    cbuf = qemu_malloc(clen);
+    /* with the RAM in a separate file the loader must see the RAM
+       record, and refuse it without -shared-ram */
+    if (ram_save_external || !ram_page_loc || !buf || !cbuf)
+        goto fail;
+
+    p = buf;
+    cpu_to_be32wu((uint32_t *)p, n);
+    p += 4;
+    for (i = 0; i < n; i ++, p += 8) {
+        cpu_to_be32wu((uint32_t *)p, ram_page_loc[i].seg);
+        cpu_to_be32wu((uint32_t *)(p + 4), ram_page_loc[i].offset);
+    }
+    cpu_to_be32wu((uint32_t *)p, ram_seg_total);
+    p += 4;
+    for (i = 0; i < ram_seg_total; i ++, p += 8) {
+        cpu_to_be32wu((uint32_t *)p, ram_seg_offsets[i] >> 32);
+        cpu_to_be32wu((uint32_t *)(p + 4), ram_seg_offsets[i]);
+    }
+    if (compress2(cbuf, &clen, buf, len, Z_BEST_SPEED) != Z_OK)
+        goto fail;
+    qemu_put_be32(f, len);
+    qemu_put_be32(f, clen);
+    qemu_put_buffer(f, cbuf, clen);
+    goto done;
+
+ fail:
+    /* no index, the state can only be loaded in full */
+    qemu_put_be32(f, 0);
+ done:
+    qemu_free(buf);
+    qemu_free(cbuf);
+    qemu_free(ram_page_loc);
+    ram_page_loc = NULL;
+}
+
+#ifndef _WIN32
+/* Lazy loading: when ram_lazy_file is set while the state is loaded,
+   the RAM records are skipped.  Once the index is read, the pages found
+   in the drives are loaded, the compressed segments that hold the other
+   pages are read in memory and the guest RAM is protected.  The first
+   access to a page then faults, and the SIGSEGV handler fills the page.
+
+   The handler can interrupt any code, so it must not use the block
+   layer, stdio or malloc: it only decompresses segments already in
+   memory, with a zlib stream allocated from a buffer of its own.  */
+#define RAM_LAZY_CACHE 4 /* decompressed segments kept */
+#define RAM_LAZY_ZMEM  (64 * 1024) /* zlib state and window */
+
+typedef struct RamLazyState {
+    int nb_pages;
+    RamPageLoc *loc;
+    int nb_segs;
+    int64_t *seg_offsets;
+    RamSegment *segs;   /* cdata is NULL for the segments not needed */
+    uint8_t *loaded;    /* one byte per host page */
+    struct sigaction old_action;
+    z_stream zs;
+    uint8_t *zmem;
+    int zmem_used;
+    RamSegment cache[RAM_LAZY_CACHE];
+    int cache_seg[RAM_LAZY_CACHE];
+    int cache_next;
+} RamLazyState;
+
+static QEMUFile *ram_lazy_file;
+static RamLazyState *ram_lazy;
+
+static voidpf ram_lazy_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    RamLazyState *s = opaque;
+    int len = (items * size + 15) & ~15;
+    uint8_t *p;
+
+    if (s->zmem_used + len > RAM_LAZY_ZMEM)
+        return Z_NULL;
+    p = s->zmem + s->zmem_used;
+    s->zmem_used += len;
+    return p;
+}
+
+static void ram_lazy_zfree(voidpf opaque, voidpf address)
 {
-    inflateEnd(&s->zstream);
 }
 
-static void ram_save(QEMUFile *f, void *opaque)
+static RamSegment *ram_lazy_get_segment(RamLazyState *s, uint32_t n)
 {
+    RamSegment *seg;
     int i;
-    RamCompressState s1, *s = &s1;
-    uint8_t buf[10];
 
-    qemu_put_be32(f, phys_ram_size);
-    if (ram_compress_open(s, f) < 0)
+    for (i = 0; i < RAM_LAZY_CACHE; i ++)
+        if (s->cache_seg[i] == n)
+            return &s->cache[i];
+
+    i = s->cache_next;
+    s->cache_next = (i + 1) % RAM_LAZY_CACHE;
+    seg = &s->cache[i];
+    s->cache_seg[i] = -1;
+    if (inflateReset(&s->zs) != Z_OK)
+        return NULL;
+    s->zs.next_in = s->segs[n].cdata;
+    s->zs.avail_in = s->segs[n].clen;
+    s->zs.next_out = seg->data;
+    s->zs.avail_out = s->segs[n].len;
+    if (inflate(&s->zs, Z_FINISH) != Z_STREAM_END || s->zs.avail_out)
+        return NULL;
+    seg->len = s->segs[n].len;
+    s->cache_seg[i] = n;
+    return seg;
+}
+
+static void ram_lazy_fill_page(RamLazyState *s, ram_addr_t addr)
+{
+    static const char msg[] = "qemu: could not load a RAM page\n";
+    RamPageLoc *loc = &s->loc[addr >> TARGET_PAGE_BITS];
+    RamSegment *seg;
+
+    if (loc->seg == RAM_LOC_UNIFORM) {
+        memset(phys_ram_base + addr, loc->offset, TARGET_PAGE_SIZE);
+    } else if ((loc->seg & RAM_LOC_DISK) == RAM_LOC_DISK) {
+        /* loaded by ram_index_load() */
+    } else {
+        seg = ram_lazy_get_segment(s, loc->seg);
+        if (!seg) {
+            write(2, msg, sizeof(msg) - 1);
+            _exit(1);
+        }
+        memcpy(phys_ram_base + addr, seg->data + loc->offset,
+               TARGET_PAGE_SIZE);
+    }
+}
+
+static void ram_lazy_fill(RamLazyState *s, ram_addr_t addr)
+{
+    int i = addr / qemu_host_page_size;
+
+    if (s->loaded[i])
         return;
-    for(i = 0; i < phys_ram_size; i+= BDRV_HASH_BLOCK_SIZE) {
-#if 0
-        if (tight_savevm_enabled) {
-            int64_t sector_num;
-            int j;
-
-            /* find if the memory block is available on a virtual
-               block device */
-            sector_num = -1;
-            for(j = 0; j < nb_drives; j++) {
-                sector_num = bdrv_hash_find(drives_table[j].bdrv,
-                                            phys_ram_base + i,
-					    BDRV_HASH_BLOCK_SIZE);
-                if (sector_num >= 0)
-                    break;
-            }
-            if (j == nb_drives)
-                goto normal_compress;
-            buf[0] = 1;
-            buf[1] = j;
-            cpu_to_be64wu((uint64_t *)(buf + 2), sector_num);
-            ram_compress_buf(s, buf, 10);
-        } else
-#endif
-        {
-            //        normal_compress:
-            buf[0] = 0;
-            ram_compress_buf(s, buf, 1);
-            ram_compress_buf(s, phys_ram_base + i, BDRV_HASH_BLOCK_SIZE);
+    mprotect(phys_ram_base + addr, qemu_host_page_size,
+             PROT_READ | PROT_WRITE);
+    for (; addr < (i + 1) * qemu_host_page_size; addr += TARGET_PAGE_SIZE)
+        ram_lazy_fill_page(s, addr);
+    s->loaded[i] = 1;
+}
+
+static void ram_lazy_fault(int sig, siginfo_t *info, void *puc)
+{
+    uint8_t *addr = info->si_addr;
+    RamLazyState *s = ram_lazy;
+
+    if (!s || addr < phys_ram_base || addr >= phys_ram_base + phys_ram_size) {
+        /* not ours, fault again with the previous handler */
+        if (s)
+            sigaction(SIGSEGV, &s->old_action, NULL);
+        else
+            signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    ram_lazy_fill(s, (addr - phys_ram_base) & qemu_host_page_mask);
+}
+
+static void ram_lazy_free(RamLazyState *s)
+{
+    int i;
+
+    for (i = 0; i < RAM_LAZY_CACHE; i ++)
+        qemu_free(s->cache[i].data);
+    if (s->segs)
+        for (i = 0; i < s->nb_segs; i ++)
+            qemu_free(s->segs[i].cdata);
+    if (s->zmem)
+        inflateEnd(&s->zs);
+    qemu_free(s->zmem);
+    qemu_free(s->segs);
+    qemu_free(s->loc);
+    qemu_free(s->seg_offsets);
+    qemu_free(s->loaded);
+    qemu_free(s);
+}
+
+/* Load the pages not accessed yet and stop lazy loading.  */
+static void ram_lazy_finish(void)
+{
+    RamLazyState *s = ram_lazy;
+    ram_addr_t addr;
+
+    if (!s)
+        return;
+    for (addr = 0; addr < phys_ram_size; addr += qemu_host_page_size)
+        ram_lazy_fill(s, addr);
+    sigaction(SIGSEGV, &s->old_action, NULL);
+    ram_lazy = NULL;
+    ram_lazy_free(s);
+}
+
+static int ram_index_parse(RamLazyState *s, const uint8_t *p, int len)
+{
+    const uint8_t *end = p + len;
+    int i;
+
+    if (len < 4)
+        return -1;
+    s->nb_pages = be32_to_cpu(*(uint32_t *)p);
+    p += 4;
+    if (s->nb_pages != phys_ram_size >> TARGET_PAGE_BITS ||
+        end - p < s->nb_pages * 8 + 4)
+        return -1;
+    s->loc = qemu_malloc(s->nb_pages * sizeof(RamPageLoc));
+    if (!s->loc)
+        return -1;
+    for (i = 0; i < s->nb_pages; i ++, p += 8) {
+        s->loc[i].seg = be32_to_cpu(*(uint32_t *)p);
+        s->loc[i].offset = be32_to_cpu(*(uint32_t *)(p + 4));
+    }
+    s->nb_segs = be32_to_cpu(*(uint32_t *)p);
+    p += 4;
+    if (s->nb_segs < 0 || (end - p) / 8 < s->nb_segs)
+        return -1;
+    s->seg_offsets = qemu_malloc(s->nb_segs * sizeof(int64_t) + 1);
+    if (!s->seg_offsets)
+        return -1;
+    for (i = 0; i < s->nb_segs; i ++, p += 8)
+        s->seg_offsets[i] = ((int64_t)be32_to_cpu(*(uint32_t *)p) << 32) |
+            be32_to_cpu(*(uint32_t *)(p + 4));
+    return 0;
+}
+
+/* Read what the fault handler cannot: the pages found in the drives go
+   straight to the RAM, since the guest may write to their sectors once
+   it runs, and the segments that hold the last content of the other
+   pages are kept in memory, still compressed.  */
+static int ram_lazy_read(RamLazyState *s, QEMUFile *f)
+{
+    RamPageLoc *loc;
+    RamSegment *seg;
+    int i, index;
+
+    for (i = 0; i < s->nb_pages; i ++) {
+        loc = &s->loc[i];
+        if (loc->seg == RAM_LOC_UNIFORM)
+            continue;
+        if ((loc->seg & RAM_LOC_DISK) == RAM_LOC_DISK) {
+            index = loc->seg & 0xff;
+            if (index >= nb_drives ||
+                bdrv_read(drives_table[index].bdrv, loc->offset,
+                          phys_ram_base + ((ram_addr_t)i << TARGET_PAGE_BITS),
+                          TARGET_PAGE_SIZE / 512) < 0)
+                return -1;
+            continue;
         }
+        if (loc->seg >= s->nb_segs)
+            return -1;
+        seg = &s->segs[loc->seg];
+        if (!seg->cdata) {
+            qemu_fseek(f, s->seg_offsets[loc->seg], SEEK_SET);
+            seg->len = qemu_get_be32(f);
+            seg->clen = qemu_get_be32(f);
+            if (seg->len <= 0 || seg->len > RAM_SEG_SIZE ||
+                seg->clen < 0 || seg->clen > compressBound(RAM_SEG_SIZE))
+                return -1;
+            seg->cdata = qemu_malloc(seg->clen + 1);
+            if (!seg->cdata ||
+                qemu_get_buffer(f, seg->cdata, seg->clen) != seg->clen)
+                return -1;
+        }
+        if ((int64_t)loc->offset + TARGET_PAGE_SIZE > seg->len)
+            return -1;
+    }
+    return 0;
+}
+
+static int ram_index_load(QEMUFile *f, void *opaque, int version_id)
+{
+    RamLazyState *s;
+    struct sigaction act;
+    uint8_t *buf, *cbuf;
+    uLongf len;
+    int clen, i;
+
+    if (version_id != 1)
+        return -EINVAL;
+    if (!ram_lazy_file || ram_lazy)
+        return 0;
+    len = qemu_get_be32(f);
+    if (!len)
+        return 0; /* no index, see qemu_loadvm_state_lazy() */
+    clen = qemu_get_be32(f);
+    if (clen < 0)
+        return -EINVAL;
+
+    s = qemu_mallocz(sizeof(RamLazyState));
+    buf = qemu_malloc(len);
+    cbuf = qemu_malloc(clen);
+    if (!s || !buf || !cbuf)
+        goto fail;
+    qemu_get_buffer(f, cbuf, clen);
+    if (uncompress(buf, &len, cbuf, clen) != Z_OK ||
+        ram_index_parse(s, buf, len) < 0)
+        goto fail;
+    s->loaded = qemu_mallocz(phys_ram_size / qemu_host_page_size);
+    if (!s->loaded)
+        goto fail;
+    for (i = 0; i < RAM_LAZY_CACHE; i ++) {
+        s->cache_seg[i] = -1;
+        s->cache[i].data = qemu_malloc(RAM_SEG_SIZE);
+        if (!s->cache[i].data)
+            goto fail;
+    }
+    s->segs = qemu_mallocz(s->nb_segs * sizeof(RamSegment) + 1);
+    s->zmem = qemu_malloc(RAM_LAZY_ZMEM);
+    if (!s->segs || !s->zmem)
+        goto fail;
+    s->zs.zalloc = ram_lazy_zalloc;
+    s->zs.zfree = ram_lazy_zfree;
+    s->zs.opaque = s;
+    if (inflateInit(&s->zs) != Z_OK)
+        goto fail;
+    if (ram_lazy_read(s, ram_lazy_file) < 0)
+        goto fail;
+    /* everything else comes from memory */
+    qemu_fclose(ram_lazy_file);
+
+    memset(&act, 0, sizeof(act));
+    sigfillset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO;
+    act.sa_sigaction = ram_lazy_fault;
+    sigaction(SIGSEGV, &act, &s->old_action);
+    ram_lazy = s;
+    mprotect(phys_ram_base, phys_ram_size, PROT_NONE);
+
+    qemu_free(buf);
+    qemu_free(cbuf);
+    return 0;
+
+ fail:
+    /* not fatal, qemu_loadvm_state_lazy() loads the state in full */
+    qemu_free(buf);
+    qemu_free(cbuf);
+    if (s)
+        ram_lazy_free(s);
+    return 0;
+}
+
+/* Load the VM state from f and leave the RAM to be loaded on demand
+   from lazy_f, which is closed if the state cannot be loaded that
+   way.  */
+static int qemu_loadvm_state_lazy(QEMUFile *f, QEMUFile *lazy_f)
+{
+    int ret;
+
+    ram_lazy_finish();
+    if (!lazy_f)
+        return qemu_loadvm_state(f);
+
+    ram_lazy_file = lazy_f;
+    ret = qemu_loadvm_state(f);
+    ram_lazy_file = NULL;
+    if (!ram_lazy) {
+        /* lazy_f is only closed by ram_index_load() once it is used */
+        qemu_fclose(lazy_f);
+        if (ret < 0)
+            return ret;
+        /* the state has no index, load it again in full */
+        qemu_fseek(f, 0, SEEK_SET);
+        return qemu_loadvm_state(f);
     }
-    ram_compress_close(s);
+    if (ret < 0)
+        ram_lazy_finish();
+    return ret;
+}
+#else
+static int ram_index_load(QEMUFile *f, void *opaque, int version_id)
+{
+    return 0;
+}
+
+static void ram_lazy_finish(void)
+{
 }
 
+static int qemu_loadvm_state_lazy(QEMUFile *f, QEMUFile *lazy_f)
+{
+    if (lazy_f)
+        qemu_fclose(lazy_f);
+    return qemu_loadvm_state(f);
+}
+#endif
+
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     RamDecompressState s1, *s = &s1;
@@ -7265,6 +8667,16 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
     if (version_id == 1)
         return ram_load_v1(f, opaque);
+    if (version_id == 3)
+        return ram_load_v3(f, opaque);
+    if (version_id == 4) {
+#ifndef _WIN32
+        /* loaded on demand through the "ram-index" record */
+        if (ram_lazy_file)
+            return 0;
+#endif
+        return ram_load_v4(f, opaque);
+    }
     if (version_id != 2)
         return -EINVAL;
     if (qemu_get_be32(f) != phys_ram_size)
@@ -7801,7 +9213,7 @@ static void help(int exitcode)
            "-cdrom file     use 'file' as IDE cdrom image (cdrom is ide1 master)\n"
 	   "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][index=i]\n"
            "       [,cyls=c,heads=h,secs=s[,trans=t]][snapshot=on|off]"
-           "       [,cache=on|off]\n"
+           "       [,cache=on|off|writeback][,readahead=kb]\n"
 	   "                use 'file' as a drive image\n"
            "-mtdblock file  use 'file' as on-board Flash memory image\n"
            "-sd file        use 'file' as SecureDigital card image\n"
@@ -7888,6 +9300,7 @@ static void help(int exitcode)
            "-monitor dev    redirect the monitor to char device 'dev'\n"
            "-serial dev     redirect the serial port to char device 'dev'\n"
            "-parallel dev   redirect the parallel port to char device 'dev'\n"
+           "-serial-pacing  transfer serial data at the emulated baud rate\n"
            "-pidfile file   Write PID to 'file'\n"
            "-S              freeze CPU at startup (use 'c' to start execution)\n"
            "-s              wait gdb connection to port\n"
@@ -7907,6 +9320,14 @@ static void help(int exitcode)
 #endif
            "-no-reboot      exit instead of rebooting\n"
            "-loadvm file    start right away with a saved state (loadvm in monitor)\n"
+           "-incoming file  start right away with the state saved in 'file' by 'migrate'\n"
+           "-tight-savevm   save RAM pages also found on a drive as references to it\n"
+#ifndef _WIN32
+           "-lazy-loadvm    load the RAM of a saved state on first access\n"
+           "-shared-ram file\n"
+           "                map the RAM copy-on-write from 'file' written by 'migrate'\n"
+           "                (use with -incoming)\n"
+#endif
 	   "-vnc display    start a VNC server on display\n"
 #ifndef _WIN32
 	   "-daemonize      daemonize QEMU after initializing\n"
@@ -7996,6 +9417,10 @@ enum {
     QEMU_OPTION_serial,
     QEMU_OPTION_parallel,
     QEMU_OPTION_loadvm,
+    QEMU_OPTION_incoming,
+    QEMU_OPTION_tight_savevm,
+    QEMU_OPTION_lazy_loadvm,
+    QEMU_OPTION_shared_ram,
     QEMU_OPTION_full_screen,
     QEMU_OPTION_no_frame,
     QEMU_OPTION_alt_grab,
@@ -8015,6 +9440,7 @@ enum {
     QEMU_OPTION_daemonize,
     QEMU_OPTION_option_rom,
     QEMU_OPTION_semihosting,
+    QEMU_OPTION_serial_pacing,
     QEMU_OPTION_name,
     QEMU_OPTION_prom_env,
     QEMU_OPTION_old_param,
@@ -8095,6 +9521,12 @@ const QEMUOption qemu_options[] = {
     { "serial", HAS_ARG, QEMU_OPTION_serial },
     { "parallel", HAS_ARG, QEMU_OPTION_parallel },
     { "loadvm", HAS_ARG, QEMU_OPTION_loadvm },
+    { "incoming", HAS_ARG, QEMU_OPTION_incoming },
+    { "tight-savevm", 0, QEMU_OPTION_tight_savevm },
+#ifndef _WIN32
+    { "lazy-loadvm", 0, QEMU_OPTION_lazy_loadvm },
+    { "shared-ram", HAS_ARG, QEMU_OPTION_shared_ram },
+#endif
     { "full-screen", 0, QEMU_OPTION_full_screen },
 #ifdef CONFIG_SDL
     { "no-frame", 0, QEMU_OPTION_no_frame },
@@ -8120,6 +9552,7 @@ const QEMUOption qemu_options[] = {
 #if defined(TARGET_ARM) || defined(TARGET_M68K)
     { "semihosting", 0, QEMU_OPTION_semihosting },
 #endif
+    { "serial-pacing", 0, QEMU_OPTION_serial_pacing },
     { "name", HAS_ARG, QEMU_OPTION_name },
 #if defined(TARGET_SPARC)
     { "prom-env", HAS_ARG, QEMU_OPTION_prom_env },
@@ -8394,6 +9827,7 @@ int main(int argc, char **argv)
     char parallel_devices[MAX_PARALLEL_PORTS][128];
     int parallel_device_index;
     const char *loadvm = NULL;
+    const char *incoming = NULL;
     QEMUMachine *machine;
     const char *cpu_model;
     char usb_devices[MAX_USB_CMDLINE][128];
@@ -8840,6 +10274,18 @@ int main(int argc, char **argv)
 	    case QEMU_OPTION_loadvm:
 		loadvm = optarg;
 		break;
+            case QEMU_OPTION_incoming:
+                incoming = optarg;
+                break;
+            case QEMU_OPTION_tight_savevm:
+                tight_savevm_enabled = 1;
+                break;
+            case QEMU_OPTION_lazy_loadvm:
+                lazy_loadvm = 1;
+                break;
+            case QEMU_OPTION_shared_ram:
+                shared_ram = optarg;
+                break;
             case QEMU_OPTION_full_screen:
                 full_screen = 1;
                 break;
@@ -8931,6 +10377,9 @@ int main(int argc, char **argv)
             case QEMU_OPTION_semihosting:
                 semihosting_enabled = 1;
                 break;
+            case QEMU_OPTION_serial_pacing:
+                serial_pacing = 1;
+                break;
             case QEMU_OPTION_name:
                 qemu_name = optarg;
                 break;
@@ -9137,6 +10586,15 @@ int main(int argc, char **argv)
     /* init the memory */
     phys_ram_size = ram_size + vga_ram_size + MAX_BIOS_SIZE;
 
+#ifndef _WIN32
+    if (shared_ram) {
+        if (!incoming) {
+            fprintf(stderr, "qemu: -shared-ram requires -incoming\n");
+            exit(1);
+        }
+        phys_ram_base = ram_map_shared(shared_ram, NULL);
+    } else
+#endif
     phys_ram_base = qemu_vmalloc(phys_ram_size);
     if (!phys_ram_base) {
         fprintf(stderr, "Could not allocate physical memory\n");
@@ -9144,6 +10602,7 @@ int main(int argc, char **argv)
     }
 
     bdrv_init();
+    atexit(bdrv_flush_exit);
 
     /* we always create the cdrom drive, even if no disk is there */
 
@@ -9167,7 +10626,8 @@ int main(int argc, char **argv)
 	    exit(1);
 
     register_savevm("timer", 0, 2, timer_save, timer_load, NULL);
-    register_savevm("ram", 0, 2, ram_save, ram_load, NULL);
+    register_savevm_live("ram", 0, 4, ram_save_live, NULL, ram_load, NULL);
+    register_savevm("ram-index", 0, 1, ram_index_save, ram_index_load, NULL);
 
     init_ioports();
 
@@ -9281,6 +10741,22 @@ int main(int argc, char **argv)
     if (loadvm)
         do_loadvm(loadvm);
 
+    if (incoming) {
+        QEMUFile *f = qemu_fopen(incoming, "rb");
+#ifndef _WIN32
+        /* drop what the board initialisation wrote to the RAM */
+        if (shared_ram)
+            ram_map_shared(shared_ram, phys_ram_base);
+#endif
+        if (!f || qemu_loadvm_state_lazy(f, lazy_loadvm && !shared_ram ?
+                        qemu_fopen(incoming, "rb") : NULL) < 0) {
+            fprintf(stderr, "qemu: could not load VM state from '%s'\n",
+                    incoming);
+            exit(1);
+        }
+        qemu_fclose(f);
+    }
+
     {
         /* XXX: simplify init */
         read_passwords();
@@ -28,8 +28,21 @@
 #include "sysemu.h"
 #include "qemu_socket.h"
 #include "qemu-timer.h"
+#include "hw/pixel_ops.h"
+
+#include <zlib.h>
+#if CONFIG_VNC_JPEG
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
 
 #define VNC_REFRESH_INTERVAL (1000 / 30)
+#define VNC_REFRESH_INTERVAL_MAX 300	/* scan period while static */
+
+/* Updates are not encoded for a client that has not sent the previous
+   one yet, so its output holds at most about a frame.  A client whose
+   output still grows past this is dropped. */
+#define VNC_OUTPUT_MAX (VNC_MAX_WIDTH * VNC_MAX_HEIGHT * 4 * 2)
 
 #include "vnc_keysym.h"
 #include "keymaps.c"
@@ -81,6 +94,25 @@ typedef void VncSendHextileTile(VncState *vs,
 
 #define VNC_AUTH_CHALLENGE_SIZE 16
 
+/* zlib streams kept for the lifetime of a connection */
+#define VNC_ZS_ZLIB	0
+#define VNC_ZS_ZRLE	1
+#define VNC_ZS_TIGHT	2	/* Tight uses four streams */
+#define VNC_ZSTREAMS	6
+
+#define VNC_TIGHT_MAX_PIXELS	65536	/* larger rectangles are split */
+#define VNC_TIGHT_MIN_TO_COMPRESS 12
+#define VNC_TIGHT_JPEG_MIN	1024	/* smallest rectangle sent as JPEG */
+
+#define VNC_PALETTE_HASH 1024
+
+typedef struct VncPalette
+{
+    int size;
+    uint32_t color[256];
+    int16_t slot[VNC_PALETTE_HASH]; /* colour index plus one, 0 if free */
+} VncPalette;
+
 enum {
     VNC_AUTH_INVALID = 0,
     VNC_AUTH_NONE = 1,
@@ -118,27 +150,23 @@ enum {
 
 #endif /* CONFIG_VNC_TLS */
 
-struct VncState
+typedef struct VncDisplay VncDisplay;
+typedef struct VncEncoder VncEncoder;
+
+/* Shared by all the clients of a display */
+struct VncDisplay
 {
     QEMUTimer *timer;
+    int refresh_interval; /* how often the frame buffer is scanned */
+    int64_t refresh_next;
     int lsock;
-    int csock;
     DisplayState *ds;
-    int need_update;
-    int width;
-    int height;
+    VncState *clients;
     uint32_t dirty_row[VNC_MAX_HEIGHT][VNC_DIRTY_WORDS];
-    char *old_data;
+    char *old_data; /* the frame buffer as last sent to the clients */
+    uint8_t *own_data; /* our frame buffer while ds->data is shared */
     int depth; /* internal VNC frame buffer byte per pixel */
-    int has_resize;
-    int has_hextile;
-    int has_pointer_type_change;
-    int absolute;
-    int last_x;
-    int last_y;
-
-    int major;
-    int minor;
+    Buffer update; /* update encoded once for a group of clients */
 
     char *display;
     char *password;
@@ -152,6 +180,46 @@ struct VncState
     char *x509cert;
     char *x509key;
 #endif
+    kbd_layout_t *kbd_layout;
+};
+
+/* The deflate streams of the compressed encodings.  Clients that get
+   exactly the same updates share one encoder, so that an update is
+   compressed once and each client's inflater still sees the whole
+   stream. */
+struct VncEncoder
+{
+    int users;
+    z_stream zstream[VNC_ZSTREAMS];
+    int zlevel[VNC_ZSTREAMS]; /* level plus one, 0 while unused */
+    int tight_reset; /* Tight streams the client must reset */
+    VncEncoder *copy; /* for the users splitting off, see vnc_group_update */
+};
+
+struct VncState
+{
+    VncDisplay *vd;
+    VncState *next;
+    VncState *leader; /* client whose update this one shares */
+    int csock;
+    DisplayState *ds;
+    int need_update;
+    int width;
+    int height;
+    uint32_t dirty_row[VNC_MAX_HEIGHT][VNC_DIRTY_WORDS];
+    int has_resize;
+    int has_copyrect;
+    int encoding; /* preferred encoding for framebuffer updates */
+    int compress_level; /* -1 unless requested by the client */
+    int quality_level; /* JPEG quality, -1 if JPEG is not wanted */
+    int has_pointer_type_change;
+    int absolute;
+    int last_x;
+    int last_y;
+
+    int major;
+    int minor;
+
     char challenge[VNC_AUTH_CHALLENGE_SIZE];
 
 #if CONFIG_VNC_TLS
@@ -160,15 +228,35 @@ struct VncState
 #endif
 
     Buffer output;
+    size_t output_sent; /* bytes of output already written */
     Buffer input;
-    kbd_layout_t *kbd_layout;
+
+    /* statistics for info vnc */
+    int64_t connect_time;
+    uint64_t bytes_sent;
+    int updates;
+    int skipped; /* refreshes missed while the output was busy */
+    int skip; /* a refresh was missed since the last update */
+    int64_t update_time; /* when the update being sent was queued */
+    int latency, latency_max; /* in ms, until fully written */
+
     /* current output mode information */
     VncWritePixels *write_pixels;
     VncSendHextileTile *send_hextile_tile;
+    int pix_native; /* frame buffer depth matching the client format */
     int pix_bpp, pix_big_endian;
     int red_shift, red_max, red_shift1;
     int green_shift, green_max, green_shift1;
     int blue_shift, blue_max, blue_shift1;
+    int cpixel_size, cpixel_shift; /* ZRLE compact pixels */
+    int tpixel_24; /* Tight sends pixels as three RGB bytes */
+
+    /* compressed encodings state */
+    VncEncoder *enc;
+    Buffer zlib; /* data before compression */
+    Buffer zlib_out;
+    VncPalette palette;
+    uint32_t pixels[VNC_TIGHT_MAX_PIXELS]; /* in the client format */
 
     VncReadEvent *read_handler;
     size_t read_handler_expect;
@@ -176,21 +264,51 @@ struct VncState
     uint8_t modifiers_state[256];
 };
 
-static VncState *vnc_state; /* needed for info vnc */
+static VncDisplay *vnc_display; /* needed for info vnc */
 
 void do_info_vnc(void)
 {
-    if (vnc_state == NULL)
+    VncState *vs, *ws;
+    int clients = 0, encoders = 0;
+    int64_t now, elapsed;
+
+    if (vnc_display == NULL)
 	term_printf("VNC server disabled\n");
     else {
 	term_printf("VNC server active on: ");
-	term_print_filename(vnc_state->display);
+	term_print_filename(vnc_display->display);
 	term_printf("\n");
 
-	if (vnc_state->csock == -1)
+	for (vs = vnc_display->clients; vs; vs = vs->next) {
+	    if (vs->csock == -1)
+		continue;
+	    clients++;
+	    for (ws = vnc_display->clients; ws != vs; ws = ws->next)
+		if (ws->csock != -1 && ws->enc == vs->enc)
+		    break;
+	    if (ws == vs)
+		encoders++;
+	}
+	if (!clients)
 	    term_printf("No client connected\n");
 	else
-	    term_printf("Client connected\n");
+	    term_printf("%d client%s connected, %d encoder%s\n",
+			clients, clients > 1 ? "s" : "",
+			encoders, encoders > 1 ? "s" : "");
+
+	now = qemu_get_clock(rt_clock);
+	for (vs = vnc_display->clients; vs; vs = vs->next) {
+	    if (vs->csock == -1)
+		continue;
+	    elapsed = MAX(now - vs->connect_time, 1);
+	    term_printf("  socket %d: %" PRId64 " kB/s, %d updates, "
+			"%d skipped, latency %d ms (max %d ms), "
+			"%ld bytes queued\n",
+			vs->csock, (int64_t) (vs->bytes_sent * 1000 / 1024 / elapsed),
+			vs->updates, vs->skipped,
+			vs->latency, vs->latency_max,
+			(long) (vs->output.offset - vs->output_sent));
+	}
     }
 }
 
@@ -207,7 +325,10 @@ static void vnc_write_s32(VncState *vs, int32_t value);
 static void vnc_write_u16(VncState *vs, uint16_t value);
 static void vnc_write_u8(VncState *vs, uint8_t value);
 static void vnc_flush(VncState *vs);
-static void vnc_update_client(void *opaque);
+static void buffer_reserve(Buffer *buffer, size_t len);
+static uint8_t *buffer_end(Buffer *buffer);
+static void buffer_reset(Buffer *buffer);
+static void vnc_update_display(VncDisplay *vd);
 static void vnc_client_read(void *opaque);
 
 static inline void vnc_set_bit(uint32_t *d, int k)
@@ -251,11 +372,14 @@ static inline int vnc_and_bits(const uint32_t *d1, const uint32_t *d2,
     return 0;
 }
 
-static void vnc_dpy_update(DisplayState *ds, int x, int y, int w, int h)
+static void vnc_mark_dirty(uint32_t (*dirty_row)[VNC_DIRTY_WORDS],
+                           int x, int y, int w, int h)
 {
-    VncState *vs = ds->opaque;
+    uint32_t mask[VNC_DIRTY_WORDS];
     int i;
 
+    if (w <= 0)
+	return;
     h += y;
 
     /* round x down to ensure the loop only spans one 16-pixel block per,
@@ -265,9 +389,21 @@ static void vnc_dpy_update(DisplayState *ds, int x, int y, int w, int h)
     w += (x % 16);
     x -= (x % 16);
 
+    /* build the mask once and OR it into each row a word at a time */
+    memset(mask, 0, sizeof(mask));
+    for (i = 0; i < w; i += 16)
+	vnc_set_bit(mask, (x + i) / 16);
+
     for (; y < h; y++)
-	for (i = 0; i < w; i += 16)
-	    vnc_set_bit(vs->dirty_row[y], (x + i) / 16);
+	for (i = x / 512; i <= (x + w - 1) / 512 && i < VNC_DIRTY_WORDS; i++)
+	    dirty_row[y][i] |= mask[i];
+}
+
+static void vnc_dpy_update(DisplayState *ds, int x, int y, int w, int h)
+{
+    VncDisplay *vd = ds->opaque;
+
+    vnc_mark_dirty(vd->dirty_row, x, y, w, h);
 }
 
 static void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
@@ -284,33 +420,59 @@ static void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
 static void vnc_dpy_resize(DisplayState *ds, int w, int h)
 {
     int size_changed;
-    VncState *vs = ds->opaque;
+    VncDisplay *vd = ds->opaque;
+    VncState *vs;
 
-    ds->data = realloc(ds->data, w * h * vs->depth);
-    vs->old_data = realloc(vs->old_data, w * h * vs->depth);
+    if (vd->own_data) {
+        ds->data = vd->own_data;
+        vd->own_data = NULL;
+    }
+    ds->data = realloc(ds->data, w * h * vd->depth);
+    vd->old_data = realloc(vd->old_data, w * h * vd->depth);
 
-    if (ds->data == NULL || vs->old_data == NULL) {
+    if (ds->data == NULL || vd->old_data == NULL) {
 	fprintf(stderr, "vnc: memory allocation failed\n");
 	exit(1);
     }
 
-    if (ds->depth != vs->depth * 8) {
-        ds->depth = vs->depth * 8;
+    if (ds->depth != vd->depth * 8) {
+        ds->depth = vd->depth * 8;
         console_color_init(ds);
     }
     size_changed = ds->width != w || ds->height != h;
     ds->width = w;
     ds->height = h;
-    ds->linesize = w * vs->depth;
-    if (vs->csock != -1 && vs->has_resize && size_changed) {
-	vnc_write_u8(vs, 0);  /* msg id */
-	vnc_write_u8(vs, 0);
-	vnc_write_u16(vs, 1); /* number of rects */
-	vnc_framebuffer_update(vs, 0, 0, ds->width, ds->height, -223);
-	vnc_flush(vs);
-	vs->width = ds->width;
-	vs->height = ds->height;
+    ds->linesize = w * vd->depth;
+    for (vs = vd->clients; vs; vs = vs->next)
+	if (vs->csock != -1 && vs->has_resize && size_changed) {
+	    vnc_write_u8(vs, 0);  /* msg id */
+	    vnc_write_u8(vs, 0);
+	    vnc_write_u16(vs, 1); /* number of rects */
+	    vnc_framebuffer_update(vs, 0, 0, ds->width, ds->height, -223);
+	    vnc_flush(vs);
+	    vs->width = ds->width;
+	    vs->height = ds->height;
+	}
+}
+
+static int vnc_dpy_share(DisplayState *ds, uint8_t *data, int linesize)
+{
+    VncDisplay *vd = ds->opaque;
+
+    if (!data) {
+        if (vd->own_data) {
+            ds->data = vd->own_data;
+            vd->own_data = NULL;
+        }
+        return 1;
     }
+
+    if (linesize != ds->width * vd->depth)
+        return 0;
+    if (!vd->own_data)
+        vd->own_data = ds->data;
+    ds->data = data;
+    return 1;
 }
 
 /* fastest code */
@@ -319,17 +481,9 @@ static void vnc_write_pixels_copy(VncState *vs, void *pixels, int size)
     vnc_write(vs, pixels, size);
 }
 
-/* slowest but generic code. */
-static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
+/* store a pixel value in the client byte order */
+static void vnc_pack_pixel(VncState *vs, uint8_t *buf, uint32_t v)
 {
-    unsigned int r, g, b;
-
-    r = (v >> vs->red_shift1) & vs->red_max;
-    g = (v >> vs->green_shift1) & vs->green_max;
-    b = (v >> vs->blue_shift1) & vs->blue_max;
-    v = (r << vs->red_shift) |
-        (g << vs->green_shift) |
-        (b << vs->blue_shift);
     switch(vs->pix_bpp) {
     case 1:
         buf[0] = v;
@@ -360,6 +514,24 @@ static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
     }
 }
 
+static inline uint32_t vnc_map_pixel(VncState *vs, uint32_t v)
+{
+    unsigned int r, g, b;
+
+    r = (v >> vs->red_shift1) & vs->red_max;
+    g = (v >> vs->green_shift1) & vs->green_max;
+    b = (v >> vs->blue_shift1) & vs->blue_max;
+    return (r << vs->red_shift) |
+        (g << vs->green_shift) |
+        (b << vs->blue_shift);
+}
+
+/* slowest but generic code. */
+static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
+{
+    vnc_pack_pixel(vs, buf, vnc_map_pixel(vs, v));
+}
+
 static void vnc_write_pixels_generic(VncState *vs, void *pixels1, int size)
 {
     uint32_t *pixels = pixels1;
@@ -380,9 +552,9 @@ static void send_framebuffer_update_raw(VncState *vs, int x, int y, int w, int h
 
     vnc_framebuffer_update(vs, x, y, w, h, 0);
 
-    row = vs->ds->data + y * vs->ds->linesize + x * vs->depth;
+    row = vs->ds->data + y * vs->ds->linesize + x * vs->vd->depth;
     for (i = 0; i < h; i++) {
-	vs->write_pixels(vs, row, w * vs->depth);
+	vs->write_pixels(vs, row, w * vs->vd->depth);
 	row += vs->ds->linesize;
     }
 }
@@ -429,12 +601,596 @@ static void send_framebuffer_update_hextile(VncState *vs, int x, int y, int w, i
     }
 }
 
-static void send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+/* Compressed encodings: zlib, ZRLE and Tight.  The pixels of a
+   rectangle are first read in the client format, then the encoded
+   data is collected in vs->zlib and deflated into vs->zlib_out. */
+
+static void vnc_zlib_error(void)
 {
-	if (vs->has_hextile)
-	    send_framebuffer_update_hextile(vs, x, y, w, h);
-	else
-	    send_framebuffer_update_raw(vs, x, y, w, h);
+    fprintf(stderr, "vnc: zlib error\n");
+    exit(1);
+}
+
+static VncEncoder *vnc_encoder_new(void)
+{
+    VncEncoder *enc = qemu_mallocz(sizeof(VncEncoder));
+
+    if (!enc) {
+        fprintf(stderr, "vnc: out of memory\n");
+        exit(1);
+    }
+    return enc;
+}
+
+/* a new encoder in the same state, for clients leaving a group */
+static VncEncoder *vnc_encoder_copy(VncEncoder *enc)
+{
+    VncEncoder *copy = vnc_encoder_new();
+    int i;
+
+    for (i = 0; i < VNC_ZSTREAMS; i++)
+        if (enc->zlevel[i]) {
+            if (deflateCopy(&copy->zstream[i], &enc->zstream[i]) != Z_OK)
+                vnc_zlib_error();
+            copy->zlevel[i] = enc->zlevel[i];
+        }
+    copy->tight_reset = enc->tight_reset;
+    return copy;
+}
+
+static void vnc_encoder_put(VncState *vs)
+{
+    VncEncoder *enc = vs->enc;
+    int i;
+
+    vs->enc = NULL;
+    if (enc && !--enc->users) {
+        for (i = 0; i < VNC_ZSTREAMS; i++)
+            if (enc->zlevel[i])
+                deflateEnd(&enc->zstream[i]);
+        qemu_free(enc);
+    }
+}
+
+static void vnc_encoder_set(VncState *vs, VncEncoder *enc)
+{
+    enc->users++;
+    vnc_encoder_put(vs);
+    vs->enc = enc;
+}
+
+static int vnc_zlib_level(VncState *vs)
+{
+    return vs->compress_level >= 0 ? vs->compress_level : 6;
+}
+
+/* Deflate vs->zlib into vs->zlib_out through one of the streams and
+   return the compressed length.  The streams are flushed after each
+   rectangle but never reset, the client inflates them continuously. */
+static int vnc_zlib_compress(VncState *vs, int stream)
+{
+    z_stream *zs = &vs->enc->zstream[stream];
+    int *zlevel = &vs->enc->zlevel[stream];
+    Buffer *out = &vs->zlib_out;
+    int level = vnc_zlib_level(vs);
+    size_t avail;
+    int ret;
+
+    buffer_reset(out);
+    if (!*zlevel) {
+        memset(zs, 0, sizeof(*zs));
+        if (deflateInit(zs, level) != Z_OK)
+            vnc_zlib_error();
+        *zlevel = level + 1;
+    }
+
+    zs->next_in = NULL;
+    zs->avail_in = 0;
+    if (*zlevel != level + 1) {
+        buffer_reserve(out, 64);
+        zs->next_out = buffer_end(out);
+        zs->avail_out = avail = out->capacity - out->offset;
+        if (deflateParams(zs, level, Z_DEFAULT_STRATEGY) != Z_OK)
+            vnc_zlib_error();
+        out->offset += avail - zs->avail_out;
+        *zlevel = level + 1;
+    }
+
+    zs->next_in = vs->zlib.buffer;
+    zs->avail_in = vs->zlib.offset;
+    do {
+        buffer_reserve(out, zs->avail_in + 64);
+        zs->next_out = buffer_end(out);
+        zs->avail_out = avail = out->capacity - out->offset;
+        ret = deflate(zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            vnc_zlib_error();
+        out->offset += avail - zs->avail_out;
+    } while (zs->avail_out == 0);
+
+    return out->offset;
+}
+
+/* read a rectangle of the frame buffer in the client pixel format */
+static void vnc_read_pixels(VncState *vs, uint32_t *dst,
+                            int x, int y, int w, int h)
+{
+    uint8_t *row = vs->ds->data + y * vs->ds->linesize + x * vs->vd->depth;
+    int i, j;
+
+    for (j = 0; j < h; j++, row += vs->ds->linesize)
+        switch (vs->vd->depth) {
+        case 1:
+            for (i = 0; i < w; i++)
+                *dst++ = row[i];
+            break;
+        case 2:
+            for (i = 0; i < w; i++)
+                *dst++ = ((uint16_t *) row)[i];
+            break;
+        default:
+            if (vs->write_pixels == vnc_write_pixels_generic)
+                for (i = 0; i < w; i++)
+                    *dst++ = vnc_map_pixel(vs, ((uint32_t *) row)[i]);
+            else
+                for (i = 0; i < w; i++)
+                    *dst++ = ((uint32_t *) row)[i];
+            break;
+        }
+}
+
+/* index of a colour in the palette, adding it while there are fewer
+   than MAX colours, or -1 */
+static int vnc_palette_index(VncPalette *pal, uint32_t c, int max)
+{
+    unsigned int h = (uint32_t) (c * 2654435761u) >> 22;
+
+    while (pal->slot[h]) {
+        if (pal->color[pal->slot[h] - 1] == c)
+            return pal->slot[h] - 1;
+        h = (h + 1) & (VNC_PALETTE_HASH - 1);
+    }
+    if (pal->size >= max)
+        return -1;
+    pal->color[pal->size++] = c;
+    pal->slot[h] = pal->size;
+    return pal->size - 1;
+}
+
+/* number of colours in N pixels, MAX + 1 if there are more than MAX */
+static int vnc_palette_build(VncPalette *pal, const uint32_t *px, int n,
+                             int max)
+{
+    int i;
+
+    pal->size = 0;
+    memset(pal->slot, 0, sizeof(pal->slot));
+    for (i = 0; i < n; i++)
+        if ((!i || px[i] != px[i - 1]) &&
+            vnc_palette_index(pal, px[i], max) < 0)
+            return max + 1;
+    return pal->size;
+}
+
+static void send_framebuffer_update_zlib(VncState *vs, int x, int y, int w, int h)
+{
+    Buffer output;
+    int i, len;
+    uint8_t *row;
+
+    vnc_framebuffer_update(vs, x, y, w, h, 6);
+
+    /* let write_pixels produce the raw data in vs->zlib */
+    output = vs->output;
+    vs->output = vs->zlib;
+    buffer_reset(&vs->output);
+    row = vs->ds->data + y * vs->ds->linesize + x * vs->vd->depth;
+    for (i = 0; i < h; i++) {
+	vs->write_pixels(vs, row, w * vs->vd->depth);
+	row += vs->ds->linesize;
+    }
+    vs->zlib = vs->output;
+    vs->output = output;
+
+    len = vnc_zlib_compress(vs, VNC_ZS_ZLIB);
+    vnc_write_u32(vs, len);
+    vnc_write(vs, vs->zlib_out.buffer, len);
+}
+
+static inline uint8_t *vnc_zrle_pixel(VncState *vs, uint8_t *p, uint32_t v)
+{
+    if (vs->cpixel_size == 3) {
+        v >>= vs->cpixel_shift;
+        if (vs->pix_big_endian) {
+            p[0] = v >> 16;
+            p[1] = v >> 8;
+            p[2] = v;
+        } else {
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+        }
+        return p + 3;
+    }
+    vnc_pack_pixel(vs, p, v);
+    return p + vs->pix_bpp;
+}
+
+static inline uint8_t *vnc_zrle_run(uint8_t *p, int len)
+{
+    for (len--; len >= 255; len -= 255)
+        *p++ = 255;
+    *p++ = len;
+    return p;
+}
+
+/* Encode a tile with whichever of the raw, solid, packed palette,
+   plain RLE and palette RLE subencodings comes out smallest. */
+static void vnc_zrle_tile(VncState *vs, const uint32_t *px, int w, int h)
+{
+    VncPalette *pal = &vs->palette;
+    Buffer *b = &vs->zlib;
+    int n = w * h, cpx = vs->cpixel_size;
+    int colors, runs, bits, raw, rle, packed, palrle, best;
+    int i, j, k, len, acc, nbits;
+    uint8_t *p;
+
+    colors = vnc_palette_build(pal, px, n, 127);
+    for (runs = 1, i = 1; i < n; i++)
+        if (px[i] != px[i - 1])
+            runs++;
+
+    buffer_reserve(b, 1 + 127 * 4 + n * 6);
+    p = buffer_end(b);
+
+    if (colors == 1) {
+        *p++ = 1;
+        p = vnc_zrle_pixel(vs, p, px[0]);
+        b->offset = p - b->buffer;
+        return;
+    }
+
+    bits = colors <= 2 ? 1 : colors <= 4 ? 2 : 4;
+    raw = n * cpx;
+    rle = runs * (cpx + 1);
+    packed = palrle = raw + 1;
+    if (colors <= 16)
+        packed = colors * cpx + (w * bits + 7) / 8 * h;
+    if (colors <= 127)
+        palrle = colors * cpx + runs * 2;
+    best = MIN(MIN(raw, rle), MIN(packed, palrle));
+
+    if (best == packed) {
+        *p++ = colors;
+        for (k = 0; k < colors; k++)
+            p = vnc_zrle_pixel(vs, p, pal->color[k]);
+        for (j = 0; j < h; j++) {
+            for (i = 0, acc = 0, nbits = 0; i < w; i++) {
+                acc = (acc << bits) | vnc_palette_index(pal, *px++, 127);
+                nbits += bits;
+                if (nbits == 8) {
+                    *p++ = acc;
+                    acc = nbits = 0;
+                }
+            }
+            if (nbits)
+                *p++ = acc << (8 - nbits);
+        }
+    } else if (best == palrle) {
+        *p++ = 128 + colors;
+        for (k = 0; k < colors; k++)
+            p = vnc_zrle_pixel(vs, p, pal->color[k]);
+        for (i = 0; i < n; i += len) {
+            for (len = 1; i + len < n && px[i + len] == px[i]; len++);
+            k = vnc_palette_index(pal, px[i], 127);
+            if (len == 1)
+                *p++ = k;
+            else {
+                *p++ = k | 128;
+                p = vnc_zrle_run(p, len);
+            }
+        }
+    } else if (best == rle) {
+        *p++ = 128;
+        for (i = 0; i < n; i += len) {
+            for (len = 1; i + len < n && px[i + len] == px[i]; len++);
+            p = vnc_zrle_pixel(vs, p, px[i]);
+            p = vnc_zrle_run(p, len);
+        }
+    } else {
+        *p++ = 0;
+        for (i = 0; i < n; i++)
+            p = vnc_zrle_pixel(vs, p, px[i]);
+    }
+    b->offset = p - b->buffer;
+}
+
+static void send_framebuffer_update_zrle(VncState *vs, int x, int y, int w, int h)
+{
+    int i, j, tw, th, len;
+
+    vnc_framebuffer_update(vs, x, y, w, h, 16);
+
+    buffer_reset(&vs->zlib);
+    for (j = y; j < y + h; j += 64)
+        for (i = x; i < x + w; i += 64) {
+            tw = MIN(64, x + w - i);
+            th = MIN(64, y + h - j);
+            vnc_read_pixels(vs, vs->pixels, i, j, tw, th);
+            vnc_zrle_tile(vs, vs->pixels, tw, th);
+        }
+
+    len = vnc_zlib_compress(vs, VNC_ZS_ZRLE);
+    vnc_write_u32(vs, len);
+    vnc_write(vs, vs->zlib_out.buffer, len);
+}
+
+static inline uint8_t *vnc_tight_pixel(VncState *vs, uint8_t *p, uint32_t v)
+{
+    if (vs->tpixel_24) {
+        p[0] = v >> vs->red_shift;
+        p[1] = v >> vs->green_shift;
+        p[2] = v >> vs->blue_shift;
+        return p + 3;
+    }
+    vnc_pack_pixel(vs, p, v);
+    return p + vs->pix_bpp;
+}
+
+/* compression control byte, also resetting the streams restarted when
+   the client joined its encoder */
+static int vnc_tight_control(VncState *vs, int ctl)
+{
+    ctl |= vs->enc->tight_reset;
+    vs->enc->tight_reset = 0;
+    return ctl;
+}
+
+/* Tight "compact" length: 7 bits per byte, up to three bytes */
+static void vnc_tight_write_len(VncState *vs, int len)
+{
+    uint8_t buf[3];
+    int n = 0;
+
+    buf[n++] = len & 0x7f;
+    if (len > 0x7f) {
+        buf[0] |= 0x80;
+        buf[n++] = (len >> 7) & 0x7f;
+        if (len > 0x3fff) {
+            buf[1] |= 0x80;
+            buf[n++] = (len >> 14) & 0xff;
+        }
+    }
+    vnc_write(vs, buf, n);
+}
+
+static void vnc_tight_data(VncState *vs, int stream)
+{
+    int len;
+
+    if (vs->zlib.offset < VNC_TIGHT_MIN_TO_COMPRESS) {
+        vnc_write(vs, vs->zlib.buffer, vs->zlib.offset);
+        return;
+    }
+
+    len = vnc_zlib_compress(vs, VNC_ZS_TIGHT + stream);
+    vnc_tight_write_len(vs, len);
+    vnc_write(vs, vs->zlib_out.buffer, len);
+}
+
+#if CONFIG_VNC_JPEG
+static const int vnc_tight_jpeg_quality[10] = {
+    5, 10, 15, 25, 37, 50, 60, 70, 75, 80
+};
+
+/* libjpeg writes straight into vs->zlib_out */
+static void vnc_jpeg_init_destination(j_compress_ptr cinfo)
+{
+    VncState *vs = cinfo->client_data;
+    Buffer *b = &vs->zlib_out;
+
+    buffer_reset(b);
+    buffer_reserve(b, 4096);
+    cinfo->dest->next_output_byte = buffer_end(b);
+    cinfo->dest->free_in_buffer = b->capacity - b->offset;
+}
+
+static boolean vnc_jpeg_empty_output_buffer(j_compress_ptr cinfo)
+{
+    VncState *vs = cinfo->client_data;
+    Buffer *b = &vs->zlib_out;
+
+    b->offset = b->capacity;
+    buffer_reserve(b, 4096);
+    cinfo->dest->next_output_byte = buffer_end(b);
+    cinfo->dest->free_in_buffer = b->capacity - b->offset;
+    return TRUE;
+}
+
+static void vnc_jpeg_term_destination(j_compress_ptr cinfo)
+{
+    VncState *vs = cinfo->client_data;
+    Buffer *b = &vs->zlib_out;
+
+    b->offset = b->capacity - cinfo->dest->free_in_buffer;
+}
+
+static void send_tight_jpeg(VncState *vs, const uint32_t *px, int w, int h)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dest;
+    uint8_t row[VNC_MAX_WIDTH * 3];
+    JSAMPROW rows[1] = { row };
+    uint32_t v;
+    int i;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    cinfo.client_data = vs;
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, vnc_tight_jpeg_quality[vs->quality_level], TRUE);
+
+    dest.init_destination = vnc_jpeg_init_destination;
+    dest.empty_output_buffer = vnc_jpeg_empty_output_buffer;
+    dest.term_destination = vnc_jpeg_term_destination;
+    cinfo.dest = &dest;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        for (i = 0; i < w; i++) {
+            v = *px++;
+            row[i * 3 + 0] = ((v >> vs->red_shift) & vs->red_max) *
+                    255 / vs->red_max;
+            row[i * 3 + 1] = ((v >> vs->green_shift) & vs->green_max) *
+                    255 / vs->green_max;
+            row[i * 3 + 2] = ((v >> vs->blue_shift) & vs->blue_max) *
+                    255 / vs->blue_max;
+        }
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    vnc_write_u8(vs, vnc_tight_control(vs, 0x90)); /* JPEG compression */
+    vnc_tight_write_len(vs, vs->zlib_out.offset);
+    vnc_write(vs, vs->zlib_out.buffer, vs->zlib_out.offset);
+}
+#endif /* CONFIG_VNC_JPEG */
+
+static void send_tight_rect(VncState *vs, int x, int y, int w, int h)
+{
+    VncPalette *pal = &vs->palette;
+    uint32_t *px = vs->pixels;
+    uint8_t buf[1 + 256 * 4], *p;
+    int n = w * h, tpx, colors, i, j, k, acc;
+
+    vnc_read_pixels(vs, px, x, y, w, h);
+    colors = vnc_palette_build(pal, px, n, 256);
+    tpx = vs->tpixel_24 ? 3 : vs->pix_bpp;
+
+    vnc_framebuffer_update(vs, x, y, w, h, 7);
+
+    if (colors == 1) {
+        buf[0] = vnc_tight_control(vs, 0x80); /* fill compression */
+        p = vnc_tight_pixel(vs, buf + 1, px[0]);
+        vnc_write(vs, buf, p - buf);
+        return;
+    }
+
+#if CONFIG_VNC_JPEG
+    if (colors > 256 && vs->quality_level >= 0 && vs->pix_bpp >= 2 &&
+        n >= VNC_TIGHT_JPEG_MIN) {
+        send_tight_jpeg(vs, px, w, h);
+        return;
+    }
+#endif
+
+    buffer_reset(&vs->zlib);
+    if (colors == 2) {
+        /* stream 1, palette filter, one bit per pixel */
+        vnc_write_u8(vs, vnc_tight_control(vs, 0x50));
+        vnc_write_u8(vs, 1);
+        buf[0] = 1;
+        p = vnc_tight_pixel(vs, buf + 1, pal->color[0]);
+        p = vnc_tight_pixel(vs, p, pal->color[1]);
+        vnc_write(vs, buf, p - buf);
+
+        buffer_reserve(&vs->zlib, (w + 7) / 8 * h);
+        p = buffer_end(&vs->zlib);
+        for (j = 0; j < h; j++) {
+            for (i = 0, acc = 0; i < w; i++) {
+                acc = (acc << 1) | (*px++ == pal->color[1]);
+                if ((i & 7) == 7) {
+                    *p++ = acc;
+                    acc = 0;
+                }
+            }
+            if (w & 7)
+                *p++ = acc << (8 - (w & 7));
+        }
+        vs->zlib.offset = p - vs->zlib.buffer;
+        vnc_tight_data(vs, 1);
+    } else if (colors <= 256 && colors * tpx + n < n * tpx) {
+        /* stream 2, palette filter, one byte per pixel */
+        vnc_write_u8(vs, vnc_tight_control(vs, 0x60));
+        vnc_write_u8(vs, 1);
+        buf[0] = colors - 1;
+        for (k = 0, p = buf + 1; k < colors; k++)
+            p = vnc_tight_pixel(vs, p, pal->color[k]);
+        vnc_write(vs, buf, p - buf);
+
+        buffer_reserve(&vs->zlib, n);
+        p = buffer_end(&vs->zlib);
+        for (i = 0; i < n; i++)
+            *p++ = vnc_palette_index(pal, px[i], 256);
+        vs->zlib.offset = p - vs->zlib.buffer;
+        vnc_tight_data(vs, 2);
+    } else {
+        /* stream 0, copy filter */
+        vnc_write_u8(vs, vnc_tight_control(vs, 0x00));
+
+        buffer_reserve(&vs->zlib, n * tpx);
+        p = buffer_end(&vs->zlib);
+        for (i = 0; i < n; i++)
+            p = vnc_tight_pixel(vs, p, px[i]);
+        vs->zlib.offset = p - vs->zlib.buffer;
+        vnc_tight_data(vs, 0);
+    }
+}
+
+static int send_framebuffer_update_tight(VncState *vs, int x, int y, int w, int h)
+{
+    int rows = MAX(VNC_TIGHT_MAX_PIXELS / w, 1);
+    int j, n = 0;
+
+    for (j = y; j < y + h; j += rows, n++)
+        send_tight_rect(vs, x, j, w, MIN(rows, y + h - j));
+    return n;
+}
+
+/* returns the number of rectangles sent */
+static int send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+{
+    switch (vs->encoding) {
+    case 5: /* Hextile */
+	send_framebuffer_update_hextile(vs, x, y, w, h);
+	break;
+    case 6: /* zlib */
+	send_framebuffer_update_zlib(vs, x, y, w, h);
+	break;
+    case 7: /* Tight */
+	return send_framebuffer_update_tight(vs, x, y, w, h);
+    case 16: /* ZRLE */
+	send_framebuffer_update_zrle(vs, x, y, w, h);
+	break;
+    default:
+	send_framebuffer_update_raw(vs, x, y, w, h);
+	break;
+    }
+    return 1;
+}
+
+/* the client asked for updates and has sent the previous ones */
+static int vnc_client_ready(VncState *vs)
+{
+    return vs->csock != -1 && vs->need_update && !vs->output.offset;
+}
+
+static int vnc_client_dirty(VncState *vs)
+{
+    uint32_t width_mask[VNC_DIRTY_WORDS];
+    int y;
+
+    vnc_set_bits(width_mask, (vs->width / 16), VNC_DIRTY_WORDS);
+    for (y = 0; y < vs->height; y++)
+	if (vnc_and_bits(vs->dirty_row[y], width_mask, VNC_DIRTY_WORDS))
+	    return 1;
+    return 0;
 }
 
 static void vnc_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int dst_y, int w, int h)
@@ -445,37 +1201,62 @@ static void vnc_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int dst_
     char *old_row;
     int y = 0;
     int pitch = ds->linesize;
-    VncState *vs = ds->opaque;
+    VncDisplay *vd = ds->opaque;
+    VncState *vs;
 
-    vnc_update_client(vs);
+    /* the clients must have the source before it is copied, scan now
+       even while the scanning is backed off */
+    vd->refresh_next = 0;
+    vnc_update_display(vd);
 
     if (dst_y > src_y) {
 	y = h - 1;
 	pitch = -pitch;
     }
 
-    src = (ds->linesize * (src_y + y) + vs->depth * src_x);
-    dst = (ds->linesize * (dst_y + y) + vs->depth * dst_x);
+    src = (ds->linesize * (src_y + y) + vd->depth * src_x);
+    dst = (ds->linesize * (dst_y + y) + vd->depth * dst_x);
 
     src_row = ds->data + src;
     dst_row = ds->data + dst;
-    old_row = vs->old_data + dst;
+    old_row = vd->old_data + dst;
 
     for (y = 0; y < h; y++) {
-	memmove(old_row, src_row, w * vs->depth);
-	memmove(dst_row, src_row, w * vs->depth);
+	memmove(old_row, src_row, w * vd->depth);
+	memmove(dst_row, src_row, w * vd->depth);
 	src_row += pitch;
 	dst_row += pitch;
 	old_row += pitch;
     }
 
-    vnc_write_u8(vs, 0);  /* msg id */
-    vnc_write_u8(vs, 0);
-    vnc_write_u16(vs, 1); /* number of rects */
-    vnc_framebuffer_update(vs, dst_x, dst_y, w, h, 1);
-    vnc_write_u16(vs, src_x);
-    vnc_write_u16(vs, src_y);
-    vnc_flush(vs);
+    for (vs = vd->clients; vs; vs = vs->next) {
+	if (vs->csock == -1)
+	    continue;
+	/* a client still waiting for part of the screen gets the
+	   destination as a normal update */
+	if (!vs->need_update || vnc_client_dirty(vs)) {
+	    vnc_mark_dirty(vs->dirty_row, dst_x, dst_y, w, h);
+	    continue;
+	}
+	vnc_write_u8(vs, 0);  /* msg id */
+	vnc_write_u8(vs, 0);
+	vnc_write_u16(vs, 1); /* number of rects */
+	vnc_framebuffer_update(vs, dst_x, dst_y, w, h, 1);
+	vnc_write_u16(vs, src_x);
+	vnc_write_u16(vs, src_y);
+	vnc_flush(vs);
+    }
+}
+
+/* CopyRect can only be used if every client understands it */
+static void vnc_update_copy(VncDisplay *vd)
+{
+    VncState *vs;
+
+    vd->ds->dpy_copy = vnc_copy;
+    for (vs = vd->clients; vs; vs = vs->next)
+	if (vs->csock != -1 && !vs->has_copyrect)
+	    vd->ds->dpy_copy = NULL;
 }
 
 static int find_dirty_height(VncState *vs, int y, int last_x, int x)
@@ -493,108 +1274,273 @@ static int find_dirty_height(VncState *vs, int y, int last_x, int x)
     return h;
 }
 
-static void vnc_update_client(void *opaque)
+/* Encode a FramebufferUpdate with the dirty tiles of the client into
+   BUF, clearing them */
+static void vnc_encode_update(VncState *vs, Buffer *buf)
 {
-    VncState *vs = opaque;
+    Buffer output;
+    int y;
+    int n_rectangles;
 
-    if (vs->need_update && vs->csock != -1) {
-	int y;
-	uint8_t *row;
-	char *old_row;
-	uint32_t width_mask[VNC_DIRTY_WORDS];
-	int n_rectangles;
-	int saved_offset;
-	int has_dirty = 0;
+    output = vs->output;
+    vs->output = *buf;
+    buffer_reset(&vs->output);
 
-        vga_hw_update();
+    n_rectangles = 0;
+    vnc_write_u8(vs, 0);  /* msg id */
+    vnc_write_u8(vs, 0);
+    vnc_write_u16(vs, 0);
+
+    for (y = 0; y < vs->height; y++) {
+	int x;
+	int last_x = -1;
+	for (x = 0; x < vs->width / 16; x++) {
+	    if (vnc_get_bit(vs->dirty_row[y], x)) {
+		if (last_x == -1) {
+		    last_x = x;
+		}
+		vnc_clear_bit(vs->dirty_row[y], x);
+	    } else {
+		if (last_x != -1) {
+		    int h = find_dirty_height(vs, y, last_x, x);
+		    n_rectangles += send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
+		}
+		last_x = -1;
+	    }
+	}
+	if (last_x != -1) {
+	    int h = find_dirty_height(vs, y, last_x, x);
+	    n_rectangles += send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
+	}
+    }
+    vs->output.buffer[2] = (n_rectangles >> 8) & 0xFF;
+    vs->output.buffer[3] = n_rectangles & 0xFF;
 
-        vnc_set_bits(width_mask, (vs->width / 16), VNC_DIRTY_WORDS);
+    *buf = vs->output;
+    vs->output = output;
+}
 
-	/* Walk through the dirty map and eliminate tiles that
-	   really aren't dirty */
-	row = vs->ds->data;
-	old_row = vs->old_data;
+/* the clients would be sent the same bytes for their pending updates */
+static int vnc_same_update(VncState *a, VncState *b)
+{
+    return vnc_client_ready(b) &&
+	b->width == a->width && b->height == a->height &&
+	b->encoding == a->encoding &&
+	vnc_zlib_level(b) == vnc_zlib_level(a) &&
+	b->quality_level == a->quality_level &&
+	b->write_pixels == a->write_pixels &&
+	b->pix_bpp == a->pix_bpp &&
+	b->pix_big_endian == a->pix_big_endian &&
+	b->red_max == a->red_max && b->red_shift == a->red_shift &&
+	b->green_max == a->green_max && b->green_shift == a->green_shift &&
+	b->blue_max == a->blue_max && b->blue_shift == a->blue_shift &&
+	!memcmp(b->dirty_row, a->dirty_row,
+		a->height * sizeof(a->dirty_row[0]));
+}
 
-	for (y = 0; y < vs->height; y++) {
-	    if (vnc_and_bits(vs->dirty_row[y], width_mask, VNC_DIRTY_WORDS)) {
-		int x;
-		uint8_t *ptr;
-		char *old_ptr;
+/* Move B to the encoder of A.  The client of B must be able to follow
+   the streams of A from the next update: that is the case while the
+   streams are unused, and Tight clients can be told to reset them. */
+static int vnc_encoder_join(VncState *a, VncState *b)
+{
+    VncEncoder *enc = a->enc;
+    int i, tight;
 
-		ptr = row;
-		old_ptr = (char*)old_row;
+    for (i = 0; i < VNC_ZS_TIGHT; i++)
+	if (enc->zlevel[i] || b->enc->zlevel[i])
+	    return 0;
 
-		for (x = 0; x < vs->ds->width; x += 16) {
-		    if (memcmp(old_ptr, ptr, 16 * vs->depth) == 0) {
-			vnc_clear_bit(vs->dirty_row[y], (x / 16));
-		    } else {
-			has_dirty = 1;
-			memcpy(old_ptr, ptr, 16 * vs->depth);
-		    }
+    for (i = 0; i < VNC_ZSTREAMS - VNC_ZS_TIGHT; i++) {
+	tight = VNC_ZS_TIGHT + i;
+	if (b->enc->zlevel[tight] || b->enc->tight_reset & (1 << i))
+	    enc->tight_reset |= 1 << i;
+	if (enc->zlevel[tight]) {
+	    deflateEnd(&enc->zstream[tight]);
+	    enc->zlevel[tight] = 0;
+	    enc->tight_reset |= 1 << i;
+	}
+    }
+    vnc_encoder_set(b, enc);
+    return 1;
+}
 
-		    ptr += 16 * vs->depth;
-		    old_ptr += 16 * vs->depth;
-		}
-	    }
+/* Send the pending update of A, encoded once, to all the clients that
+   would get the same bytes.  The other users of A's encoder leave it
+   with a copy of the streams. */
+static void vnc_group_update(VncState *a)
+{
+    VncDisplay *vd = a->vd;
+    VncEncoder *enc = a->enc;
+    VncState *vs;
 
-	    row += vs->ds->linesize;
-	    old_row += vs->ds->linesize;
+    a->leader = a;
+    for (vs = vd->clients; vs; vs = vs->next) {
+	if (vs == a || vs->leader || vs->csock == -1)
+	    continue;
+	if (vnc_same_update(a, vs) &&
+	    (vs->enc == enc || vnc_encoder_join(a, vs)))
+	    vs->leader = a;
+	else if (vs->enc == enc) {
+	    if (!enc->copy)
+		enc->copy = vnc_encoder_copy(enc);
+	    vnc_encoder_set(vs, enc->copy);
 	}
+    }
+    enc->copy = NULL;
 
-	if (!has_dirty) {
-	    qemu_mod_timer(vs->timer, qemu_get_clock(rt_clock) + VNC_REFRESH_INTERVAL);
-	    return;
+    vnc_encode_update(a, &vd->update);
+
+    for (vs = vd->clients; vs; vs = vs->next)
+	if (vs->leader == a) {
+	    if (vs != a)
+		memcpy(vs->dirty_row, a->dirty_row,
+		       a->height * sizeof(a->dirty_row[0]));
+	    vs->update_time = qemu_get_clock(rt_clock);
+	    vs->updates++;
+	    vs->skip = 0;
+	    vnc_write(vs, vd->update.buffer, vd->update.offset);
+	    vnc_flush(vs);
 	}
+}
 
-	/* Count rectangles */
-	n_rectangles = 0;
-	vnc_write_u8(vs, 0);  /* msg id */
-	vnc_write_u8(vs, 0);
-	saved_offset = vs->output.offset;
-	vnc_write_u16(vs, 0);
-
-	for (y = 0; y < vs->height; y++) {
-	    int x;
-	    int last_x = -1;
-	    for (x = 0; x < vs->width / 16; x++) {
-		if (vnc_get_bit(vs->dirty_row[y], x)) {
-		    if (last_x == -1) {
-			last_x = x;
-		    }
-		    vnc_clear_bit(vs->dirty_row[y], x);
-		} else {
-		    if (last_x != -1) {
-			int h = find_dirty_height(vs, y, last_x, x);
-			send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-			n_rectangles++;
+/* Compare the tiles marked dirty with what the clients were last sent,
+   once for all of them, and pass on those that really changed */
+static int vnc_refresh_dirty(VncDisplay *vd)
+{
+    DisplayState *ds = vd->ds;
+    uint32_t width_mask[VNC_DIRTY_WORDS];
+    uint8_t *row;
+    char *old_row;
+    VncState *vs;
+    int x, y, i;
+    int has_dirty = 0;
+
+    vnc_set_bits(width_mask, (ds->width / 16), VNC_DIRTY_WORDS);
+
+    row = ds->data;
+    old_row = vd->old_data;
+
+    for (y = 0; y < ds->height; y++) {
+	if (vnc_and_bits(vd->dirty_row[y], width_mask, VNC_DIRTY_WORDS)) {
+	    uint8_t *ptr;
+	    char *old_ptr;
+
+	    x = 0;
+	    while (x < ds->width / 16) {
+		/* skip whole words of clean tiles */
+		if ((x & 31) == 0 && !vd->dirty_row[y][x / 32]) {
+		    x += 32;
+		    continue;
+		}
+		if (vnc_get_bit(vd->dirty_row[y], x)) {
+		    ptr = row + x * 16 * vd->depth;
+		    old_ptr = old_row + x * 16 * vd->depth;
+		    if (memcmp(old_ptr, ptr, 16 * vd->depth) == 0) {
+			vnc_clear_bit(vd->dirty_row[y], x);
+		    } else {
+			has_dirty = 1;
+			memcpy(old_ptr, ptr, 16 * vd->depth);
 		    }
-		    last_x = -1;
 		}
+		x++;
 	    }
-	    if (last_x != -1) {
-		int h = find_dirty_height(vs, y, last_x, x);
-		send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-		n_rectangles++;
-	    }
+
+	    for (vs = vd->clients; vs; vs = vs->next)
+		for (i = 0; i < VNC_DIRTY_WORDS; i++)
+		    vs->dirty_row[y][i] |= vd->dirty_row[y][i] & width_mask[i];
 	}
-	vs->output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
-	vs->output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
-	vnc_flush(vs);
+	memset(vd->dirty_row[y], 0, sizeof(vd->dirty_row[y]));
 
+	row += ds->linesize;
+	old_row += ds->linesize;
     }
 
-    if (vs->csock != -1) {
-        qemu_mod_timer(vs->timer, qemu_get_clock(rt_clock) + VNC_REFRESH_INTERVAL);
+    return has_dirty;
+}
+
+static void vnc_update_display(VncDisplay *vd)
+{
+    VncState *vs;
+    int has_dirty;
+    int64_t now;
+
+    for (vs = vd->clients; vs; vs = vs->next)
+	if (vs->csock != -1 && vs->need_update)
+	    break;
+    if (!vs)
+	return;
+
+    /* The emulated display is updated at the full rate whatever the
+       clients do, only the scanning for changes backs off */
+    vga_hw_update();
+
+    now = qemu_get_clock(rt_clock);
+    if (now < vd->refresh_next)
+	return;
+
+    has_dirty = vnc_refresh_dirty(vd);
+
+    for (vs = vd->clients; vs; vs = vs->next)
+	vs->leader = NULL;
+    for (vs = vd->clients; vs; vs = vs->next) {
+	if (vs->leader || !vs->need_update || !vnc_client_dirty(vs))
+	    continue;
+	if (vnc_client_ready(vs)) {
+	    vnc_group_update(vs);
+	    has_dirty = 1;
+	} else if (vs->csock != -1) {
+	    /* frame skip: the tiles wait in the dirty map until the
+	       output drains, then go out as one update */
+	    vs->skipped++;
+	    vs->skip = 1;
+	    has_dirty = 1;
+	}
     }
 
+    /* Scan less and less often while nothing changes */
+    if (!has_dirty)
+	vd->refresh_interval = MIN(vd->refresh_interval * 2,
+				   VNC_REFRESH_INTERVAL_MAX);
+    else
+	vd->refresh_interval = VNC_REFRESH_INTERVAL;
+    vd->refresh_next = now + vd->refresh_interval;
 }
 
-static int vnc_listen_poll(void *opaque)
+static void vnc_client_free(VncState *vs)
 {
-    VncState *vs = opaque;
-    if (vs->csock == -1)
-	return 1;
-    return 0;
+    free(vs->input.buffer);
+    free(vs->output.buffer);
+    free(vs->zlib.buffer);
+    free(vs->zlib_out.buffer);
+    qemu_free(vs);
+}
+
+static void vnc_refresh(void *opaque)
+{
+    VncDisplay *vd = opaque;
+    VncState **pvs, *vs;
+
+    /* Disconnected clients are only freed here, where none of their
+       handlers can be running */
+    for (pvs = &vd->clients; (vs = *pvs);)
+	if (vs->csock == -1) {
+	    *pvs = vs->next;
+	    vnc_client_free(vs);
+	} else
+	    pvs = &vs->next;
+
+    vnc_update_display(vd);
+
+    if (vd->clients)
+	qemu_mod_timer(vd->timer,
+		       qemu_get_clock(rt_clock) + VNC_REFRESH_INTERVAL);
+}
+
+/* Go back to the full scan rate on input, a change is likely */
+static void vnc_refresh_reset(VncDisplay *vd)
+{
+    vd->refresh_interval = VNC_REFRESH_INTERVAL;
+    vd->refresh_next = 0;
 }
 
 static void buffer_reserve(Buffer *buffer, size_t len)
@@ -642,7 +1588,9 @@ static int vnc_client_io_error(VncState *vs, int ret, int last_errno)
 	vs->csock = -1;
 	buffer_reset(&vs->input);
 	buffer_reset(&vs->output);
+	vs->output_sent = 0;
 	vs->need_update = 0;
+	vnc_encoder_put(vs);
 #if CONFIG_VNC_TLS
 	if (vs->tls_session) {
 	    gnutls_deinit(vs->tls_session);
@@ -650,6 +1598,8 @@ static int vnc_client_io_error(VncState *vs, int ret, int last_errno)
 	}
 	vs->wiremode = VNC_WIREMODE_CLEAR;
 #endif /* CONFIG_VNC_TLS */
+	/* the client is freed by the refresh timer */
+	vnc_update_copy(vs->vd);
 	return 0;
     }
     return ret;
@@ -664,10 +1614,12 @@ static void vnc_client_write(void *opaque)
 {
     long ret;
     VncState *vs = opaque;
+    int64_t now;
 
 #if CONFIG_VNC_TLS
     if (vs->tls_session) {
-	ret = gnutls_write(vs->tls_session, vs->output.buffer, vs->output.offset);
+	ret = gnutls_write(vs->tls_session, vs->output.buffer + vs->output_sent,
+			   vs->output.offset - vs->output_sent);
 	if (ret < 0) {
 	    if (ret == GNUTLS_E_AGAIN)
 		errno = EAGAIN;
@@ -677,16 +1629,31 @@ static void vnc_client_write(void *opaque)
 	}
     } else
 #endif /* CONFIG_VNC_TLS */
-	ret = send(vs->csock, vs->output.buffer, vs->output.offset, 0);
+	ret = send(vs->csock, vs->output.buffer + vs->output_sent,
+		   vs->output.offset - vs->output_sent, 0);
     ret = vnc_client_io_error(vs, ret, socket_error());
     if (!ret)
 	return;
 
-    memmove(vs->output.buffer, vs->output.buffer + ret, (vs->output.offset - ret));
-    vs->output.offset -= ret;
+    vs->bytes_sent += ret;
+    vs->output_sent += ret;
+    if (vs->output_sent < vs->output.offset)
+	return;
 
-    if (vs->output.offset == 0) {
-	qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
+    vs->output.offset = 0;
+    vs->output_sent = 0;
+    qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
+
+    if (vs->update_time) {
+	now = qemu_get_clock(rt_clock);
+	vs->latency = now - vs->update_time;
+	vs->latency_max = MAX(vs->latency, vs->latency_max);
+	vs->update_time = 0;
+	/* send what was held back without waiting for the next refresh */
+	if (vs->skip) {
+	    vs->vd->refresh_next = 0;
+	    qemu_mod_timer(vs->vd->timer, now);
+	}
     }
 }
 
@@ -741,6 +1708,14 @@ static void vnc_client_read(void *opaque)
 
 static void vnc_write(VncState *vs, const void *data, size_t len)
 {
+    if (vs->csock == -1)
+	return;
+    if (vs->output.offset + len > VNC_OUTPUT_MAX) {
+	VNC_DEBUG("Client output over %d bytes\n", VNC_OUTPUT_MAX);
+	vnc_client_error(vs);
+	return;
+    }
+
     buffer_reserve(&vs->output, len);
 
     if (buffer_empty(&vs->output)) {
@@ -867,6 +1842,8 @@ static void pointer_event(VncState *vs, int button_mask, int x, int y)
     int buttons = 0;
     int dz = 0;
 
+    vnc_refresh_reset(vs->vd);
+
     if (button_mask & 0x01)
 	buttons |= MOUSE_EVENT_LBUTTON;
     if (button_mask & 0x02)
@@ -914,15 +1891,15 @@ static void reset_keys(VncState *vs)
 
 static void press_key(VncState *vs, int keysym)
 {
-    kbd_put_keycode(keysym2scancode(vs->kbd_layout, keysym) & 0x7f);
-    kbd_put_keycode(keysym2scancode(vs->kbd_layout, keysym) | 0x80);
+    kbd_put_keycode(keysym2scancode(vs->vd->kbd_layout, keysym) & 0x7f);
+    kbd_put_keycode(keysym2scancode(vs->vd->kbd_layout, keysym) | 0x80);
 }
 
 static void do_key_event(VncState *vs, int down, uint32_t sym)
 {
     int keycode;
 
-    keycode = keysym2scancode(vs->kbd_layout, sym & 0xFFFF);
+    keycode = keysym2scancode(vs->vd->kbd_layout, sym & 0xFFFF);
 
     /* QEMU console switch */
     switch(keycode) {
@@ -951,12 +1928,12 @@ static void do_key_event(VncState *vs, int down, uint32_t sym)
         break;
     }
 
-    if (keycode_is_keypad(vs->kbd_layout, keycode)) {
+    if (keycode_is_keypad(vs->vd->kbd_layout, keycode)) {
         /* If the numlock state needs to change then simulate an additional
            keypress before sending this one.  This will happen if the user
            toggles numlock away from the VNC window.
         */
-        if (keysym_is_numlock(vs->kbd_layout, sym & 0xFFFF)) {
+        if (keysym_is_numlock(vs->vd->kbd_layout, sym & 0xFFFF)) {
             if (!vs->modifiers_state[0x45]) {
                 vs->modifiers_state[0x45] = 1;
                 press_key(vs, 0xff7f);
@@ -1024,6 +2001,7 @@ static void do_key_event(VncState *vs, int down, uint32_t sym)
 
 static void key_event(VncState *vs, int down, uint32_t sym)
 {
+    vnc_refresh_reset(vs->vd);
     if (sym >= 'A' && sym <= 'Z' && is_graphic_console())
 	sym = sym - 'A' + 'a';
     do_key_event(vs, down, sym);
@@ -1045,14 +2023,9 @@ static void framebuffer_update_request(VncState *vs, int incremental,
     int i;
     vs->need_update = 1;
     if (!incremental) {
-	char *old_row = vs->old_data + y_position * vs->ds->linesize;
-
-	for (i = 0; i < h; i++) {
+	for (i = 0; i < h; i++)
             vnc_set_bits(vs->dirty_row[y_position + i],
                          (vs->ds->width / 16), VNC_DIRTY_WORDS);
-	    memset(old_row, 42, vs->ds->width * vs->depth);
-	    old_row += vs->ds->linesize;
-	}
     }
 }
 
@@ -1060,22 +2033,31 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
 {
     int i;
 
-    vs->has_hextile = 0;
+    vs->encoding = 0;
+    vs->compress_level = -1;
+    vs->quality_level = -1;
     vs->has_resize = 0;
     vs->has_pointer_type_change = 0;
+    vs->has_copyrect = 0;
     vs->absolute = -1;
-    vs->ds->dpy_copy = NULL;
 
     for (i = n_encodings - 1; i >= 0; i--) {
 	switch (encodings[i]) {
 	case 0: /* Raw */
-	    vs->has_hextile = 0;
+	case 5: /* Hextile */
+	case 6: /* zlib */
+	case 7: /* Tight */
+	case 16: /* ZRLE */
+	    vs->encoding = encodings[i];
 	    break;
 	case 1: /* CopyRect */
-	    vs->ds->dpy_copy = vnc_copy;
+	    vs->has_copyrect = 1;
 	    break;
-	case 5: /* Hextile */
-	    vs->has_hextile = 1;
+	case -256 ... -247: /* CompressLevel */
+	    vs->compress_level = encodings[i] + 256;
+	    break;
+	case -32 ... -23: /* QualityLevel */
+	    vs->quality_level = encodings[i] + 32;
 	    break;
 	case -223: /* DesktopResize */
 	    vs->has_resize = 1;
@@ -1088,6 +2070,7 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
 	}
     }
 
+    vnc_update_copy(vs->vd);
     check_pointer_type_change(vs, kbd_mouse_is_absolute());
 }
 
@@ -1102,6 +2085,100 @@ static int compute_nbits(unsigned int val)
     return n;
 }
 
+/* remember the client format for the encodings that build pixels */
+static void vnc_client_format(VncState *vs,
+                              int bits_per_pixel, int depth, int big_endian,
+                              int red_max, int green_max, int blue_max,
+                              int red_shift, int green_shift, int blue_shift)
+{
+    uint32_t mask;
+
+    vs->pix_bpp = bits_per_pixel / 8;
+    vs->pix_big_endian = big_endian;
+    vs->red_max = red_max;
+    vs->green_max = green_max;
+    vs->blue_max = blue_max;
+    vs->red_shift = red_shift;
+    vs->green_shift = green_shift;
+    vs->blue_shift = blue_shift;
+
+    /* ZRLE and Tight drop the unused byte of 24-bit colour pixels */
+    mask = ((uint32_t) red_max << red_shift) |
+        ((uint32_t) green_max << green_shift) |
+        ((uint32_t) blue_max << blue_shift);
+    vs->cpixel_size = vs->pix_bpp;
+    vs->cpixel_shift = 0;
+    if (bits_per_pixel == 32 && depth <= 24) {
+        if (!(mask & 0xff000000))
+            vs->cpixel_size = 3;
+        else if (!(mask & 0xff)) {
+            vs->cpixel_size = 3;
+            vs->cpixel_shift = 8;
+        }
+    }
+    vs->tpixel_24 = bits_per_pixel == 32 && depth == 24 &&
+        red_max == 0xff && green_max == 0xff && blue_max == 0xff;
+}
+
+/* Select how pixels are sent to the client from the current frame
+   buffer depth */
+static void vnc_client_pixels(VncState *vs)
+{
+    if (vs->pix_native == vs->vd->depth) {
+        vs->write_pixels = vnc_write_pixels_copy;
+        switch (vs->pix_native) {
+        case 1:
+            vs->send_hextile_tile = send_hextile_tile_8;
+            break;
+        case 2:
+            vs->send_hextile_tile = send_hextile_tile_16;
+            break;
+        default:
+            vs->send_hextile_tile = send_hextile_tile_32;
+            break;
+        }
+    } else {
+        /* generic and slower case */
+        vs->red_shift1 = 24 - compute_nbits(vs->red_max);
+        vs->green_shift1 = 16 - compute_nbits(vs->green_max);
+        vs->blue_shift1 = 8 - compute_nbits(vs->blue_max);
+        vs->write_pixels = vnc_write_pixels_generic;
+        vs->send_hextile_tile = send_hextile_tile_generic;
+    }
+}
+
+/* The frame buffer uses the pixel format of the clients when they all
+   agree on one of the formats that can be copied as is, 32 bits per
+   pixel otherwise, which the generic code converts from. */
+static void vnc_choose_depth(VncDisplay *vd)
+{
+    VncState *vs;
+    int depth = 0;
+
+    for (vs = vd->clients; vs; vs = vs->next) {
+        if (vs->csock == -1 || !vs->pix_bpp)
+            continue;
+        if (depth && depth != (vs->pix_native ? vs->pix_native : 4)) {
+            depth = 4;
+            break;
+        }
+        depth = vs->pix_native ? vs->pix_native : 4;
+    }
+
+    if (depth && depth != vd->depth) {
+        vd->depth = depth;
+        vnc_dpy_resize(vd->ds, vd->ds->width, vd->ds->height);
+        memset(vd->old_data, 42, vd->ds->linesize * vd->ds->height);
+        for (vs = vd->clients; vs; vs = vs->next)
+            memset(vs->dirty_row, 0xFF, sizeof(vs->dirty_row));
+        vga_hw_invalidate();
+    }
+
+    for (vs = vd->clients; vs; vs = vs->next)
+        if (vs->csock != -1 && vs->pix_bpp)
+            vnc_client_pixels(vs);
+}
+
 static void set_pixel_format(VncState *vs,
 			     int bits_per_pixel, int depth,
 			     int big_endian_flag, int true_color_flag,
@@ -1115,59 +2192,37 @@ static void set_pixel_format(VncState *vs,
 #else
     host_big_endian_flag = 0;
 #endif
-    if (!true_color_flag) {
-    fail:
+    if (!true_color_flag ||
+        (bits_per_pixel != 8 &&
+         bits_per_pixel != 16 &&
+         bits_per_pixel != 32)) {
 	vnc_client_error(vs);
         return;
     }
+    vnc_client_format(vs, bits_per_pixel, depth, big_endian_flag,
+                      red_max, green_max, blue_max,
+                      red_shift, green_shift, blue_shift);
     if (bits_per_pixel == 32 &&
         host_big_endian_flag == big_endian_flag &&
         red_max == 0xff && green_max == 0xff && blue_max == 0xff &&
         red_shift == 16 && green_shift == 8 && blue_shift == 0) {
-        vs->depth = 4;
-        vs->write_pixels = vnc_write_pixels_copy;
-        vs->send_hextile_tile = send_hextile_tile_32;
+        vs->pix_native = 4;
     } else
     if (bits_per_pixel == 16 &&
         host_big_endian_flag == big_endian_flag &&
         red_max == 31 && green_max == 63 && blue_max == 31 &&
         red_shift == 11 && green_shift == 5 && blue_shift == 0) {
-        vs->depth = 2;
-        vs->write_pixels = vnc_write_pixels_copy;
-        vs->send_hextile_tile = send_hextile_tile_16;
+        vs->pix_native = 2;
     } else
     if (bits_per_pixel == 8 &&
         red_max == 7 && green_max == 7 && blue_max == 3 &&
         red_shift == 5 && green_shift == 2 && blue_shift == 0) {
-        vs->depth = 1;
-        vs->write_pixels = vnc_write_pixels_copy;
-        vs->send_hextile_tile = send_hextile_tile_8;
+        vs->pix_native = 1;
     } else
-    {
-        /* generic and slower case */
-        if (bits_per_pixel != 8 &&
-            bits_per_pixel != 16 &&
-            bits_per_pixel != 32)
-            goto fail;
-        vs->depth = 4;
-        vs->red_shift = red_shift;
-        vs->red_max = red_max;
-        vs->red_shift1 = 24 - compute_nbits(red_max);
-        vs->green_shift = green_shift;
-        vs->green_max = green_max;
-        vs->green_shift1 = 16 - compute_nbits(green_max);
-        vs->blue_shift = blue_shift;
-        vs->blue_max = blue_max;
-        vs->blue_shift1 = 8 - compute_nbits(blue_max);
-        vs->pix_bpp = bits_per_pixel / 8;
-        vs->pix_big_endian = big_endian_flag;
-        vs->write_pixels = vnc_write_pixels_generic;
-        vs->send_hextile_tile = send_hextile_tile_generic;
-    }
+        vs->pix_native = 0;
 
-    vnc_dpy_resize(vs->ds, vs->ds->width, vs->ds->height);
+    vnc_choose_depth(vs->vd);
     memset(vs->dirty_row, 0xFF, sizeof(vs->dirty_row));
-    memset(vs->old_data, 42, vs->ds->linesize * vs->ds->height);
 
     vga_hw_invalidate();
     vga_hw_update();
@@ -1257,31 +2312,35 @@ static int protocol_client_init(VncState *vs, uint8_t *data, size_t len)
     vnc_write_u16(vs, vs->ds->width);
     vnc_write_u16(vs, vs->ds->height);
 
-    vnc_write_u8(vs, vs->depth * 8); /* bits-per-pixel */
-    vnc_write_u8(vs, vs->depth * 8); /* depth */
+    vs->pix_native = vs->vd->depth;
+    vnc_write_u8(vs, vs->pix_native * 8); /* bits-per-pixel */
+    vnc_write_u8(vs, vs->pix_native * 8); /* depth */
 #ifdef WORDS_BIGENDIAN
-    vnc_write_u8(vs, 1);             /* big-endian-flag */
+    vs->pix_big_endian = 1;
 #else
-    vnc_write_u8(vs, 0);             /* big-endian-flag */
+    vs->pix_big_endian = 0;
 #endif
+    vnc_write_u8(vs, vs->pix_big_endian); /* big-endian-flag */
     vnc_write_u8(vs, 1);             /* true-color-flag */
-    if (vs->depth == 4) {
+    if (vs->pix_native == 4) {
 	vnc_write_u16(vs, 0xFF);     /* red-max */
 	vnc_write_u16(vs, 0xFF);     /* green-max */
 	vnc_write_u16(vs, 0xFF);     /* blue-max */
 	vnc_write_u8(vs, 16);        /* red-shift */
 	vnc_write_u8(vs, 8);         /* green-shift */
 	vnc_write_u8(vs, 0);         /* blue-shift */
-        vs->send_hextile_tile = send_hextile_tile_32;
-    } else if (vs->depth == 2) {
+        vnc_client_format(vs, 32, 32, vs->pix_big_endian,
+                          0xff, 0xff, 0xff, 16, 8, 0);
+    } else if (vs->pix_native == 2) {
 	vnc_write_u16(vs, 31);       /* red-max */
 	vnc_write_u16(vs, 63);       /* green-max */
 	vnc_write_u16(vs, 31);       /* blue-max */
 	vnc_write_u8(vs, 11);        /* red-shift */
 	vnc_write_u8(vs, 5);         /* green-shift */
 	vnc_write_u8(vs, 0);         /* blue-shift */
-        vs->send_hextile_tile = send_hextile_tile_16;
-    } else if (vs->depth == 1) {
+        vnc_client_format(vs, 16, 16, vs->pix_big_endian,
+                          31, 63, 31, 11, 5, 0);
+    } else if (vs->pix_native == 1) {
         /* XXX: change QEMU pixel 8 bit pixel format to match the VNC one ? */
 	vnc_write_u16(vs, 7);        /* red-max */
 	vnc_write_u16(vs, 7);        /* green-max */
@@ -1289,9 +2348,9 @@ static int protocol_client_init(VncState *vs, uint8_t *data, size_t len)
 	vnc_write_u8(vs, 5);         /* red-shift */
 	vnc_write_u8(vs, 2);         /* green-shift */
 	vnc_write_u8(vs, 0);         /* blue-shift */
-        vs->send_hextile_tile = send_hextile_tile_8;
+        vnc_client_format(vs, 8, 8, 0, 7, 7, 3, 5, 2, 0);
     }
-    vs->write_pixels = vnc_write_pixels_copy;
+    vnc_client_pixels(vs);
 
     vnc_write(vs, pad, 3);           /* padding */
 
@@ -1325,7 +2384,7 @@ static int protocol_client_auth_vnc(VncState *vs, uint8_t *data, size_t len)
     int i, j, pwlen;
     unsigned char key[8];
 
-    if (!vs->password || !vs->password[0]) {
+    if (!vs->vd->password || !vs->vd->password[0]) {
 	VNC_DEBUG("No password configured on server");
 	vnc_write_u32(vs, 1); /* Reject auth */
 	if (vs->minor >= 8) {
@@ -1341,9 +2400,9 @@ static int protocol_client_auth_vnc(VncState *vs, uint8_t *data, size_t len)
     memcpy(response, vs->challenge, VNC_AUTH_CHALLENGE_SIZE);
 
     /* Calculate the expected challenge response */
-    pwlen = strlen(vs->password);
+    pwlen = strlen(vs->vd->password);
     for (i=0; i<sizeof(key); i++)
-        key[i] = i<pwlen ? vs->password[i] : 0;
+        key[i] = i<pwlen ? vs->vd->password[i] : 0;
     deskey(key, EN0);
     for (j = 0; j < VNC_AUTH_CHALLENGE_SIZE; j += 8)
         des(response+j, response+j);
@@ -1432,15 +2491,15 @@ static gnutls_certificate_credentials_t vnc_tls_initialize_x509_cred(VncState *v
     gnutls_certificate_credentials_t x509_cred;
     int ret;
 
-    if (!vs->x509cacert) {
+    if (!vs->vd->x509cacert) {
 	VNC_DEBUG("No CA x509 certificate specified\n");
 	return NULL;
     }
-    if (!vs->x509cert) {
+    if (!vs->vd->x509cert) {
 	VNC_DEBUG("No server x509 certificate specified\n");
 	return NULL;
     }
-    if (!vs->x509key) {
+    if (!vs->vd->x509key) {
 	VNC_DEBUG("No server private key specified\n");
 	return NULL;
     }
@@ -1450,7 +2509,7 @@ static gnutls_certificate_credentials_t vnc_tls_initialize_x509_cred(VncState *v
 	return NULL;
     }
     if ((ret = gnutls_certificate_set_x509_trust_file(x509_cred,
-						      vs->x509cacert,
+						      vs->vd->x509cacert,
 						      GNUTLS_X509_FMT_PEM)) < 0) {
 	VNC_DEBUG("Cannot load CA certificate %s\n", gnutls_strerror(ret));
 	gnutls_certificate_free_credentials(x509_cred);
@@ -1458,17 +2517,17 @@ static gnutls_certificate_credentials_t vnc_tls_initialize_x509_cred(VncState *v
     }
 
     if ((ret = gnutls_certificate_set_x509_key_file (x509_cred,
-						     vs->x509cert,
-						     vs->x509key,
+						     vs->vd->x509cert,
+						     vs->vd->x509key,
 						     GNUTLS_X509_FMT_PEM)) < 0) {
 	VNC_DEBUG("Cannot load certificate & key %s\n", gnutls_strerror(ret));
 	gnutls_certificate_free_credentials(x509_cred);
 	return NULL;
     }
 
-    if (vs->x509cacrl) {
+    if (vs->vd->x509cacrl) {
 	if ((ret = gnutls_certificate_set_x509_crl_file(x509_cred,
-							vs->x509cacrl,
+							vs->vd->x509cacrl,
 							GNUTLS_X509_FMT_PEM)) < 0) {
 	    VNC_DEBUG("Cannot load CRL %s\n", gnutls_strerror(ret));
 	    gnutls_certificate_free_credentials(x509_cred);
@@ -1562,7 +2621,7 @@ static int vnc_validate_certificate(struct VncState *vs)
 
 static int start_auth_vencrypt_subauth(VncState *vs)
 {
-    switch (vs->subauth) {
+    switch (vs->vd->subauth) {
     case VNC_AUTH_VENCRYPT_TLSNONE:
     case VNC_AUTH_VENCRYPT_X509NONE:
        VNC_DEBUG("Accept TLS auth none\n");
@@ -1576,7 +2635,7 @@ static int start_auth_vencrypt_subauth(VncState *vs)
        return start_auth_vnc(vs);
 
     default: /* Should not be possible, but just in case */
-       VNC_DEBUG("Reject auth %d\n", vs->auth);
+       VNC_DEBUG("Reject auth %d\n", vs->vd->auth);
        vnc_write_u8(vs, 1);
        if (vs->minor >= 8) {
            static const char err[] = "Unsupported authentication type";
@@ -1608,7 +2667,7 @@ static int vnc_continue_handshake(struct VncState *vs) {
        return -1;
     }
 
-    if (vs->x509verify) {
+    if (vs->vd->x509verify) {
 	if (vnc_validate_certificate(vs) < 0) {
 	    VNC_DEBUG("Client verification failed\n");
 	    vnc_client_error(vs);
@@ -1632,10 +2691,10 @@ static void vnc_handshake_io(void *opaque) {
     vnc_continue_handshake(vs);
 }
 
-#define NEED_X509_AUTH(vs)			      \
-    ((vs)->subauth == VNC_AUTH_VENCRYPT_X509NONE ||   \
-     (vs)->subauth == VNC_AUTH_VENCRYPT_X509VNC ||    \
-     (vs)->subauth == VNC_AUTH_VENCRYPT_X509PLAIN)
+#define NEED_X509_AUTH(vs)				  \
+    ((vs)->vd->subauth == VNC_AUTH_VENCRYPT_X509NONE ||   \
+     (vs)->vd->subauth == VNC_AUTH_VENCRYPT_X509VNC ||    \
+     (vs)->vd->subauth == VNC_AUTH_VENCRYPT_X509PLAIN)
 
 
 static int vnc_start_tls(struct VncState *vs) {
@@ -1699,7 +2758,7 @@ static int vnc_start_tls(struct VncState *vs) {
 		vnc_client_error(vs);
 		return -1;
 	    }
-	    if (vs->x509verify) {
+	    if (vs->vd->x509verify) {
 		VNC_DEBUG("Requesting a client certificate\n");
 		gnutls_certificate_server_set_request (vs->tls_session, GNUTLS_CERT_REQUEST);
 	    }
@@ -1734,7 +2793,7 @@ static int protocol_client_vencrypt_auth(VncState *vs, uint8_t *data, size_t len
 {
     int auth = read_u32(data, 0);
 
-    if (auth != vs->subauth) {
+    if (auth != vs->vd->subauth) {
 	VNC_DEBUG("Rejecting auth %d\n", auth);
 	vnc_write_u8(vs, 0); /* Reject auth */
 	vnc_flush(vs);
@@ -1769,10 +2828,10 @@ static int protocol_client_vencrypt_init(VncState *vs, uint8_t *data, size_t len
 	vnc_flush(vs);
 	vnc_client_error(vs);
     } else {
-	VNC_DEBUG("Sending allowed auth %d\n", vs->subauth);
+	VNC_DEBUG("Sending allowed auth %d\n", vs->vd->subauth);
 	vnc_write_u8(vs, 0); /* Accept version */
 	vnc_write_u8(vs, 1); /* Number of sub-auths */
-	vnc_write_u32(vs, vs->subauth); /* The supported auth */
+	vnc_write_u32(vs, vs->vd->subauth); /* The supported auth */
 	vnc_flush(vs);
 	vnc_read_when(vs, protocol_client_vencrypt_auth, 4);
     }
@@ -1794,7 +2853,7 @@ static int protocol_client_auth(VncState *vs, uint8_t *data, size_t len)
 {
     /* We only advertise 1 auth scheme at a time, so client
      * must pick the one we sent. Verify this */
-    if (data[0] != vs->auth) { /* Reject auth */
+    if (data[0] != vs->vd->auth) { /* Reject auth */
        VNC_DEBUG("Reject auth %d\n", (int)data[0]);
        vnc_write_u32(vs, 1);
        if (vs->minor >= 8) {
@@ -1805,7 +2864,7 @@ static int protocol_client_auth(VncState *vs, uint8_t *data, size_t len)
        vnc_client_error(vs);
     } else { /* Accept requested auth */
        VNC_DEBUG("Client requested auth %d\n", (int)data[0]);
-       switch (vs->auth) {
+       switch (vs->vd->auth) {
        case VNC_AUTH_NONE:
            VNC_DEBUG("Accept auth none\n");
            if (vs->minor >= 8) {
@@ -1826,7 +2885,7 @@ static int protocol_client_auth(VncState *vs, uint8_t *data, size_t len)
 #endif /* CONFIG_VNC_TLS */
 
        default: /* Should not be possible, but just in case */
-           VNC_DEBUG("Reject auth %d\n", vs->auth);
+           VNC_DEBUG("Reject auth %d\n", vs->vd->auth);
            vnc_write_u8(vs, 1);
            if (vs->minor >= 8) {
                static const char err[] = "Authentication failed";
@@ -1871,26 +2930,26 @@ static int protocol_version(VncState *vs, uint8_t *version, size_t len)
 	vs->minor = 3;
 
     if (vs->minor == 3) {
-	if (vs->auth == VNC_AUTH_NONE) {
+	if (vs->vd->auth == VNC_AUTH_NONE) {
             VNC_DEBUG("Tell client auth none\n");
-            vnc_write_u32(vs, vs->auth);
+            vnc_write_u32(vs, vs->vd->auth);
             vnc_flush(vs);
             vnc_read_when(vs, protocol_client_init, 1);
-       } else if (vs->auth == VNC_AUTH_VNC) {
+       } else if (vs->vd->auth == VNC_AUTH_VNC) {
             VNC_DEBUG("Tell client VNC auth\n");
-            vnc_write_u32(vs, vs->auth);
+            vnc_write_u32(vs, vs->vd->auth);
             vnc_flush(vs);
             start_auth_vnc(vs);
        } else {
-            VNC_DEBUG("Unsupported auth %d for protocol 3.3\n", vs->auth);
+            VNC_DEBUG("Unsupported auth %d for protocol 3.3\n", vs->vd->auth);
             vnc_write_u32(vs, VNC_AUTH_INVALID);
             vnc_flush(vs);
             vnc_client_error(vs);
        }
     } else {
-	VNC_DEBUG("Telling client we support auth %d\n", vs->auth);
+	VNC_DEBUG("Telling client we support auth %d\n", vs->vd->auth);
 	vnc_write_u8(vs, 1); /* num auth */
-	vnc_write_u8(vs, vs->auth);
+	vnc_write_u8(vs, vs->vd->auth);
 	vnc_read_when(vs, protocol_client_auth, 1);
 	vnc_flush(vs);
     }
@@ -1900,27 +2959,45 @@ static int protocol_version(VncState *vs, uint8_t *version, size_t len)
 
 static void vnc_listen_read(void *opaque)
 {
-    VncState *vs = opaque;
+    VncDisplay *vd = opaque;
+    VncState *vs;
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
+    int csock;
 
     /* Catch-up */
     vga_hw_update();
 
-    vs->csock = accept(vs->lsock, (struct sockaddr *)&addr, &addrlen);
-    if (vs->csock != -1) {
-	VNC_DEBUG("New client on socket %d\n", vs->csock);
+    csock = accept(vd->lsock, (struct sockaddr *)&addr, &addrlen);
+    if (csock != -1) {
+	vs = qemu_mallocz(sizeof(VncState));
+	if (!vs) {
+	    closesocket(csock);
+	    return;
+	}
+	VNC_DEBUG("New client on socket %d\n", csock);
+	vs->vd = vd;
+	vs->ds = vd->ds;
+	vs->csock = csock;
+	vs->last_x = -1;
+	vs->last_y = -1;
+	vs->compress_level = -1;
+	vs->quality_level = -1;
+	vs->connect_time = qemu_get_clock(rt_clock);
+	vnc_encoder_set(vs, vnc_encoder_new());
+	vs->next = vd->clients;
+	vd->clients = vs;
+
         socket_set_nonblock(vs->csock);
-	qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, opaque);
+	qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
 	vnc_write(vs, "RFB 003.008\n", 12);
 	vnc_flush(vs);
 	vnc_read_when(vs, protocol_version, 12);
-	memset(vs->old_data, 0, vs->ds->linesize * vs->ds->height);
 	memset(vs->dirty_row, 0xFF, sizeof(vs->dirty_row));
-	vs->has_resize = 0;
-	vs->has_hextile = 0;
-	vs->ds->dpy_copy = NULL;
-        vnc_update_client(vs);
+	vnc_update_copy(vd);
+	vnc_refresh_reset(vd);
+	qemu_mod_timer(vd->timer,
+		       qemu_get_clock(rt_clock) + VNC_REFRESH_INTERVAL);
     }
 }
 
@@ -1928,46 +3005,45 @@ extern int parse_host_port(struct sockaddr_in *saddr, const char *str);
 
 void vnc_display_init(DisplayState *ds)
 {
-    VncState *vs;
+    VncDisplay *vd;
 
-    vs = qemu_mallocz(sizeof(VncState));
-    if (!vs)
+    vd = qemu_mallocz(sizeof(VncDisplay));
+    if (!vd)
 	exit(1);
 
-    ds->opaque = vs;
-    vnc_state = vs;
-    vs->display = NULL;
-    vs->password = NULL;
+    ds->opaque = vd;
+    vnc_display = vd;
+    vd->display = NULL;
+    vd->password = NULL;
 
-    vs->lsock = -1;
-    vs->csock = -1;
-    vs->depth = 4;
-    vs->last_x = -1;
-    vs->last_y = -1;
+    vd->lsock = -1;
+    vd->depth = 4;
 
-    vs->ds = ds;
+    vd->ds = ds;
 
     if (!keyboard_layout)
 	keyboard_layout = "en-us";
 
-    vs->kbd_layout = init_keyboard_layout(keyboard_layout);
-    if (!vs->kbd_layout)
+    vd->kbd_layout = init_keyboard_layout(keyboard_layout);
+    if (!vd->kbd_layout)
 	exit(1);
 
-    vs->timer = qemu_new_timer(rt_clock, vnc_update_client, vs);
+    vd->timer = qemu_new_timer(rt_clock, vnc_refresh, vd);
+    vd->refresh_interval = VNC_REFRESH_INTERVAL;
 
-    vs->ds->data = NULL;
-    vs->ds->dpy_update = vnc_dpy_update;
-    vs->ds->dpy_resize = vnc_dpy_resize;
-    vs->ds->dpy_refresh = NULL;
+    vd->ds->data = NULL;
+    vd->ds->dpy_update = vnc_dpy_update;
+    vd->ds->dpy_resize = vnc_dpy_resize;
+    vd->ds->dpy_share = vnc_dpy_share;
+    vd->ds->dpy_refresh = NULL;
 
-    memset(vs->dirty_row, 0xFF, sizeof(vs->dirty_row));
+    memset(vd->dirty_row, 0xFF, sizeof(vd->dirty_row));
 
-    vnc_dpy_resize(vs->ds, 640, 400);
+    vnc_dpy_resize(vd->ds, 640, 400);
 }
 
 #if CONFIG_VNC_TLS
-static int vnc_set_x509_credential(VncState *vs,
+static int vnc_set_x509_credential(VncDisplay *vd,
 				   const char *certdir,
 				   const char *filename,
 				   char **cred,
@@ -1999,75 +3075,64 @@ static int vnc_set_x509_credential(VncState *vs,
     return 0;
 }
 
-static int vnc_set_x509_credential_dir(VncState *vs,
+static int vnc_set_x509_credential_dir(VncDisplay *vd,
 				       const char *certdir)
 {
-    if (vnc_set_x509_credential(vs, certdir, X509_CA_CERT_FILE, &vs->x509cacert, 0) < 0)
+    if (vnc_set_x509_credential(vd, certdir, X509_CA_CERT_FILE, &vd->x509cacert, 0) < 0)
 	goto cleanup;
-    if (vnc_set_x509_credential(vs, certdir, X509_CA_CRL_FILE, &vs->x509cacrl, 1) < 0)
+    if (vnc_set_x509_credential(vd, certdir, X509_CA_CRL_FILE, &vd->x509cacrl, 1) < 0)
 	goto cleanup;
-    if (vnc_set_x509_credential(vs, certdir, X509_SERVER_CERT_FILE, &vs->x509cert, 0) < 0)
+    if (vnc_set_x509_credential(vd, certdir, X509_SERVER_CERT_FILE, &vd->x509cert, 0) < 0)
 	goto cleanup;
-    if (vnc_set_x509_credential(vs, certdir, X509_SERVER_KEY_FILE, &vs->x509key, 0) < 0)
+    if (vnc_set_x509_credential(vd, certdir, X509_SERVER_KEY_FILE, &vd->x509key, 0) < 0)
 	goto cleanup;
 
     return 0;
 
  cleanup:
-    qemu_free(vs->x509cacert);
-    qemu_free(vs->x509cacrl);
-    qemu_free(vs->x509cert);
-    qemu_free(vs->x509key);
-    vs->x509cacert = vs->x509cacrl = vs->x509cert = vs->x509key = NULL;
+    qemu_free(vd->x509cacert);
+    qemu_free(vd->x509cacrl);
+    qemu_free(vd->x509cert);
+    qemu_free(vd->x509key);
+    vd->x509cacert = vd->x509cacrl = vd->x509cert = vd->x509key = NULL;
     return -1;
 }
 #endif /* CONFIG_VNC_TLS */
 
 void vnc_display_close(DisplayState *ds)
 {
-    VncState *vs = ds ? (VncState *)ds->opaque : vnc_state;
+    VncDisplay *vd = ds ? (VncDisplay *)ds->opaque : vnc_display;
+    VncState *vs;
 
-    if (vs->display) {
-	qemu_free(vs->display);
-	vs->display = NULL;
+    if (vd->display) {
+	qemu_free(vd->display);
+	vd->display = NULL;
     }
-    if (vs->lsock != -1) {
-	qemu_set_fd_handler2(vs->lsock, NULL, NULL, NULL, NULL);
-	close(vs->lsock);
-	vs->lsock = -1;
+    if (vd->lsock != -1) {
+	qemu_set_fd_handler2(vd->lsock, NULL, NULL, NULL, NULL);
+	close(vd->lsock);
+	vd->lsock = -1;
     }
-    if (vs->csock != -1) {
-	qemu_set_fd_handler2(vs->csock, NULL, NULL, NULL, NULL);
-	closesocket(vs->csock);
-	vs->csock = -1;
-	buffer_reset(&vs->input);
-	buffer_reset(&vs->output);
-	vs->need_update = 0;
-#if CONFIG_VNC_TLS
-	if (vs->tls_session) {
-	    gnutls_deinit(vs->tls_session);
-	    vs->tls_session = NULL;
-	}
-	vs->wiremode = VNC_WIREMODE_CLEAR;
-#endif /* CONFIG_VNC_TLS */
-    }
-    vs->auth = VNC_AUTH_INVALID;
+    for (vs = vd->clients; vs; vs = vs->next)
+	if (vs->csock != -1)
+	    vnc_client_error(vs);
+    vd->auth = VNC_AUTH_INVALID;
 #if CONFIG_VNC_TLS
-    vs->subauth = VNC_AUTH_INVALID;
-    vs->x509verify = 0;
+    vd->subauth = VNC_AUTH_INVALID;
+    vd->x509verify = 0;
 #endif
 }
 
 int vnc_display_password(DisplayState *ds, const char *password)
 {
-    VncState *vs = ds ? (VncState *)ds->opaque : vnc_state;
+    VncDisplay *vd = ds ? (VncDisplay *)ds->opaque : vnc_display;
 
-    if (vs->password) {
-	qemu_free(vs->password);
-	vs->password = NULL;
+    if (vd->password) {
+	qemu_free(vd->password);
+	vd->password = NULL;
     }
     if (password && password[0]) {
-	if (!(vs->password = qemu_strdup(password)))
+	if (!(vd->password = qemu_strdup(password)))
 	    return -1;
     }
 
@@ -2084,7 +3149,7 @@ int vnc_display_open(DisplayState *ds, const char *display)
     int reuse_addr, ret;
     socklen_t addrlen;
     const char *p;
-    VncState *vs = ds ? (VncState *)ds->opaque : vnc_state;
+    VncDisplay *vd = ds ? (VncDisplay *)ds->opaque : vnc_display;
     const char *options;
     int password = 0;
 #if CONFIG_VNC_TLS
@@ -2095,7 +3160,7 @@ int vnc_display_open(DisplayState *ds, const char *display)
     if (strcmp(display, "none") == 0)
 	return 0;
 
-    if (!(vs->display = strdup(display)))
+    if (!(vd->display = strdup(display)))
 	return -1;
 
     options = display;
@@ -2110,7 +3175,7 @@ int vnc_display_open(DisplayState *ds, const char *display)
 	    char *start, *end;
 	    x509 = 1; /* Require x509 certificates */
 	    if (strncmp(options, "x509verify", 10) == 0)
-	        vs->x509verify = 1; /* ...and verify client certs */
+	        vd->x509verify = 1; /* ...and verify client certs */
 
 	    /* Now check for 'x509=/some/path' postfix
 	     * and use that to setup x509 certificate/key paths */
@@ -2122,18 +3187,18 @@ int vnc_display_open(DisplayState *ds, const char *display)
 		strncpy(path, start+1, len);
 		path[len] = '\0';
 		VNC_DEBUG("Trying certificate path '%s'\n", path);
-		if (vnc_set_x509_credential_dir(vs, path) < 0) {
+		if (vnc_set_x509_credential_dir(vd, path) < 0) {
 		    fprintf(stderr, "Failed to find x509 certificates/keys in %s\n", path);
 		    qemu_free(path);
-		    qemu_free(vs->display);
-		    vs->display = NULL;
+		    qemu_free(vd->display);
+		    vd->display = NULL;
 		    return -1;
 		}
 		qemu_free(path);
 	    } else {
 		fprintf(stderr, "No certificate path provided\n");
-		qemu_free(vs->display);
-		vs->display = NULL;
+		qemu_free(vd->display);
+		vd->display = NULL;
 		return -1;
 	    }
 #endif
@@ -2143,39 +3208,39 @@ int vnc_display_open(DisplayState *ds, const char *display)
     if (password) {
 #if CONFIG_VNC_TLS
 	if (tls) {
-	    vs->auth = VNC_AUTH_VENCRYPT;
+	    vd->auth = VNC_AUTH_VENCRYPT;
 	    if (x509) {
 		VNC_DEBUG("Initializing VNC server with x509 password auth\n");
-		vs->subauth = VNC_AUTH_VENCRYPT_X509VNC;
+		vd->subauth = VNC_AUTH_VENCRYPT_X509VNC;
 	    } else {
 		VNC_DEBUG("Initializing VNC server with TLS password auth\n");
-		vs->subauth = VNC_AUTH_VENCRYPT_TLSVNC;
+		vd->subauth = VNC_AUTH_VENCRYPT_TLSVNC;
 	    }
 	} else {
 #endif
 	    VNC_DEBUG("Initializing VNC server with password auth\n");
-	    vs->auth = VNC_AUTH_VNC;
+	    vd->auth = VNC_AUTH_VNC;
 #if CONFIG_VNC_TLS
-	    vs->subauth = VNC_AUTH_INVALID;
+	    vd->subauth = VNC_AUTH_INVALID;
 	}
 #endif
     } else {
 #if CONFIG_VNC_TLS
 	if (tls) {
-	    vs->auth = VNC_AUTH_VENCRYPT;
+	    vd->auth = VNC_AUTH_VENCRYPT;
 	    if (x509) {
 		VNC_DEBUG("Initializing VNC server with x509 no auth\n");
-		vs->subauth = VNC_AUTH_VENCRYPT_X509NONE;
+		vd->subauth = VNC_AUTH_VENCRYPT_X509NONE;
 	    } else {
 		VNC_DEBUG("Initializing VNC server with TLS no auth\n");
-		vs->subauth = VNC_AUTH_VENCRYPT_TLSNONE;
+		vd->subauth = VNC_AUTH_VENCRYPT_TLSNONE;
 	    }
 	} else {
 #endif
 	    VNC_DEBUG("Initializing VNC server with no auth\n");
-	    vs->auth = VNC_AUTH_NONE;
+	    vd->auth = VNC_AUTH_NONE;
 #if CONFIG_VNC_TLS
-	    vs->subauth = VNC_AUTH_INVALID;
+	    vd->subauth = VNC_AUTH_INVALID;
 	}
 #endif
     }
@@ -2184,11 +3249,11 @@ int vnc_display_open(DisplayState *ds, const char *display)
 	addr = (struct sockaddr *)&uaddr;
 	addrlen = sizeof(uaddr);
 
-	vs->lsock = socket(PF_UNIX, SOCK_STREAM, 0);
-	if (vs->lsock == -1) {
+	vd->lsock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (vd->lsock == -1) {
 	    fprintf(stderr, "Could not create socket\n");
-	    free(vs->display);
-	    vs->display = NULL;
+	    free(vd->display);
+	    vd->display = NULL;
 	    return -1;
 	}
 
@@ -2205,51 +3270,51 @@ int vnc_display_open(DisplayState *ds, const char *display)
 
 	if (parse_host_port(&iaddr, display) < 0) {
 	    fprintf(stderr, "Could not parse VNC address\n");
-	    free(vs->display);
-	    vs->display = NULL;
+	    free(vd->display);
+	    vd->display = NULL;
 	    return -1;
 	}
 
 	iaddr.sin_port = htons(ntohs(iaddr.sin_port) + 5900);
 
-	vs->lsock = socket(PF_INET, SOCK_STREAM, 0);
-	if (vs->lsock == -1) {
+	vd->lsock = socket(PF_INET, SOCK_STREAM, 0);
+	if (vd->lsock == -1) {
 	    fprintf(stderr, "Could not create socket\n");
-	    free(vs->display);
-	    vs->display = NULL;
+	    free(vd->display);
+	    vd->display = NULL;
 	    return -1;
 	}
 
 	reuse_addr = 1;
-	ret = setsockopt(vs->lsock, SOL_SOCKET, SO_REUSEADDR,
+	ret = setsockopt(vd->lsock, SOL_SOCKET, SO_REUSEADDR,
 			 (const char *)&reuse_addr, sizeof(reuse_addr));
 	if (ret == -1) {
 	    fprintf(stderr, "setsockopt() failed\n");
-	    close(vs->lsock);
-	    vs->lsock = -1;
-	    free(vs->display);
-	    vs->display = NULL;
+	    close(vd->lsock);
+	    vd->lsock = -1;
+	    free(vd->display);
+	    vd->display = NULL;
 	    return -1;
 	}
     }
 
-    if (bind(vs->lsock, addr, addrlen) == -1) {
+    if (bind(vd->lsock, addr, addrlen) == -1) {
 	fprintf(stderr, "bind() failed\n");
-	close(vs->lsock);
-	vs->lsock = -1;
-	free(vs->display);
-	vs->display = NULL;
+	close(vd->lsock);
+	vd->lsock = -1;
+	free(vd->display);
+	vd->display = NULL;
 	return -1;
     }
 
-    if (listen(vs->lsock, 1) == -1) {
+    if (listen(vd->lsock, 1) == -1) {
 	fprintf(stderr, "listen() failed\n");
-	close(vs->lsock);
-	vs->lsock = -1;
-	free(vs->display);
-	vs->display = NULL;
+	close(vd->lsock);
+	vd->lsock = -1;
+	free(vd->display);
+	vd->display = NULL;
 	return -1;
     }
 
-    return qemu_set_fd_handler2(vs->lsock, vnc_listen_poll, vnc_listen_read, NULL, vs);
+    return qemu_set_fd_handler2(vd->lsock, NULL, vnc_listen_read, NULL, vd);
 }
@@ -13,7 +13,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
                                              uint32_t *last_fg32,
                                              int *has_bg, int *has_fg)
 {
-    uint8_t *row = (vs->ds->data + y * vs->ds->linesize + x * vs->depth);
+    uint8_t *row = (vs->ds->data + y * vs->ds->linesize + x * vs->vd->depth);
     pixel_t *irow = (pixel_t *)row;
     int j, i;
     pixel_t *last_bg = (pixel_t *)last_bg32;
@@ -27,8 +27,37 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
     uint8_t data[(sizeof(pixel_t) + 2) * 16 * 16];
     int n_data = 0;
     int n_subtiles = 0;
+    int solid;
 
+    /* most tiles are a single colour, check for that with a plain
+       compare loop before classifying pixels one at a time */
+    bg = irow[0];
+#ifdef PIXEL_OPS_SSE2
+    if ((w * sizeof(pixel_t)) % 16 == 0 && pixel_ops_sse2()) {
+	uint32_t fill = bg * (0xffffffffU / (pixel_t) -1);
+
+	for (j = 0; j < h; j++) {
+	    if (!pixel_block_is_fill((uint8_t *) irow,
+				     w * sizeof(pixel_t), fill))
+		break;
+	    irow += vs->ds->linesize / sizeof(pixel_t);
+	}
+    } else
+#endif
     for (j = 0; j < h; j++) {
+	for (i = 0; i < w; i++)
+	    if (irow[i] != bg)
+		break;
+	if (i < w)
+	    break;
+	irow += vs->ds->linesize / sizeof(pixel_t);
+    }
+    solid = (j == h);
+    if (solid)
+	n_colors = 1;
+    irow = (pixel_t *)row;
+
+    for (j = 0; j < h && !solid; j++) {
 	for (i = 0; i < w; i++) {
 	    switch (n_colors) {
 	    case 0:
@@ -197,7 +226,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
 	}
     } else {
 	for (j = 0; j < h; j++) {
-	    vs->write_pixels(vs, row, w * vs->depth);
+	    vs->write_pixels(vs, row, w * vs->vd->depth);
 	    row += vs->ds->linesize;
 	}
     }